@@ -0,0 +1,1194 @@
+/**
+ * @author yuanluo2
+ * @brief PopCap's .pak file format and extraction core, written in C++11, only works for windows platform.
+ * 
+ * a very big thanks to https://github.com/nathaniel-daniel/popcap-pak-rs for giving 
+ * the popcap .pak file's format:
+ * 
+ * Header 
+ *   4 bytes - Magic (Should be [0xc0, 0x4a, 0xc0, 0xba])
+ *   4 bytes - Version (Should be all 0) 
+ *   loop 
+ *       1 byte  - Record Flag (exit loop if 0x80)
+ *       1 byte  - File name length (N) 
+ *       N bytes - Filename 
+ *       4 bytes - Filesize (u32)
+ *       4 bytes - Last write time (Microsoft FILETIME struct)
+ *   end
+ *
+ * Body
+ *   for each record
+ *       record.filesize bytes - File data
+ *   end
+ * 
+*/
+#ifndef POPCAP_PAK_HPP
+#define POPCAP_PAK_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include "popcap_pak_stats.hpp"
+#include "popcap_pak_storage.hpp"
+#include "popcap_pak_topology.hpp"
+#include "popcap_pak_durability.hpp"
+#include "popcap_pak_priority.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+using uchar = unsigned char;
+
+struct FileAttr {
+    std::unique_ptr<char[]> fileName;
+    uint32_t fileNameLen;
+    uint32_t fileSize;
+    FILETIME lastWriteTime;
+    uint64_t offset;    // where the file data starts in the .pak file, archives can be larger than 4 GB.
+};
+
+/*
+    magic should be 0xC0, 0x4A, 0xC0, 0xBA,
+    version should be all 0x00.
+*/
+struct Header {
+    std::array<uchar, 4> magic;
+    std::array<uchar, 4> version;
+    std::vector<FileAttr> fileAttrList;
+    uint64_t headerSize;    // file data starts right after the header.
+};
+
+template<typename CharType>
+uchar decode_one_byte(CharType c) {
+    // using 0xf7 to decode the data in .pak file.
+    return static_cast<uchar>(c ^ 0xf7);
+}
+
+template<typename CharType>
+void decode_bytes(CharType* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        data[i] = decode_one_byte(data[i]);
+    }
+}
+
+// xor is its own inverse, encoding is the same operation as decoding.
+template<typename CharType>
+void encode_bytes(CharType* data, size_t len) {
+    decode_bytes(data, len);
+}
+
+class HeaderParser {
+    uint64_t bytesParsed = 0;
+
+    /*
+        every read in the header goes through here, a short read means
+        the pak file is truncated, so we stop at once instead of parsing garbage.
+    */
+    bool read_bytes(std::ifstream& f, char* buf, size_t len) {
+        f.read(buf, len);
+
+        if (static_cast<size_t>(f.gcount()) != len) {
+            std::cerr << "pak header is truncated at offset " << bytesParsed + f.gcount() << "\n";
+            return false;
+        }
+
+        bytesParsed += len;
+        return true;
+    }
+
+    bool is_pak_header_end(std::ifstream& f, bool& end) {
+        char c;
+
+        if (!read_bytes(f, &c, 1)) {
+            return false;
+        }
+
+        end = decode_one_byte(c) == 0x80;
+        return true;
+    }
+
+    bool parse_magic(Header& header, std::ifstream& f) {
+        if (!read_bytes(f, (char*)(header.magic.data()), header.magic.size())) {
+            return false;
+        }
+
+        decode_bytes(header.magic.data(), header.magic.size());
+        return true;
+    }
+
+    bool parse_version(Header& header, std::ifstream& f) {
+        if (!read_bytes(f, (char*)(header.version.data()), header.version.size())) {
+            return false;
+        }
+
+        decode_bytes(header.version.data(), header.version.size());
+        return true;
+    }
+
+    std::unique_ptr<char[]> init_file_name(size_t size) {
+        return std::unique_ptr<char[]>(new char[size]);
+    }
+
+    bool parse_file_name(FileAttr& attr, std::ifstream& f) {
+        char c;
+        
+        if (!read_bytes(f, &c, 1)) {
+            return false;
+        }
+
+        // get the length of the file name.
+        uint32_t fileNameLen = (uint32_t)decode_one_byte(c);
+        attr.fileName = init_file_name(fileNameLen + 1);
+        attr.fileName[fileNameLen] = '\0';
+        attr.fileNameLen = fileNameLen;
+
+        // get file name.
+        if (!read_bytes(f, attr.fileName.get(), fileNameLen)) {
+            return false;
+        }
+
+        decode_bytes(attr.fileName.get(), fileNameLen);
+        return true;
+    }
+
+    bool parse_file_size(FileAttr& attr, std::ifstream& f) {
+        constexpr uint32_t FILE_SIZE_BYTES = 4;
+
+        if (!read_bytes(f, (char*)(&(attr.fileSize)), FILE_SIZE_BYTES)) {
+            return false;
+        }
+
+        decode_bytes((char*)(&(attr.fileSize)), FILE_SIZE_BYTES);
+        return true;
+    }
+
+    bool parse_file_last_write_time(FileAttr& attr, std::ifstream& f) {
+        if (!read_bytes(f, (char*)(&(attr.lastWriteTime)), sizeof(FILETIME))) {
+            return false;
+        }
+
+        decode_bytes((char*)(&(attr.lastWriteTime)), sizeof(FILETIME));
+        return true;
+    }
+public:
+    HeaderParser() = default;
+
+    void compute_file_offsets(Header& header) {
+        uint64_t offset = header.headerSize;
+
+        for (FileAttr& attr : header.fileAttrList) {
+            attr.offset = offset;
+            offset += attr.fileSize;
+        }
+    }
+
+    bool parse(Header& header, std::ifstream& f) {
+        TraceSpan span{ "header_parse" };
+        bool end = false;
+        bytesParsed = 0;
+
+        if (!parse_magic(header, f) || !parse_version(header, f)) {
+            return false;
+        }
+
+        while (true) {
+            if (!is_pak_header_end(f, end)) {
+                return false;
+            }
+
+            if (end) {
+                break;
+            }
+
+            FileAttr attr;
+            if (!parse_file_name(attr, f) || 
+                !parse_file_size(attr, f) || 
+                !parse_file_last_write_time(attr, f)) {
+                return false;
+            }
+
+            header.fileAttrList.emplace_back(std::move(attr));
+        }
+
+        header.headerSize = bytesParsed;
+        compute_file_offsets(header);
+        return true;
+    }
+};
+
+/*
+    checks a parsed header against the pak file before anything is written,
+    so a corrupt or hostile pak is rejected here instead of in the middle of extraction.
+*/
+class HeaderValidator {
+    bool check_magic(const Header& header) {
+        static const std::array<uchar, 4> MAGIC = { { 0xc0, 0x4a, 0xc0, 0xba } };
+
+        if (header.magic != MAGIC) {
+            std::cerr << "bad magic, this is not a popcap .pak file\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool check_version(const Header& header) {
+        static const std::array<uchar, 4> VERSION = { { 0x00, 0x00, 0x00, 0x00 } };
+
+        if (header.version != VERSION) {
+            std::cerr << "unsupported .pak version\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool is_separator(char c) {
+        return c == '\\' || c == '/';
+    }
+
+    /*
+        file names come from the pak file, so never let them escape the extract dir:
+        no absolute paths, no drive letters, no `..` components, no empty names.
+    */
+    bool check_file_name(const FileAttr& attr) {
+        const char* name = attr.fileName.get();
+        const char* component = name;
+
+        if (attr.fileNameLen == 0 || std::strlen(name) != attr.fileNameLen) {
+            std::cerr << "invalid file name in pak header: `" << name << "`\n";
+            return false;
+        }
+
+        if (is_separator(name[0]) || std::strchr(name, ':') != nullptr) {
+            std::cerr << "absolute file name in pak header: `" << name << "`\n";
+            return false;
+        }
+
+        for (const char* cursor = name; ; ++cursor) {
+            if (*cursor == '\0' || is_separator(*cursor)) {
+                if (cursor - component == 2 && component[0] == '.' && component[1] == '.') {
+                    std::cerr << "path traversal in pak header: `" << name << "`\n";
+                    return false;
+                }
+
+                if (*cursor == '\0') {
+                    break;
+                }
+
+                component = cursor + 1;
+            }
+        }
+
+        return true;
+    }
+
+    bool check_total_size(const Header& header, uint64_t pakSize) {
+        uint64_t total = header.headerSize;
+
+        for (const FileAttr& attr : header.fileAttrList) {
+            total += attr.fileSize;
+        }
+
+        if (total != pakSize) {
+            std::cerr << "pak file size mismatch, header says " << total 
+                      << " bytes, but the file has " << pakSize << " bytes\n";
+            return false;
+        }
+
+        return true;
+    }
+public:
+    HeaderValidator() = default;
+
+    bool validate(const Header& header, uint64_t pakSize) {
+        TraceSpan span{ "header_validate" };
+
+        if (!check_magic(header) || !check_version(header)) {
+            return false;
+        }
+
+        for (const FileAttr& attr : header.fileAttrList) {
+            if (!check_file_name(attr)) {
+                return false;
+            }
+        }
+
+        return check_total_size(header, pakSize);
+    }
+};
+
+/*
+    the reverse of HeaderParser, writes an encoded header, used to build .pak files.
+*/
+class HeaderWriter {
+    void write_bytes(std::ofstream& f, const void* data, size_t len) {
+        std::array<char, 256> buf;
+
+        std::memcpy(buf.data(), data, len);
+        encode_bytes(buf.data(), len);
+        f.write(buf.data(), len);
+    }
+
+    void write_record_flag(std::ofstream& f, uchar flag) {
+        write_bytes(f, &flag, 1);
+    }
+
+    void write_file_name(const FileAttr& attr, std::ofstream& f) {
+        uchar len = static_cast<uchar>(attr.fileNameLen);
+
+        write_bytes(f, &len, 1);
+        write_bytes(f, attr.fileName.get(), attr.fileNameLen);
+    }
+public:
+    HeaderWriter() = default;
+
+    /*
+        file names longer than 255 bytes can't be stored, returns false for them.
+    */
+    bool write(const Header& header, std::ofstream& f) {
+        write_bytes(f, header.magic.data(), header.magic.size());
+        write_bytes(f, header.version.data(), header.version.size());
+
+        for (const FileAttr& attr : header.fileAttrList) {
+            if (attr.fileNameLen > 255) {
+                return false;
+            }
+
+            write_record_flag(f, 0x00);
+            write_file_name(attr, f);
+            write_bytes(f, &(attr.fileSize), 4);
+            write_bytes(f, &(attr.lastWriteTime), sizeof(FILETIME));
+        }
+
+        write_record_flag(f, 0x80);
+        return static_cast<bool>(f);
+    }
+};
+
+class WinFile {
+    HANDLE hFile;
+public:
+    static const char* name() { return "winfile"; }
+
+    WinFile() : hFile{ INVALID_HANDLE_VALUE } {}
+
+    WinFile(const WinFile&) = delete;
+    WinFile& operator=(const WinFile&) = delete;
+
+    WinFile(WinFile&& other) noexcept {
+        if (this != &other) {
+            hFile = other.hFile;
+            other.hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    WinFile& operator=(WinFile&& other) noexcept {
+        if (this != &other) {
+            hFile = other.hFile;
+            other.hFile = INVALID_HANDLE_VALUE;
+        }
+
+        return *this;
+    }
+
+    ~WinFile() noexcept {
+        close();
+    }
+
+    void close() noexcept {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        hFile = CreateFile(path, 
+                            GENERIC_WRITE,
+                            0,
+                            nullptr,
+                            CREATE_NEW,
+                            FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+
+        if (hFile == INVALID_HANDLE_VALUE) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+        else {
+            ec.clear();
+            return true;
+        }
+    }
+
+    bool write_data(const char* data, DWORD len, std::error_code& ec) noexcept {
+        if (!WriteFile(hFile, data, len, nullptr, nullptr)) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+        else {
+            ec.clear();
+            return true;
+        }
+    }
+
+    bool set_file_time(const FILETIME& ft, std::error_code& ec) noexcept {
+        if (!SetFileTime(hFile, nullptr, nullptr, &ft)) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+        else {
+            ec.clear();
+            return true;
+        }
+    }
+};
+
+/*
+    FILE_FLAG_NO_BUFFERING, the windows O_DIRECT, needs the offset, size and memory of every
+    transfer aligned to the sector size, 4096 covers both 512 and 4K sector disks.
+    the aligned blocks are recycled, so a worker doesn't VirtualAlloc() for every file.
+    every NUMA node has its own free list, a block is allocated on the node of the worker that
+    asks for it and goes back to that list, so it never ends up with a worker of another node.
+*/
+constexpr size_t DIRECT_ALIGNMENT = 4096;
+constexpr size_t DIRECT_BLOCK_SIZE = 1 << 20;
+
+class AlignedBufferPool {
+    struct FreeList {
+        std::mutex mutex;
+        std::vector<char*> blocks;
+    };
+
+    std::vector<std::unique_ptr<FreeList>> nodes;
+
+    AlignedBufferPool() {
+        ULONG highest = 0;
+
+        if (!GetNumaHighestNodeNumber(&highest)) {
+            highest = 0;
+        }
+
+        for (ULONG i = 0; i <= highest; ++i) {
+            nodes.emplace_back(new FreeList);
+        }
+    }
+public:
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    ~AlignedBufferPool() {
+        for (const std::unique_ptr<FreeList>& list : nodes) {
+            for (char* block : list->blocks) {
+                VirtualFree(block, 0, MEM_RELEASE);
+                MemoryStats::instance().record_free(DIRECT_BLOCK_SIZE);
+            }
+        }
+    }
+
+    static AlignedBufferPool& instance() {
+        static AlignedBufferPool pool;
+        return pool;
+    }
+
+    unsigned node_count() const noexcept {
+        return static_cast<unsigned>(nodes.size());
+    }
+
+    // a DIRECT_BLOCK_SIZE block on `node`, page aligned, null if out of memory.
+    char* acquire(unsigned node) {
+        FreeList& list = *nodes[node % nodes.size()];
+
+        {
+            std::lock_guard<std::mutex> lock{ list.mutex };
+
+            if (!list.blocks.empty()) {
+                char* block = list.blocks.back();
+                list.blocks.pop_back();
+                return block;
+            }
+        }
+
+        char* block = static_cast<char*>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, DIRECT_BLOCK_SIZE,
+                                                            MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE, node % nodes.size()));
+
+        if (block != nullptr) {
+            MemoryStats::instance().record_alloc(DIRECT_BLOCK_SIZE, MemPhase::Buffers);
+        }
+
+        return block;
+    }
+
+    void release(char* block, unsigned node) {
+        if (block != nullptr) {
+            FreeList& list = *nodes[node % nodes.size()];
+            std::lock_guard<std::mutex> lock{ list.mutex };
+            list.blocks.push_back(block);
+        }
+    }
+};
+
+class PooledBlock {
+    unsigned node;
+    char* block;
+public:
+    PooledBlock() : PooledBlock{ current_numa_node() } {}
+
+    // on `n`, for a worker whose thread may not be on its node yet.
+    explicit PooledBlock(unsigned n) : node{ n }, block{ AlignedBufferPool::instance().acquire(node) } {}
+
+    PooledBlock(const PooledBlock&) = delete;
+    PooledBlock& operator=(const PooledBlock&) = delete;
+
+    ~PooledBlock() {
+        AlignedBufferPool::instance().release(block, node);
+    }
+
+    char* data() const noexcept {
+        return block;
+    }
+};
+
+/*
+    WinFile without the file cache. writes are staged in an aligned block and go out a whole
+    block at a time, the tail is padded to the alignment and the file is cut back to its real
+    size after it, so callers can write any length like with WinFile.
+*/
+class DirectFile {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    PooledBlock stage;
+    size_t staged = 0;
+    uint64_t written = 0;
+
+    bool write_block(size_t len, std::error_code& ec) noexcept {
+        DWORD done = 0;
+
+        if (!WriteFile(hFile, stage.data(), static_cast<DWORD>(len), &done, nullptr) || done != len) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool flush_tail(std::error_code& ec) noexcept {
+        if (staged == 0) {
+            return true;
+        }
+
+        size_t padded = (staged + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+        LARGE_INTEGER li;
+
+        std::memset(stage.data() + staged, 0, padded - staged);
+        if (!write_block(padded, ec)) {
+            return false;
+        }
+
+        written += staged;
+        staged = 0;
+        li.QuadPart = static_cast<LONGLONG>(written);
+
+        if (!SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN) || !SetEndOfFile(hFile)) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+
+        return true;
+    }
+public:
+    static const char* name() { return "direct"; }
+
+    DirectFile() = default;
+    DirectFile(const DirectFile&) = delete;
+    DirectFile& operator=(const DirectFile&) = delete;
+
+    ~DirectFile() noexcept {
+        close();
+    }
+
+    void close() noexcept {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            std::error_code ec;
+            flush_tail(ec);
+            CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        if (stage.data() == nullptr) {
+            ec = std::make_error_code(std::errc::not_enough_memory);
+            return false;
+        }
+
+        hFile = CreateFile(path, GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_FLAG_NO_BUFFERING, nullptr);
+
+        if (hFile == INVALID_HANDLE_VALUE) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* data, DWORD len, std::error_code& ec) noexcept {
+        while (len > 0) {
+            size_t n = (std::min)(static_cast<size_t>(len), DIRECT_BLOCK_SIZE - staged);
+
+            std::memcpy(stage.data() + staged, data, n);
+            staged += n;
+            data += n;
+            len -= static_cast<DWORD>(n);
+
+            if (staged == DIRECT_BLOCK_SIZE) {
+                if (!write_block(DIRECT_BLOCK_SIZE, ec)) {
+                    return false;
+                }
+
+                written += DIRECT_BLOCK_SIZE;
+                staged = 0;
+            }
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    // the tail goes out first, writing it later would change the last write time again.
+    bool set_file_time(const FILETIME& ft, std::error_code& ec) noexcept {
+        if (!flush_tail(ec)) {
+            return false;
+        }
+
+        if (!SetFileTime(hFile, nullptr, nullptr, &ft)) {
+            ec.assign(GetLastError(), std::system_category());
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+};
+
+/*
+    the part of std::ifstream the extraction loop uses, reading without the file cache.
+    whole aligned blocks are read into a pooled window and copied out from there,
+    so reads can start at any offset and have any length.
+*/
+class DirectReader {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    PooledBlock window;
+    uint64_t windowStart = 0;
+    size_t windowLen = 0;
+    uint64_t pos = 0;
+    std::streamsize lastRead = 0;
+    bool good = false;
+public:
+    DirectReader() = default;
+
+    explicit DirectReader(const char* path, std::ios::openmode = std::ios::binary) {
+        open(path);
+    }
+
+    DirectReader(const DirectReader&) = delete;
+    DirectReader& operator=(const DirectReader&) = delete;
+
+    ~DirectReader() noexcept {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+
+    bool open(const char* path) noexcept {
+        if (window.data() != nullptr) {
+            hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+        }
+
+        good = hFile != INVALID_HANDLE_VALUE;
+        return good;
+    }
+
+    bool is_open() const noexcept {
+        return hFile != INVALID_HANDLE_VALUE;
+    }
+
+    explicit operator bool() const noexcept {
+        return good;
+    }
+
+    std::streamsize gcount() const noexcept {
+        return lastRead;
+    }
+
+    DirectReader& seekg(std::streamoff off, std::ios::seekdir dir) noexcept {
+        pos = dir == std::ios::cur ? pos + off : static_cast<uint64_t>(off);
+        good = is_open();
+        return *this;
+    }
+
+    // a short read clears the good state, like a stream hitting the end of file.
+    DirectReader& read(char* buf, std::streamsize len) noexcept {
+        size_t done = 0;
+
+        while (good && done < static_cast<size_t>(len)) {
+            if (pos < windowStart || pos >= windowStart + windowLen) {
+                OVERLAPPED ov{};
+                DWORD readLen = 0;
+
+                windowStart = pos & ~static_cast<uint64_t>(DIRECT_ALIGNMENT - 1);
+                ov.Offset = static_cast<DWORD>(windowStart & 0xffffffffu);
+                ov.OffsetHigh = static_cast<DWORD>(windowStart >> 32);
+
+                if (!ReadFile(hFile, window.data(), static_cast<DWORD>(DIRECT_BLOCK_SIZE), &readLen, &ov)) {
+                    readLen = 0;
+                }
+
+                windowLen = readLen;
+                if (pos >= windowStart + windowLen) {
+                    good = false;       // end of file or a read error.
+                    break;
+                }
+            }
+
+            size_t n = (std::min)(static_cast<size_t>(windowStart + windowLen - pos), static_cast<size_t>(len) - done);
+
+            std::memcpy(buf + done, window.data() + (pos - windowStart), n);
+            done += n;
+            pos += n;
+        }
+
+        lastRead = static_cast<std::streamsize>(done);
+        return *this;
+    }
+};
+
+inline void save_file_attr_list(const Header& header, const char* savPath) {
+    std::ofstream out{ savPath };
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        out << attr.fileName.get() << ", " << attr.fileSize << "\n";
+    }
+
+    std::cout << "file attributes are saved at `" << savPath << "`\n";
+    std::cout << "this .pak file has " << header.fileAttrList.size() << " files\n";
+}
+
+inline bool is_dir_exist(const char* path) {
+    DWORD dwAttrib = GetFileAttributes(path);
+
+    return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
+            (dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
+}
+
+/*
+    concatenate 2 paths, only for windows platform.
+*/
+inline void path_concatenate(std::array<char, MAX_PATH>& buf, const char* parent, const char* sub) {
+    bool hasBackslash = false;
+    char* cursor = buf.data();
+
+    while (*parent != '\0') {
+        *cursor = *parent;
+
+        ++cursor;
+        ++parent;
+    }
+
+    --parent;
+    if (*parent == '\\') {
+        hasBackslash = true;
+    }
+
+    if (*sub != '\\' && !hasBackslash) {
+        *cursor = '\\';
+        ++cursor;
+    }
+
+    if (*sub == '\\' && hasBackslash) {
+        ++sub;
+    }
+
+    while (*sub != '\0') {
+        *cursor = *sub;
+
+        ++cursor;
+        ++sub;
+    }
+
+    *cursor = '\0';
+}
+
+/*
+    constructs all parent directories of the given path if they're not exist.
+*/
+inline bool construct_parent_dirs(char* path, std::error_code& ec) {
+    char* cursor = path;
+
+    while (*cursor != '\0') {
+        if (*cursor == '\\') {
+            /* 
+                CreateDirectory() needs a null terminated string, so we can play a trick here.
+                this is why this function's arguments just need a char*, with this
+                operation, we won't do any copy on the path.
+            */
+            *cursor = '\0';
+
+            if (!is_dir_exist(path)) {
+                // another worker may create the same dir between the check and here.
+                if (CreateDirectory(path, nullptr)) {
+                    DurabilityTracker::instance().dir_created(path);
+                }
+                else if (GetLastError() != ERROR_ALREADY_EXISTS) {
+                    ec.assign(GetLastError(), std::system_category());
+                    return false;
+                }
+            }
+
+            // reset back.
+            *cursor = '\\';
+        }
+
+        ++cursor;
+    }
+
+    ec.clear();
+    return true;
+}
+
+/*
+    std::streamoff is 64-bit, so seeking by the absolute offset works for archives larger than 4 GB.
+*/
+template<typename Input>
+bool seek_to_next_file(const FileAttr& attr, Input& f) {
+    f.seekg(static_cast<std::streamoff>(attr.offset + attr.fileSize), std::ios::beg);
+    return static_cast<bool>(f);
+}
+
+/*
+    what became of one file. a failed file was skipped and the extraction goes on,
+    after a fatal one the pak can't be read any further.
+*/
+enum class FileOutcome {
+    Saved,
+    Failed,
+    Fatal
+};
+
+template<typename Input>
+FileOutcome skip_to_next_file(const FileAttr& attr, Input& f) {
+    return seek_to_next_file(attr, f) ? FileOutcome::Failed : FileOutcome::Fatal;
+}
+
+/*
+    `stats` can be null, then nothing is measured.
+    `Input` is std::ifstream or DirectReader, `Output` is WinFile or DirectFile.
+*/
+template<typename Output = WinFile, typename Input, size_t N>
+FileOutcome save_single_file_data(const FileAttr& attr, Input& f, std::array<char, N>& buf, const char* filePath, ExtractStats* stats = nullptr) {
+    uint32_t fileSize = attr.fileSize;
+    uint32_t readLen = 0;
+    std::error_code ec;
+    Output wf;
+    ProgressSlot* progress = stats != nullptr ? stats->progress : nullptr;
+    bool opened;
+
+    {
+        PhaseTimer timer{ stats, Phase::Open };
+        opened = wf.init(filePath, ec);
+    }
+    
+    if (!opened) {
+        std::cerr << "create file failed: `" << filePath << "`, " << ec.message() << "\n";
+
+        // skip this file's data, otherwise all the files after it are garbage.
+        return skip_to_next_file(attr, f);
+    }
+
+    while (fileSize > 0) {
+        {
+            PhaseTimer timer{ stats, Phase::Read };
+
+            if (fileSize < buf.size()) {
+                f.read(buf.data(), fileSize);
+            }
+            else {
+                f.read(buf.data(), buf.size());
+            }
+        }
+
+        readLen = f.gcount();
+        if (readLen == 0) {
+            std::cerr << "unexpected end of pak file while reading `" << filePath << "`\n";
+            return FileOutcome::Fatal;
+        }
+
+        {
+            PhaseTimer timer{ stats, Phase::Decode };
+            decode_bytes(buf.data(), readLen);
+        }
+
+        bool written;
+        {
+            PhaseTimer timer{ stats, Phase::Write };
+            written = wf.write_data(buf.data(), readLen, ec);
+        }
+
+        if (!written) {
+            std::cerr << "write to file failed for file `" << filePath << "`, " << ec.message() << "\n";
+            return skip_to_next_file(attr, f);
+        }    
+        
+        if (progress != nullptr) {
+            progress->add_bytes(readLen);
+        }
+
+        fileSize -= readLen;
+    }
+
+    bool timeSet;
+    {
+        PhaseTimer timer{ stats, Phase::SetTime };
+        timeSet = wf.set_file_time(attr.lastWriteTime, ec);
+    }
+
+    if (!timeSet) {
+        std::cerr << "set last write time failed for file `" << filePath << "`, " << ec.message() << "\n";
+    }
+
+    {
+        PhaseTimer timer{ stats, Phase::Close };
+        wf.close();
+    }
+
+    // with no durability file_done() returns at once, timing it would only add an empty sync phase.
+    if (DurabilityTracker::instance().durability() != Durability::None) {
+        PhaseTimer timer{ stats, Phase::Sync };
+        DurabilityTracker::instance().file_done(filePath);
+    }
+
+    return FileOutcome::Saved;
+}
+
+/*
+    creates the parent dirs of one file and saves it, `f` must be at the file's data.
+    only saved files count into the files and bytes of `stats`, the others into its failed files.
+*/
+template<typename Output = WinFile, typename Input, size_t N>
+FileOutcome save_one_file(const FileAttr& attr, Input& f, std::array<char, N>& buf, 
+                   std::array<char, MAX_PATH>& pathBuf, const char* rootPath, ExtractStats* stats) {
+    std::error_code ec;
+    uint64_t start = stats != nullptr ? now_ticks() : 0;
+    ProgressSlot* progress = stats != nullptr ? stats->progress : nullptr;
+    TraceSpan span{ "file", attr.fileName.get() };
+    FileOutcome outcome;
+    bool created;
+
+    if (progress != nullptr) {
+        progress->begin_file(attr.fileName.get());
+    }
+
+    path_concatenate(pathBuf, rootPath, attr.fileName.get());
+
+    {
+        PhaseTimer timer{ stats, Phase::CreateDirs };
+        created = construct_parent_dirs(pathBuf.data(), ec);
+    }
+    
+    if (!created) {
+        std::cerr << "create dir failed for `" << pathBuf.data() << "`, " << ec.message() << "\n";
+        outcome = skip_to_next_file(attr, f);
+    }
+    else {
+        outcome = save_single_file_data<Output>(attr, f, buf, pathBuf.data(), stats);
+    }
+
+    if (outcome == FileOutcome::Fatal) {
+        return outcome;
+    }
+
+    if (progress != nullptr) {
+        progress->end_file(attr.fileSize, outcome == FileOutcome::Saved);
+    }
+
+    if (stats != nullptr) {
+        stats->add_file(attr.fileSize, now_ticks() - start, outcome == FileOutcome::Saved);
+        stats->file_done(attr, outcome == FileOutcome::Saved);
+    }
+
+    return outcome;
+}
+
+template<typename Output = WinFile, typename Input>
+bool save_file_data(const Header& header, Input& f, const char* rootPath, ExtractStats* stats = nullptr) {
+    std::array<char, 8192> buf;
+    std::array<char, MAX_PATH> pathBuf;
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        if (save_one_file<Output>(attr, f, buf, pathBuf, rootPath, stats) == FileOutcome::Fatal) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    the index of the next file for worker `id`, parks first if the controller holds it back.
+*/
+inline size_t take_next_file(NodeWorkQueues& queues, unsigned queue, ConcurrencyController* controller, unsigned id) {
+    if (controller != nullptr) {
+        controller->wait_turn(id);
+    }
+
+    return queues.take(queue);
+}
+
+/*
+    the first exception of the workers of one extraction. it can't leave a worker thread, so the
+    worker keeps it here and stops, and the extraction throws it again after the join.
+*/
+class WorkerError {
+    std::mutex mutex;
+    std::exception_ptr first;
+public:
+    // call it in a catch block.
+    void keep() {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        if (!first) {
+            first = std::current_exception();
+        }
+    }
+
+    void rethrow() const {
+        if (first) {
+            std::rethrow_exception(first);
+        }
+    }
+};
+
+/*
+    every worker opens its own stream on the pak file and seeks to the offset of each file,
+    files are handed out through atomic counters, one per NUMA node if WorkerPlacement is
+    enabled, so workers never wait on each other. each worker counts into its own ExtractStats, they're merged into `stats` at the end.
+    if `stats->progress` is set, it must point to `threadNum` slots, one per worker.
+    with a `controller`, it starts `controller->max_workers()` workers instead and lets it
+    decide how many of them run.
+*/
+template<typename Input = std::ifstream, typename Output = WinFile>
+bool save_file_data_parallel(const Header& header, const char* pakPath, const char* rootPath, 
+                                    unsigned threadNum, ExtractStats* stats = nullptr, 
+                                    ConcurrencyController* controller = nullptr) {
+    const WorkerPlacement& placement = WorkerPlacement::instance();
+    NodeWorkQueues queues{ header.fileAttrList.size(), placement.queue_count() };
+    std::atomic<bool> failed{ false };
+    WorkerError error;
+    std::vector<std::thread> workers;
+
+    if (controller != nullptr) {
+        threadNum = controller->max_workers();
+    }
+
+    std::vector<ExtractStats> workerStats(threadNum);
+
+    for (unsigned i = 0; i < threadNum; ++i) {
+        workerStats[i].init_worker(stats, i);
+    }
+
+    auto work = [&](unsigned id) {
+        try {
+            unsigned queue = placement.place(id);
+            TraceSpan span{ "worker" };
+            Input f{ pakPath, std::ios::binary };
+            std::array<char, 8192> buf;
+            std::array<char, MAX_PATH> pathBuf;
+            ExtractStats* ws = stats != nullptr ? &workerStats[id] : nullptr;
+
+            if (!f.is_open()) {
+                std::cerr << "can't open file: `" << pakPath << "`\n";
+                failed = true;
+                return;
+            }
+
+            for (size_t i = take_next_file(queues, queue, controller, id); i < header.fileAttrList.size() && !failed; 
+                        i = take_next_file(queues, queue, controller, id)) {
+                const FileAttr& attr = header.fileAttrList[i];
+                f.seekg(static_cast<std::streamoff>(attr.offset), std::ios::beg);
+
+                if (save_one_file<Output>(attr, f, buf, pathBuf, rootPath, ws) == FileOutcome::Fatal) {
+                    failed = true;
+                }
+
+                if (controller != nullptr) {
+                    controller->add_bytes(attr.fileSize);
+                }
+            }
+
+            if (controller != nullptr) {
+                controller->finish();
+            }
+        }
+        catch (...) {
+            // a worker thread can't let it out, it would end the process.
+            error.keep();
+            failed = true;
+
+            if (controller != nullptr) {
+                controller->finish();
+            }
+        }
+    };
+
+    if (controller != nullptr) {
+        controller->start_control();
+    }
+
+    for (unsigned i = 0; i < threadNum; ++i) {
+        workers.emplace_back(work, i);
+    }
+
+    for (std::thread& t : workers) {
+        t.join();
+    }
+
+    if (controller != nullptr) {
+        controller->stop();
+    }
+
+    if (stats != nullptr) {
+        for (const ExtractStats& ws : workerStats) {
+            stats->merge(ws);
+        }
+    }
+
+    error.rethrow();
+    return !failed;
+}
+
+inline uint64_t get_pak_file_size(std::ifstream& f) {
+    f.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(f.tellg());
+    f.seekg(0, std::ios::beg);
+
+    return size;
+}
+
+#endif // POPCAP_PAK_HPP
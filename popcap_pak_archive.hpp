@@ -0,0 +1,305 @@
+/**
+ * @author yuanluo2
+ * @brief hot-swappable archive reader for long-running processes, written in C++11, only works for windows platform.
+ *
+ * a generation is the mapping of one pak plus its CompactIndex. reload() builds the next one off
+ * to the side and publishes it with one atomic store, lookups never take a lock and never wait
+ * for a reload.
+ *
+ * old generations are freed with epoch based reclamation: a reader announces the global epoch in
+ * its slot while it holds a ArchiveReader::Pin, and clears it after. a retired generation is freed
+ * once every announced epoch is newer than the epoch it was retired in, so nobody can still point
+ * into it. the slots are shared by all readers of the process, EPOCH_SLOTS threads may read at
+ * once, more wait for a free slot.
+*/
+#ifndef POPCAP_PAK_ARCHIVE_HPP
+#define POPCAP_PAK_ARCHIVE_HPP
+
+#include "popcap_pak_io.hpp"
+#include "popcap_pak_index.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+constexpr unsigned EPOCH_SLOTS = 128;
+
+/*
+    the epoch slots of the process, one cache line each.
+*/
+class EpochDomain {
+    struct Slot {
+        std::atomic<uint64_t> epoch{ 0 };   // 0 while the thread reads nothing.
+        std::atomic<bool> owned{ false };
+        char pad[128 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+    };
+
+    // a thread keeps its slot until it exits.
+    struct ThreadSlot {
+        Slot* slot = nullptr;
+        unsigned depth = 0;
+
+        ~ThreadSlot() {
+            if (slot != nullptr) {
+                slot->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::unique_ptr<Slot[]> slots{ new Slot[EPOCH_SLOTS] };
+    std::atomic<uint64_t> global{ 1 };
+
+    EpochDomain() = default;
+
+    Slot* claim_slot() {
+        while (true) {
+            for (unsigned i = 0; i < EPOCH_SLOTS; ++i) {
+                bool expected = false;
+
+                if (!slots[i].owned.load(std::memory_order_relaxed) &&
+                    slots[i].owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    return &slots[i];
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    static ThreadSlot& this_thread_slot() {
+        thread_local ThreadSlot ts;
+        return ts;
+    }
+public:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // pins can nest, only the outermost one announces.
+    void enter() {
+        ThreadSlot& ts = this_thread_slot();
+
+        if (ts.slot == nullptr) {
+            ts.slot = claim_slot();
+        }
+
+        if (ts.depth++ == 0) {
+            // seq_cst, the announcement must be visible before the pointer is loaded.
+            ts.slot->epoch.store(global.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+
+    void leave() {
+        ThreadSlot& ts = this_thread_slot();
+
+        if (--ts.depth == 0) {
+            ts.slot->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // the epoch something retired now belongs to, readers after it can't see it.
+    uint64_t advance() {
+        return global.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // the oldest epoch a reader still holds, UINT64_MAX if nobody reads.
+    uint64_t oldest_active() const {
+        uint64_t oldest = UINT64_MAX;
+
+        for (unsigned i = 0; i < EPOCH_SLOTS; ++i) {
+            uint64_t e = slots[i].epoch.load(std::memory_order_seq_cst);
+
+            if (e != 0 && e < oldest) {
+                oldest = e;
+            }
+        }
+
+        return oldest;
+    }
+};
+
+class ArchiveReader {
+    struct Generation {
+        MappedSource mapped;
+        CompactIndex index;
+        std::string path;
+        uint64_t number;
+    };
+
+    struct Retired {
+        Generation* gen;
+        uint64_t epoch;
+    };
+
+    std::atomic<Generation*> current{ nullptr };
+    std::mutex reloadMutex;         // reloads are rare, they just take turns.
+    std::vector<Retired> retired;
+    uint64_t generations = 0;
+
+    static Generation* load_generation(const char* pakPath, uint64_t number) {
+        std::unique_ptr<Generation> gen{ new Generation };
+        Header header;
+        HeaderParser parser;
+        HeaderValidator validator;
+        std::error_code ec;
+
+        // the mapping first, the header is checked against the file that is actually mapped.
+        if (!gen->mapped.init(pakPath, ec)) {
+            std::cerr << "can't map file: `" << pakPath << "`, " << ec.message() << "\n";
+            return nullptr;
+        }
+
+        std::ifstream f{ pakPath, std::ios::binary };
+        if (!f.is_open()) {
+            std::cerr << "can't open file: `" << pakPath << "`\n";
+            return nullptr;
+        }
+
+        if (!parser.parse(header, f) || !validator.validate(header, gen->mapped.file_size())) {
+            std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+            return nullptr;
+        }
+
+        gen->index.build(header);
+        gen->path = pakPath;
+        gen->number = number;
+        return gen.release();
+    }
+
+    // call with reloadMutex held.
+    size_t reclaim() {
+        uint64_t oldest = EpochDomain::instance().oldest_active();
+        size_t freed = 0;
+
+        for (size_t i = 0; i < retired.size(); ) {
+            if (retired[i].epoch < oldest) {
+                delete retired[i].gen;
+                retired[i] = retired.back();
+                retired.pop_back();
+                freed++;
+            }
+            else {
+                ++i;
+            }
+        }
+
+        return freed;
+    }
+public:
+    /*
+        keeps the current generation alive while it's in scope, lookups go through it.
+        pins are cheap, take one per request, not one per thread.
+    */
+    class Pin {
+        const Generation* gen;
+    public:
+        explicit Pin(const ArchiveReader& reader) {
+            EpochDomain::instance().enter();
+            gen = reader.current.load(std::memory_order_seq_cst);
+        }
+
+        ~Pin() {
+            EpochDomain::instance().leave();
+        }
+
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+
+        bool valid() const noexcept {
+            return gen != nullptr;
+        }
+
+        uint64_t generation() const noexcept {
+            return gen->number;
+        }
+
+        const CompactIndex& index() const noexcept {
+            return gen->index;
+        }
+
+        // the still encoded pak file, valid while the pin lives.
+        const char* data() const noexcept {
+            return gen->mapped.data();
+        }
+
+        /*
+            copies the decoded data of `name` into `out`, false if the pak has no such file.
+        */
+        bool read(const char* name, std::vector<char>& out) const {
+            IndexEntry entry;
+
+            if (gen == nullptr || !gen->index.find(name, entry)) {
+                return false;
+            }
+
+            out.assign(gen->mapped.data() + entry.offset, gen->mapped.data() + entry.offset + entry.fileSize);
+            decode_bytes(out.data(), out.size());
+            return true;
+        }
+    };
+
+    ArchiveReader() = default;
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    // no Pin may outlive the reader.
+    ~ArchiveReader() {
+        delete current.load();
+
+        for (const Retired& r : retired) {
+            delete r.gen;
+        }
+    }
+
+    bool open(const char* pakPath) {
+        return reload(pakPath);
+    }
+
+    /*
+        maps and indexes `pakPath`, then swaps it in. on failure the old generation stays.
+        a deploy writes the new pak next to the old one and renames it over, the old mapping
+        keeps the old data until its last reader is done.
+    */
+    bool reload(const char* pakPath) {
+        std::lock_guard<std::mutex> lock{ reloadMutex };
+        Generation* next = load_generation(pakPath, generations + 1);
+
+        if (next == nullptr) {
+            return false;
+        }
+
+        generations++;
+        Generation* old = current.exchange(next, std::memory_order_seq_cst);
+
+        if (old != nullptr) {
+            retired.push_back(Retired{ old, EpochDomain::instance().advance() });
+        }
+
+        reclaim();
+        return true;
+    }
+
+    /*
+        frees the retired generations nobody reads anymore, the number still waiting.
+        reload() does this too, call it now and then if reloads are far apart.
+    */
+    size_t collect() {
+        std::lock_guard<std::mutex> lock{ reloadMutex };
+        reclaim();
+        return retired.size();
+    }
+
+    uint64_t generation() const noexcept {
+        Pin pin{ *this };
+        return pin.valid() ? pin.generation() : 0;
+    }
+};
+
+#endif // POPCAP_PAK_ARCHIVE_HPP
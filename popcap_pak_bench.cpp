@@ -0,0 +1,695 @@
+/**
+ * @author yuanluo2
+ * @brief benchmark suite for the .pak extractor, written in C++11.
+ *
+ * microbenchmarks for every stage (decode, header parse, pak read, file write) and
+ * end-to-end extraction over the corpus profiles and thread counts, optionally
+ * comparing the C and C++ frontend executables, plus a matrix of the I/O backends in
+ * popcap_pak_io.hpp over buffer sizes and warm or cold cache, and a matrix of the templated
+ * engine over every source, decoder and sink next to a handwritten loop. results are written as
+ * JSON, and a previous JSON file can be given as baseline to catch regressions.
+*/
+#include "popcap_pak_tune.hpp"
+
+#include <chrono>
+#include <string>
+#include <sstream>
+
+/*
+    cpu time and I/O operations are of this process only, they don't cover the frontend executables.
+*/
+struct BenchSample {
+    double seconds;     // best of all repeats, negative if the benchmark failed.
+    double cpuSeconds;  // user + kernel time of the best repeat.
+    uint64_t ioOps;     // read, write and other I/O operations of the best repeat, close to the syscall count.
+};
+
+struct BenchResult {
+    std::string name;
+    BenchSample sample;
+    uint64_t bytes;
+    uint64_t items;
+};
+
+struct BenchOptions {
+    std::vector<std::string> profiles = { "tiny", "small" };
+    std::vector<unsigned> threads = { 1, 2, 4, 8 };
+    unsigned repeat = 3;
+    std::string workDir = "popcap_bench_tmp";
+    std::string outPath;
+    std::string baselinePath;
+    double threshold = 0.05;
+    std::string cExtractor;
+    std::string cppExtractor;
+    std::vector<std::string> backends;      // empty skips the backend matrix.
+    std::vector<std::string> engines;       // empty skips the engine matrix.
+    std::vector<size_t> bufferSizes = { 4 << 10, 64 << 10, 1 << 20 };
+    std::vector<std::string> caches = { "warm", "cold" };
+};
+
+inline double filetime_to_seconds(const FILETIME& ft) {
+    return ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 1e7;
+}
+
+BenchSample read_process_counters() {
+    FILETIME creation, exit, kernel, user;
+    IO_COUNTERS io{};
+    BenchSample s{ 0.0, 0.0, 0 };
+
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        s.cpuSeconds = filetime_to_seconds(kernel) + filetime_to_seconds(user);
+    }
+
+    if (GetProcessIoCounters(GetCurrentProcess(), &io)) {
+        s.ioOps = io.ReadOperationCount + io.WriteOperationCount + io.OtherOperationCount;
+    }
+
+    return s;
+}
+
+/*
+    runs `setup` untimed and then `fn` timed, `repeat` times, and keeps the best run.
+*/
+template<typename Setup, typename Fn>
+BenchSample time_best(unsigned repeat, Setup setup, Fn fn) {
+    BenchSample best{ -1.0, 0.0, 0 };
+
+    for (unsigned i = 0; i < repeat; ++i) {
+        setup();
+
+        BenchSample before = read_process_counters();
+        auto start = std::chrono::steady_clock::now();
+
+        if (!fn()) {
+            return BenchSample{ -1.0, 0.0, 0 };
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        BenchSample after = read_process_counters();
+
+        if (best.seconds < 0 || elapsed.count() < best.seconds) {
+            best.seconds = elapsed.count();
+            best.cpuSeconds = after.cpuSeconds - before.cpuSeconds;
+            best.ioOps = after.ioOps - before.ioOps;
+        }
+    }
+
+    return best;
+}
+
+template<typename Fn>
+BenchSample time_best(unsigned repeat, Fn fn) {
+    return time_best(repeat, []() {}, fn);
+}
+
+class BenchReport {
+    std::vector<BenchResult> results;
+
+    static double mb(const BenchResult& r) {
+        return static_cast<double>(r.bytes) / (1 << 20);
+    }
+
+    static double mb_per_s(const BenchResult& r) {
+        return r.sample.seconds > 0 ? mb(r) / r.sample.seconds : 0.0;
+    }
+
+    static double items_per_s(const BenchResult& r) {
+        return r.sample.seconds > 0 ? r.items / r.sample.seconds : 0.0;
+    }
+
+    static double io_ops_per_mb(const BenchResult& r) {
+        return r.bytes > 0 ? r.sample.ioOps / mb(r) : 0.0;
+    }
+
+    static double cpu_ms_per_mb(const BenchResult& r) {
+        return r.bytes > 0 ? r.sample.cpuSeconds * 1000 / mb(r) : 0.0;
+    }
+public:
+    void add(const std::string& name, const BenchSample& sample, uint64_t bytes, uint64_t items) {
+        if (sample.seconds < 0) {
+            std::cerr << "benchmark failed: " << name << "\n";
+            return;
+        }
+
+        BenchResult r{ name, sample, bytes, items };
+        results.push_back(r);
+
+        std::cout << name << ": " << sample.seconds * 1000 << " ms, "
+                  << mb_per_s(r) << " MB/s, " << items_per_s(r) << " items/s, "
+                  << io_ops_per_mb(r) << " io ops/MB, " << cpu_ms_per_mb(r) << " cpu ms/MB\n";
+    }
+
+    /*
+        one result per line, so the baseline reader below doesn't need a real json parser.
+    */
+    bool write_json(std::ostream& out) const {
+        out << "{\n  \"benchmarks\": [\n";
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+
+            out << "    { \"name\": \"" << r.name << "\", \"seconds\": " << r.sample.seconds
+                << ", \"bytes\": " << r.bytes << ", \"items\": " << r.items
+                << ", \"mb_per_s\": " << mb_per_s(r) << ", \"items_per_s\": " << items_per_s(r)
+                << ", \"io_ops_per_mb\": " << io_ops_per_mb(r) << ", \"cpu_ms_per_mb\": " << cpu_ms_per_mb(r)
+                << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+    /*
+        compares against a json file written by write_json(), returns the number of regressions,
+        a benchmark regresses when it is more than `threshold` slower than the baseline.
+    */
+    int compare_baseline(std::istream& in, double threshold) const {
+        std::string line;
+        int regressions = 0;
+
+        std::cout << "\ncomparison with baseline (positive is slower):\n";
+
+        while (std::getline(in, line)) {
+            size_t namePos = line.find("\"name\": \"");
+            size_t secPos = line.find("\"seconds\": ");
+
+            if (namePos == std::string::npos || secPos == std::string::npos) {
+                continue;
+            }
+
+            namePos += 9;
+            std::string name = line.substr(namePos, line.find('"', namePos) - namePos);
+            double baseSeconds = std::atof(line.c_str() + secPos + 11);
+
+            for (const BenchResult& r : results) {
+                if (r.name != name || baseSeconds <= 0) {
+                    continue;
+                }
+
+                double change = r.sample.seconds / baseSeconds - 1.0;
+                bool regressed = change > threshold;
+
+                std::cout << "  " << name << ": " << change * 100 << "%" << (regressed ? "  REGRESSION" : "") << "\n";
+                regressions += regressed ? 1 : 0;
+            }
+        }
+
+        return regressions;
+    }
+};
+
+bool load_header(const std::string& pakPath, Header& header) {
+    HeaderParser parser;
+    std::ifstream f{ pakPath, std::ios::binary };
+
+    return f.is_open() && parser.parse(header, f);
+}
+
+void bench_decode(BenchReport& report, const BenchOptions& opt) {
+    std::vector<char> buf(64 << 20, 0x5a);
+
+    BenchSample t = time_best(opt.repeat, [&]() {
+        decode_bytes(buf.data(), buf.size());
+        return true;
+    });
+
+    report.add("decode", t, buf.size(), 0);
+}
+
+void bench_write(BenchReport& report, const BenchOptions& opt) {
+    std::array<char, 8192> buf;
+    std::string dir = opt.workDir + "\\write";
+    std::string seqPath = dir + "\\sequential.bin";
+    const uint64_t seqBytes = 64 << 20;
+    const uint32_t smallFiles = 1000;
+
+    buf.fill(0x5a);
+    CreateDirectory(dir.c_str(), nullptr);
+
+    // the files of the previous run are deleted before the clock starts, like prepare_run().
+    auto delete_sequential = [&]() {
+        DeleteFile(seqPath.c_str());
+    };
+
+    auto delete_small_files = [&]() {
+        for (uint32_t i = 0; i < smallFiles; ++i) {
+            DeleteFile((dir + "\\small" + std::to_string(i) + ".bin").c_str());
+        }
+    };
+
+    BenchSample t = time_best(opt.repeat, delete_sequential, [&]() {
+        std::error_code ec;
+        WinFile wf;
+        bool ok = wf.init(seqPath.c_str(), ec);
+
+        for (uint64_t n = 0; ok && n < seqBytes; n += buf.size()) {
+            ok = wf.write_data(buf.data(), static_cast<DWORD>(buf.size()), ec);
+        }
+
+        return ok;
+    });
+
+    delete_sequential();
+    report.add("write/sequential", t, seqBytes, 1);
+
+    t = time_best(opt.repeat, delete_small_files, [&]() {
+        std::error_code ec;
+        bool ok = true;
+
+        for (uint32_t i = 0; ok && i < smallFiles; ++i) {
+            std::string path = dir + "\\small" + std::to_string(i) + ".bin";
+            WinFile wf;
+
+            ok = wf.init(path.c_str(), ec) && wf.write_data(buf.data(), 4096, ec);
+        }
+
+        return ok;
+    });
+
+    delete_small_files();
+    report.add("write/small_files", t, uint64_t(smallFiles) * 4096, smallFiles);
+    RemoveDirectory(dir.c_str());
+}
+
+/*
+    deletes the output of the previous run, a cold run also flushes it and drops the cached pages
+    of both the output and the pak first.
+*/
+void prepare_run(const Header& header, const std::string& pakPath, const std::string& rootPath, const std::string& cache) {
+    if (cache == "cold") {
+        drop_extracted_cache(header, rootPath);
+    }
+
+    remove_extracted_tree(header, rootPath);
+
+    if (cache == "cold") {
+        drop_file_cache(pakPath.c_str());
+    }
+}
+
+/*
+    the same extraction workload through one source and sink, for every buffer size and cache state.
+    a backend is picked by the name of its source or of its sink.
+*/
+struct BackendRun {
+    BenchReport& report;
+    const BenchOptions& opt;
+    const Header& header;
+    const std::string& pakPath;
+    const std::string& rootPath;
+    const std::string& prefix;
+    uint64_t bodyBytes;
+
+    template<typename Source, typename Sink>
+    void bench() {
+        bool selected = std::find(opt.backends.begin(), opt.backends.end(), "all") != opt.backends.end() ||
+                        std::find(opt.backends.begin(), opt.backends.end(), Source::name()) != opt.backends.end() ||
+                        std::find(opt.backends.begin(), opt.backends.end(), Sink::name()) != opt.backends.end();
+
+        if (!selected) {
+            return;
+        }
+
+        for (size_t bufSize : opt.bufferSizes) {
+            for (const std::string& cache : opt.caches) {
+                auto setup = [&]() {
+                    prepare_run(header, pakPath, rootPath, cache);
+                };
+
+                BenchSample t = time_best(opt.repeat, setup, [&]() {
+                    return extract_with<Source, Sink>(header, pakPath.c_str(), rootPath.c_str(), bufSize);
+                });
+
+                report.add("backend" + prefix + "/" + Source::name() + "+" + Sink::name() + 
+                           "/buf=" + std::to_string(bufSize) + "/" + cache, t, bodyBytes, header.fileAttrList.size());
+            }
+        }
+    }
+};
+
+/*
+    the same loop as extract_with<PositionalSource, MemorySink>() written out by hand, no template,
+    no policy, the decode inlined. an engine slower than this pays for its abstractions.
+*/
+bool extract_handwritten(const Header& header, const char* pakPath, const char* rootPath, size_t bufSize) {
+    HANDLE hFile = CreateFile(pakPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    std::vector<char> buf(bufSize);
+    std::vector<char> data;
+    std::array<char, MAX_PATH> pathBuf;
+    bool ok = true;
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        uint64_t offset = attr.offset;
+        uint32_t left = attr.fileSize;
+
+        path_concatenate(pathBuf, rootPath, attr.fileName.get());
+        data.clear();
+
+        while (ok && left > 0) {
+            OVERLAPPED ov{};
+            DWORD readLen = 0;
+
+            ov.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            ok = ReadFile(hFile, buf.data(), static_cast<DWORD>((std::min)(size_t(left), bufSize)), &readLen, &ov) && readLen > 0;
+
+            for (DWORD i = 0; i < readLen; ++i) {
+                buf[i] ^= 0xf7;
+            }
+
+            data.insert(data.end(), buf.data(), buf.data() + readLen);
+            offset += readLen;
+            left -= readLen;
+        }
+    }
+
+    CloseHandle(hFile);
+    return ok;
+}
+
+/*
+    extract_with<Source, Sink, Decoder>() for every combination of the three, each one compiled
+    to its own loop. a sink that writes no files measures the read and decode alone.
+*/
+struct EngineRun {
+    BenchReport& report;
+    const BenchOptions& opt;
+    const Header& header;
+    const std::string& pakPath;
+    const std::string& rootPath;
+    const std::string& prefix;
+    uint64_t bodyBytes;
+
+    bool selected(const std::string& name) const {
+        return std::find(opt.engines.begin(), opt.engines.end(), "all") != opt.engines.end() ||
+               std::find(opt.engines.begin(), opt.engines.end(), name) != opt.engines.end();
+    }
+
+    template<typename Function>
+    void run(const std::string& name, Function extract) {
+        for (size_t bufSize : opt.bufferSizes) {
+            for (const std::string& cache : opt.caches) {
+                auto setup = [&]() {
+                    prepare_run(header, pakPath, rootPath, cache);
+                    HashSink::take_digests();
+                };
+
+                BenchSample t = time_best(opt.repeat, setup, [&]() {
+                    return extract(bufSize);
+                });
+
+                report.add("engine" + prefix + "/" + name + "/buf=" + std::to_string(bufSize) + "/" + cache,
+                           t, bodyBytes, header.fileAttrList.size());
+            }
+        }
+    }
+
+    template<typename Source, typename Decoder, typename Sink>
+    void bench() {
+        std::string name = std::string(Source::name()) + "+" + Decoder::name() + "+" + Sink::name();
+
+        if (selected(name)) {
+            run(name, [&](size_t bufSize) {
+                return extract_with<Source, Sink, Decoder>(header, pakPath.c_str(), rootPath.c_str(), bufSize);
+            });
+        }
+    }
+
+    template<typename Source, typename Decoder>
+    void bench_sinks() {
+        bench<Source, Decoder, WinFile>();
+        bench<Source, Decoder, MappedFileSink>();
+        bench<Source, Decoder, MemorySink>();
+        bench<Source, Decoder, HashSink>();
+        bench<Source, Decoder, DirectFile>();
+    }
+
+    template<typename Source>
+    void bench_decoders() {
+        bench_sinks<Source, ScalarDecoder>();
+        bench_sinks<Source, SimdDecoder>();
+        bench_sinks<Source, IdentityDecoder>();
+    }
+
+    void bench_all() {
+        if (opt.engines.empty()) {
+            return;
+        }
+
+        bench_decoders<StreamSource>();
+        bench_decoders<StdioSource>();
+        bench_decoders<ReadFileSource>();
+        bench_decoders<PositionalSource>();
+        bench_decoders<MappedSource>();
+        bench_decoders<UnbufferedSource>();
+
+        if (selected("handwritten+memory")) {
+            run("handwritten+memory", [&](size_t bufSize) {
+                return extract_handwritten(header, pakPath.c_str(), rootPath.c_str(), bufSize);
+            });
+        }
+    }
+};
+
+void bench_profile(BenchReport& report, const BenchOptions& opt, const CorpusProfile& profile) {
+    std::string pakPath = opt.workDir + "\\" + profile.name + ".pak";
+    std::string rootPath = opt.workDir + "\\" + profile.name + "_out";
+    Header header;
+
+    // generated paks are kept in the work dir and reused by later runs.
+    if (GetFileAttributes(pakPath.c_str()) == INVALID_FILE_ATTRIBUTES) {
+        std::cout << "generating `" << pakPath << "` ...\n";
+
+        if (!generate_corpus_pak(profile, pakPath.c_str(), header)) {
+            return;
+        }
+
+        header = Header{};
+    }
+
+    if (!load_header(pakPath, header)) {
+        std::cerr << "can't parse `" << pakPath << "`\n";
+        return;
+    }
+
+    uint64_t bodyBytes = 0;
+    for (const FileAttr& attr : header.fileAttrList) {
+        bodyBytes += attr.fileSize;
+    }
+
+    uint64_t entries = header.fileAttrList.size();
+    std::string prefix = std::string("/") + profile.name;
+
+    BenchSample t = time_best(opt.repeat, [&]() {
+        Header h;
+        return load_header(pakPath, h);
+    });
+
+    report.add("parse" + prefix, t, header.headerSize, entries);
+
+    t = time_best(opt.repeat, [&]() {
+        std::ifstream f{ pakPath, std::ios::binary };
+        std::array<char, 8192> buf;
+
+        while (f.read(buf.data(), buf.size()) || f.gcount() > 0) {
+        }
+
+        return true;
+    });
+
+    report.add("read" + prefix, t, header.headerSize + bodyBytes, 1);
+
+    auto cleanup = [&]() {
+        remove_extracted_tree(header, rootPath);
+    };
+
+    for (unsigned threadNum : opt.threads) {
+        t = time_best(opt.repeat, cleanup, [&]() {
+            bool ok;
+
+            if (threadNum > 1) {
+                ok = save_file_data_parallel(header, pakPath.c_str(), rootPath.c_str(), threadNum);
+            }
+            else {
+                std::ifstream f{ pakPath, std::ios::binary };
+                f.seekg(static_cast<std::streamoff>(header.headerSize), std::ios::beg);
+                ok = save_file_data(header, f, rootPath.c_str());
+            }
+
+            return ok;
+        });
+
+        report.add("extract" + prefix + "/threads=" + std::to_string(threadNum), t, bodyBytes, entries);
+    }
+
+    // the frontends are separate executables, so they are timed as whole processes.
+    const std::array<std::pair<const char*, const std::string*>, 2> frontends = { {
+        { "c", &opt.cExtractor }, { "cpp", &opt.cppExtractor }
+    } };
+
+    for (const auto& frontend : frontends) {
+        if (frontend.second->empty()) {
+            continue;
+        }
+
+        // cmd.exe strips the outermost quotes, so the whole command is quoted once more.
+        std::string cmd = "\"\"" + *frontend.second + "\" \"" + pakPath + "\" \"" + rootPath + "\" > nul 2>&1\"";
+
+        t = time_best(opt.repeat, cleanup, [&]() {
+            return std::system(cmd.c_str()) == 0;
+        });
+
+        report.add(std::string("frontend/") + frontend.first + prefix, t, bodyBytes, entries);
+    }
+
+    BackendRun run{ report, opt, header, pakPath, rootPath, prefix, bodyBytes };
+    run.bench<StreamSource, StreamSink>();
+    run.bench<StdioSource, StdioSink>();
+    run.bench<ReadFileSource, WinFile>();
+    run.bench<PositionalSource, WinFile>();
+    run.bench<MappedSource, WinFile>();
+    run.bench<UnbufferedSource, WinFile>();
+    run.bench<UnbufferedSource, DirectFile>();
+
+    EngineRun engines{ report, opt, header, pakPath, rootPath, prefix, bodyBytes };
+    engines.bench_all();
+
+    remove_extracted_tree(header, rootPath);
+}
+
+std::vector<std::string> split_list(const char* s) {
+    std::vector<std::string> items;
+    std::stringstream ss{ s };
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+
+    return items;
+}
+
+bool parse_options(BenchOptions& opt, int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            std::cerr << "unknown option: `" << arg << "`\n";
+            return false;
+        }
+
+        std::string key = arg.substr(2, eq - 2);
+        const char* value = argv[i] + eq + 1;
+
+        if (key == "profiles") {
+            opt.profiles = split_list(value);
+        }
+        else if (key == "threads") {
+            opt.threads.clear();
+            for (const std::string& n : split_list(value)) {
+                opt.threads.push_back(static_cast<unsigned>((std::max)(1, std::atoi(n.c_str()))));
+            }
+        }
+        else if (key == "repeat")        opt.repeat = static_cast<unsigned>((std::max)(1, std::atoi(value)));
+        else if (key == "work-dir")      opt.workDir = value;
+        else if (key == "out")           opt.outPath = value;
+        else if (key == "baseline")      opt.baselinePath = value;
+        else if (key == "threshold")     opt.threshold = std::atof(value);
+        else if (key == "c-extractor")   opt.cExtractor = value;
+        else if (key == "cpp-extractor") opt.cppExtractor = value;
+        else if (key == "backends")      opt.backends = split_list(value);
+        else if (key == "engines")       opt.engines = split_list(value);
+        else if (key == "cache")         opt.caches = split_list(value);
+        else if (key == "buffer-sizes") {
+            opt.bufferSizes.clear();
+            for (const std::string& n : split_list(value)) {
+                opt.bufferSizes.push_back(static_cast<size_t>((std::max)(uint64_t(1), parse_size(n.c_str()))));
+            }
+        }
+        else {
+            std::cerr << "unknown option: `" << arg << "`\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "usage: " << prog << " [options]\n";
+    std::cerr << "  --profiles=tiny,small        corpus profiles for parse, read and extract\n";
+    std::cerr << "  --threads=1,2,4,8            thread counts for extraction\n";
+    std::cerr << "  --repeat=3                   runs per benchmark, the best one is reported\n";
+    std::cerr << "  --work-dir=popcap_bench_tmp  where corpus paks and outputs go\n";
+    std::cerr << "  --out=FILE                   write results as json\n";
+    std::cerr << "  --baseline=FILE --threshold=0.05\n";
+    std::cerr << "                               compare with an earlier json, exit code 2 on regression\n";
+    std::cerr << "  --c-extractor=EXE --cpp-extractor=EXE\n";
+    std::cerr << "                               also time the frontend executables\n";
+    std::cerr << "  --backends=all|ifstream,stdio,readfile,positional,mmap,unbuffered,direct\n";
+    std::cerr << "  --buffer-sizes=4K,64K,1M --cache=warm,cold\n";
+    std::cerr << "                               I/O backend matrix, off unless --backends is given\n";
+    std::cerr << "  --engines=all|SOURCE+DECODER+SINK,handwritten+memory\n";
+    std::cerr << "                               engine matrix, decoders scalar,simd,identity,\n";
+    std::cerr << "                               sinks winfile,mmapfile,memory,hash,direct, off unless --engines is given\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opt;
+    BenchReport report;
+
+    if (!parse_options(opt, argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!is_dir_exist(opt.workDir.c_str()) && !CreateDirectory(opt.workDir.c_str(), nullptr)) {
+        std::cerr << "can't create work dir: `" << opt.workDir << "`\n";
+        return 1;
+    }
+
+    bench_decode(report, opt);
+    bench_write(report, opt);
+
+    for (const std::string& name : opt.profiles) {
+        const CorpusProfile* profile = find_corpus_profile(name.c_str());
+
+        if (profile == nullptr) {
+            std::cerr << "unknown profile: `" << name << "`\n";
+            return 1;
+        }
+
+        bench_profile(report, opt, *profile);
+    }
+
+    if (!opt.outPath.empty()) {
+        std::ofstream out{ opt.outPath };
+
+        if (!report.write_json(out)) {
+            std::cerr << "can't write `" << opt.outPath << "`\n";
+            return 1;
+        }
+    }
+
+    if (!opt.baselinePath.empty()) {
+        std::ifstream in{ opt.baselinePath };
+
+        if (!in.is_open()) {
+            std::cerr << "can't open baseline: `" << opt.baselinePath << "`\n";
+            return 1;
+        }
+
+        if (report.compare_baseline(in, opt.threshold) > 0) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * @author yuanluo2
+ * @brief the C ABI of popcap_pak_core.h, written in C++11, only works for windows platform.
+ *
+ * nothing here is new, every call goes to the same parser, index order and engines as
+ * the C++ frontend, so both frontends run one implementation.
+*/
+#ifndef POPCAP_PAK_CORE_NO_MEMORY_HOOKS
+#define POPCAP_PAK_DEFINE_MEMORY_HOOKS  // the core is the one C++ file of a C program, see popcap_pak_core.h.
+#endif
+
+#include "popcap_pak_io.hpp"
+#include "popcap_pak_index.hpp"
+#include "popcap_pak_core.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+struct PopcapPak {
+    Header header;
+    std::string path;
+    mutable PositionalSource source;    // positional reads share the handle between threads.
+    std::vector<uint32_t> byName;       // the files sorted like CompactIndex sorts them.
+};
+
+static_assert(POPCAP_PAK_MEMORY_PHASES == MEM_PHASE_COUNT, "popcap_pak_core.h has another list of phases");
+
+namespace {
+
+void fill_entry(const FileAttr& attr, PopcapPakEntry* entry) {
+    entry->fileName = attr.fileName.get();
+    entry->fileNameLen = attr.fileNameLen;
+    entry->fileSize = attr.fileSize;
+    entry->lastWriteTime = attr.lastWriteTime;
+    entry->offset = attr.offset;
+}
+
+// call it in a catch block, a C caller can't take a C++ exception.
+void report_exception(const char* fn) noexcept {
+    try {
+        throw;
+    }
+    catch (const std::bad_alloc&) {
+        std::cerr << fn << ": out of memory\n";
+    }
+    catch (const std::exception& e) {
+        std::cerr << fn << ": " << e.what() << "\n";
+    }
+    catch (...) {
+        std::cerr << fn << ": unknown error\n";
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+void popcap_pak_extract_options_init(PopcapPakExtractOptions* opt) {
+    opt->source = PositionalSource::name();
+    opt->decoder = SimdDecoder::name();
+    opt->sink = WinFile::name();
+    opt->bufferSize = 64 << 10;
+    opt->threads = 1;
+}
+
+PopcapPak* popcap_pak_open(const char* pakPath) {
+    try {
+        std::unique_ptr<PopcapPak> pak{ new (std::nothrow) PopcapPak };
+        HeaderParser parser;
+        HeaderValidator validator;
+        std::error_code ec;
+
+        if (pak == nullptr) {
+            std::cerr << "out of memory\n";
+            return nullptr;
+        }
+
+        std::ifstream f{ pakPath, std::ios::binary };
+        if (!f.is_open()) {
+            std::cerr << "can't open file: `" << pakPath << "`\n";
+            return nullptr;
+        }
+
+        {
+            MemoryScope scope{ MemPhase::Parse };
+
+            if (!parser.parse(pak->header, f) || !validator.validate(pak->header, get_pak_file_size(f))) {
+                std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+                return nullptr;
+            }
+        }
+
+        if (!pak->source.init(pakPath, ec)) {
+            std::cerr << "can't open file: `" << pakPath << "`, " << ec.message() << "\n";
+            return nullptr;
+        }
+
+        const std::vector<FileAttr>& files = pak->header.fileAttrList;
+        MemoryScope scope{ MemPhase::Index };
+
+        pak->path = pakPath;
+        pak->byName.resize(files.size());
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            pak->byName[i] = static_cast<uint32_t>(i);
+        }
+
+        std::sort(pak->byName.begin(), pak->byName.end(), [&](uint32_t a, uint32_t b) {
+            return compare_name_nocase(files[a].fileName.get(), files[a].fileNameLen, files[b].fileName.get(), files[b].fileNameLen) < 0;
+        });
+
+        return pak.release();
+    }
+    catch (...) {
+        report_exception("popcap_pak_open");
+        return nullptr;
+    }
+}
+
+void popcap_pak_close(PopcapPak* pak) {
+    delete pak;
+}
+
+size_t popcap_pak_file_count(const PopcapPak* pak) {
+    return pak->header.fileAttrList.size();
+}
+
+UINT64 popcap_pak_header_size(const PopcapPak* pak) {
+    return pak->header.headerSize;
+}
+
+BOOL popcap_pak_entry(const PopcapPak* pak, size_t index, PopcapPakEntry* entry) {
+    try {
+        if (index >= pak->header.fileAttrList.size()) {
+            return FALSE;
+        }
+
+        fill_entry(pak->header.fileAttrList[index], entry);
+        return TRUE;
+    }
+    catch (...) {
+        report_exception("popcap_pak_entry");
+        return FALSE;
+    }
+}
+
+BOOL popcap_pak_find(const PopcapPak* pak, const char* fileName, PopcapPakEntry* entry) {
+    try {
+        const std::vector<FileAttr>& files = pak->header.fileAttrList;
+        std::string name = fileName;
+
+        std::replace(name.begin(), name.end(), '/', '\\');
+
+        auto it = std::lower_bound(pak->byName.begin(), pak->byName.end(), name, [&](uint32_t i, const std::string& n) {
+            return compare_name_nocase(files[i].fileName.get(), files[i].fileNameLen, n.data(), n.size()) < 0;
+        });
+
+        if (it == pak->byName.end() || compare_name_nocase(files[*it].fileName.get(), files[*it].fileNameLen, name.data(), name.size()) != 0) {
+            return FALSE;
+        }
+
+        fill_entry(files[*it], entry);
+        return TRUE;
+    }
+    catch (...) {
+        report_exception("popcap_pak_find");
+        return FALSE;
+    }
+}
+
+void popcap_pak_decode(void* data, size_t len) {
+    SimdDecoder::decode(static_cast<char*>(data), len);
+}
+
+BOOL popcap_pak_read_file(const PopcapPak* pak, const PopcapPakEntry* entry, void* buf) {
+    try {
+        char* out = static_cast<char*>(buf);
+        std::error_code ec;
+
+        for (uint32_t done = 0; done < entry->fileSize; ) {
+            size_t n = pak->source.read(entry->offset + done, out + done, entry->fileSize - done, ec);
+
+            if (n == 0) {
+                std::cerr << "can't read `" << entry->fileName << "` from `" << pak->path << "`, " << (ec ? ec.message() : "unexpected end of file") << "\n";
+                return FALSE;
+            }
+
+            done += static_cast<uint32_t>(n);
+        }
+
+        SimdDecoder::decode(out, entry->fileSize);
+        return TRUE;
+    }
+    catch (...) {
+        report_exception("popcap_pak_read_file");
+        return FALSE;
+    }
+}
+
+BOOL popcap_pak_extract(const PopcapPak* pak, const char* rootPath, const PopcapPakExtractOptions* opt) {
+    try {
+        PopcapPakExtractOptions o;
+
+        popcap_pak_extract_options_init(&o);
+        if (opt != nullptr) {
+            o.source = opt->source != nullptr ? opt->source : o.source;
+            o.decoder = opt->decoder != nullptr ? opt->decoder : o.decoder;
+            o.sink = opt->sink != nullptr ? opt->sink : o.sink;
+            o.bufferSize = opt->bufferSize > 0 ? opt->bufferSize : o.bufferSize;
+            o.threads = opt->threads > 0 ? opt->threads : o.threads;
+        }
+
+        const ExtractEngine* engine = find_extract_engine(o.source, o.sink, o.decoder);
+        if (engine == nullptr) {
+            std::cerr << "unknown engine: `" << o.source << "+" << o.decoder << "+" << o.sink << "`\n";
+            return FALSE;
+        }
+
+        MemoryStats::instance().set_default_phase(MemPhase::Extract);
+        bool ok = engine->fn(pak->header, pak->path.c_str(), rootPath, o.bufferSize, o.threads, nullptr, nullptr);
+        MemoryStats::instance().set_default_phase(MemPhase::Other);
+
+        return ok ? TRUE : FALSE;
+    }
+    catch (...) {
+        MemoryStats::instance().set_default_phase(MemPhase::Other);
+        report_exception("popcap_pak_extract");
+        return FALSE;
+    }
+}
+
+void popcap_pak_memory_stats_enable(void) {
+    MemoryStats::instance().enable();
+}
+
+void popcap_pak_memory_stats(PopcapPakMemoryStats* stats) {
+    const MemoryStats& m = MemoryStats::instance();
+
+    stats->peakBytes = m.peak_bytes();
+    stats->liveBytes = m.live_bytes();
+    stats->allocations = m.allocations();
+    stats->frees = m.free_count();
+
+    for (size_t i = 0; i < POPCAP_PAK_MEMORY_PHASES; ++i) {
+        MemPhase phase = static_cast<MemPhase>(i);
+        PopcapPakMemoryPhase& p = stats->phases[i];
+
+        p.name = mem_phase_name(phase);
+        p.allocations = m.phase_allocations(phase);
+        p.bytes = m.phase_bytes(phase);
+        p.peakBytes = m.phase_peak_bytes(phase);
+    }
+}
+
+} // extern "C"
@@ -0,0 +1,118 @@
+/*
+    @author yuanluo2
+    @brief the .pak core of the C++ version behind a C ABI, only works for windows platform.
+
+    the parser, the validator, the index, the decoders and the extraction engines of
+    popcap_pak_io.hpp, built once in popcap_pak_core.cpp and callable from ANSI C, so the
+    C frontend gets the parallel, mmap and simd work of the C++ version without a second copy:
+
+        cl /O2 /EHsc /c popcap_pak_core.cpp
+        cl /O2 popcap_pak_extractor.c popcap_pak_core.obj
+
+    every function reports its errors on stderr, like the frontends do, and returns FALSE or NULL,
+    no C++ exception ever leaves it.
+    to count its allocations popcap_pak_core.obj replaces the global operator new and delete of the
+    program, see popcap_pak_memory.hpp. a C++ program with its own compiles it with
+    /DPOPCAP_PAK_CORE_NO_MEMORY_HOOKS and its stats are then only the aligned buffers.
+    a PopcapPak may be read by many threads at once, it's never changed after popcap_pak_open().
+*/
+#ifndef POPCAP_PAK_CORE_H
+#define POPCAP_PAK_CORE_H
+
+#include <windows.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PopcapPak                PopcapPak;
+typedef struct PopcapPakEntry           PopcapPakEntry;
+typedef struct PopcapPakExtractOptions  PopcapPakExtractOptions;
+typedef struct PopcapPakMemoryPhase     PopcapPakMemoryPhase;
+typedef struct PopcapPakMemoryStats     PopcapPakMemoryStats;
+
+/* parse, index, buffers, caches, extract, other. */
+#define POPCAP_PAK_MEMORY_PHASES  6
+
+/*
+    one file of the pak, fileName stays valid until popcap_pak_close().
+*/
+struct PopcapPakEntry {
+    const char* fileName;
+    UINT32 fileNameLen;
+    UINT32 fileSize;
+    FILETIME lastWriteTime;
+    UINT64 offset;    /* where the file data starts in the pak file. */
+};
+
+/*
+    NULL picks the default, see popcap_pak_extract_options_init().
+*/
+struct PopcapPakExtractOptions {
+    const char* source;     /* ifstream, stdio, readfile, positional, mmap, unbuffered. */
+    const char* decoder;    /* scalar, simd. */
+    const char* sink;       /* winfile, mmapfile. */
+    size_t bufferSize;
+    unsigned threads;
+};
+
+struct PopcapPakMemoryPhase {
+    const char* name;
+    UINT64 allocations;
+    UINT64 bytes;
+    INT64 peakBytes;    /* the highest live bytes of the core at an allocation of this phase. */
+};
+
+struct PopcapPakMemoryStats {
+    INT64 peakBytes;
+    INT64 liveBytes;
+    UINT64 allocations;
+    UINT64 frees;
+    PopcapPakMemoryPhase phases[POPCAP_PAK_MEMORY_PHASES];
+};
+
+/* positional, simd, winfile, 64 KB, one thread. */
+void popcap_pak_extract_options_init(PopcapPakExtractOptions* opt);
+
+/*
+    parses and validates the header, builds the index, nothing of the body is read.
+    remember to call popcap_pak_close() at last.
+*/
+PopcapPak* popcap_pak_open(const char* pakPath);
+
+/* this function will do nothing if pak is NULL. */
+void popcap_pak_close(PopcapPak* pak);
+
+size_t popcap_pak_file_count(const PopcapPak* pak);
+
+UINT64 popcap_pak_header_size(const PopcapPak* pak);
+
+/* the files in the order of the header. */
+BOOL popcap_pak_entry(const PopcapPak* pak, size_t index, PopcapPakEntry* entry);
+
+/* finds a file without case, `/` and `\` are the same. */
+BOOL popcap_pak_find(const PopcapPak* pak, const char* fileName, PopcapPakEntry* entry);
+
+/* decodes in place, the same as encoding. */
+void popcap_pak_decode(void* data, size_t len);
+
+/* reads and decodes the whole file into `buf`, which holds entry->fileSize bytes. */
+BOOL popcap_pak_read_file(const PopcapPak* pak, const PopcapPakEntry* entry, void* buf);
+
+/*
+    extracts every file under rootPath, opt may be NULL.
+*/
+BOOL popcap_pak_extract(const PopcapPak* pak, const char* rootPath, const PopcapPakExtractOptions* opt);
+
+/* counting is off until this is called, call it before popcap_pak_open(). */
+void popcap_pak_memory_stats_enable(void);
+
+/* what the core allocated so far, per phase, the same counters as `--memory-stats` of the C++ extractor. */
+void popcap_pak_memory_stats(PopcapPakMemoryStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * @author yuanluo2
+ * @brief synthetic .pak corpus, written in C++11.
+ *
+ * builds valid, xor encoded .pak files from a parameterized profile, so benchmarks and
+ * tests can recreate realistic archives locally without the proprietary game paks.
+ * the same profile and seed always produce the same bytes.
+*/
+#ifndef POPCAP_PAK_CORPUS_HPP
+#define POPCAP_PAK_CORPUS_HPP
+
+#include "popcap_pak.hpp"
+
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+
+struct CorpusProfile {
+    const char* name;
+    uint32_t entries;
+    uint64_t totalSize;     // approximate sum of all file sizes.
+    double sizeSigma;       // shape of the log-normal size distribution, larger is wider.
+    double tailRatio;       // fraction of files drawn from the heavy tail instead.
+    double tailScale;       // heavy tail files start at this many times the typical size.
+    uint32_t dirDepth;      // max directory depth of a file.
+    uint32_t dirFanout;     // sub directories per directory.
+    uint32_t nameLen;       // length of the file name without directories.
+    double dupRatio;        // fraction of files whose data repeats an earlier file.
+    uint64_t seed;
+};
+
+const std::array<CorpusProfile, 4> PROFILES = { {
+    { "tiny",   100,     1ull << 20, 1.5, 0.01, 20.0, 2, 4,  12, 0.05, 1 },
+    { "small",  10000,   100ull << 20, 1.5, 0.01, 50.0, 4, 8,  16, 0.05, 1 },
+    { "medium", 100000,  1ull << 30, 1.8, 0.01, 100.0, 5, 10, 20, 0.10, 1 },
+    { "large",  1000000, 8ull << 30, 2.0, 0.005, 200.0, 6, 12, 24, 0.10, 1 },
+} };
+
+/*
+    one entry of the generated pak, files with the same contentId have the same data.
+*/
+struct SyntheticEntry {
+    uint32_t contentId;
+};
+
+/*
+    xorshift64*, cheap enough that generating data is never slower than writing it.
+*/
+class ContentStream {
+    uint64_t state;
+public:
+    ContentStream(uint64_t seed, uint32_t contentId)
+        : state{ (seed ^ (0x9e3779b97f4a7c15ull * (contentId + 1ull))) | 1 } {}
+
+    uint64_t next() noexcept {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+
+    void fill(char* buf, size_t len) noexcept {
+        size_t i = 0;
+
+        for (; i + 8 <= len; i += 8) {
+            uint64_t v = next();
+            std::memcpy(buf + i, &v, 8);
+        }
+
+        if (i < len) {
+            uint64_t v = next();
+            std::memcpy(buf + i, &v, len - i);
+        }
+    }
+};
+
+class CorpusGenerator {
+    const CorpusProfile& profile;
+    std::mt19937_64 rng;
+
+    uint32_t draw_file_size(double mean) {
+        // pareto with alpha 2.5 for the tail, its mean is 5/3 of its minimum.
+        constexpr double TAIL_ALPHA = 2.5;
+        double tailMeanFactor = profile.tailScale * TAIL_ALPHA / (TAIL_ALPHA - 1.0);
+
+        // split the wanted mean between body and tail, so the total size matches the profile.
+        double bodyMean = mean / ((1.0 - profile.tailRatio) + profile.tailRatio * tailMeanFactor);
+
+        // log-normal mean is exp(mu + sigma^2 / 2), pick mu so the body mean comes out right.
+        double sigma = profile.sizeSigma;
+        std::lognormal_distribution<double> body{ std::log(bodyMean) - sigma * sigma / 2, sigma };
+        std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+        double size;
+
+        if (unit(rng) < profile.tailRatio) {
+            size = bodyMean * profile.tailScale / std::pow(1.0 - unit(rng), 1.0 / TAIL_ALPHA);
+        }
+        else {
+            size = body(rng);
+        }
+
+        if (size >= 4294967295.0) {
+            return 0xffffffffu;
+        }
+
+        return static_cast<uint32_t>(size);
+    }
+
+    std::string make_file_name(uint32_t index) {
+        std::uniform_int_distribution<uint32_t> depthDist{ 0, profile.dirDepth };
+        std::uniform_int_distribution<uint32_t> dirDist{ 0, profile.dirFanout > 0 ? profile.dirFanout - 1 : 0 };
+        std::string name;
+        uint32_t depth = depthDist(rng);
+
+        for (uint32_t i = 0; i < depth; ++i) {
+            name += "dir";
+            name += std::to_string(dirDist(rng));
+            name += '\\';
+        }
+
+        // the index keeps every name unique, pad it up to the wanted length.
+        std::string base = "f" + std::to_string(index);
+        while (base.size() < profile.nameLen) {
+            base += static_cast<char>('a' + (index + base.size()) % 26);
+        }
+
+        name += base;
+        name += ".bin";
+
+        if (name.size() > 255) {
+            name.erase(0, name.size() - 255);
+            name[0] = 'x';
+        }
+
+        return name;
+    }
+
+    FILETIME make_file_time() {
+        // somewhere in the ten years after 2010-01-01.
+        std::uniform_int_distribution<uint64_t> seconds{ 0, 10ull * 365 * 24 * 3600 };
+        uint64_t t = 129067776000000000ull + seconds(rng) * 10000000ull;
+        FILETIME ft;
+
+        ft.dwLowDateTime = static_cast<DWORD>(t & 0xffffffffu);
+        ft.dwHighDateTime = static_cast<DWORD>(t >> 32);
+        return ft;
+    }
+public:
+    explicit CorpusGenerator(const CorpusProfile& p) : profile{ p }, rng{ p.seed } {}
+
+    void generate(Header& header, std::vector<SyntheticEntry>& entries) {
+        std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+        double mean = static_cast<double>(profile.totalSize) / (profile.entries > 0 ? profile.entries : 1);
+        uint32_t nextContentId = 0;
+
+        header.magic = { { 0xc0, 0x4a, 0xc0, 0xba } };
+        header.version = { { 0x00, 0x00, 0x00, 0x00 } };
+        header.fileAttrList.reserve(profile.entries);
+        entries.reserve(profile.entries);
+
+        for (uint32_t i = 0; i < profile.entries; ++i) {
+            FileAttr attr{};
+            SyntheticEntry entry;
+            std::string name = make_file_name(i);
+
+            attr.fileNameLen = static_cast<uint32_t>(name.size());
+            attr.fileName = std::unique_ptr<char[]>(new char[name.size() + 1]);
+            std::memcpy(attr.fileName.get(), name.c_str(), name.size() + 1);
+            attr.lastWriteTime = make_file_time();
+
+            if (i > 0 && unit(rng) < profile.dupRatio) {
+                std::uniform_int_distribution<uint32_t> pick{ 0, i - 1 };
+                uint32_t j = pick(rng);
+
+                attr.fileSize = header.fileAttrList[j].fileSize;
+                entry.contentId = entries[j].contentId;
+            }
+            else {
+                attr.fileSize = draw_file_size(mean);
+                entry.contentId = nextContentId++;
+            }
+
+            header.fileAttrList.emplace_back(std::move(attr));
+            entries.push_back(entry);
+        }
+    }
+
+    bool write_body(const Header& header, const std::vector<SyntheticEntry>& entries, std::ofstream& f) {
+        std::vector<char> buf(1 << 20);
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            ContentStream content{ profile.seed, entries[i].contentId };
+            uint64_t left = header.fileAttrList[i].fileSize;
+
+            while (left > 0) {
+                size_t len = left < buf.size() ? static_cast<size_t>(left) : buf.size();
+
+                content.fill(buf.data(), len);
+                encode_bytes(buf.data(), len);
+
+                if (!f.write(buf.data(), len)) {
+                    return false;
+                }
+
+                left -= len;
+            }
+        }
+
+        return true;
+    }
+};
+
+/*
+    accepts plain numbers and the K, M, G suffixes.
+*/
+inline uint64_t parse_size(const char* s) {
+    char* end = nullptr;
+    uint64_t v = std::strtoull(s, &end, 10);
+
+    switch (*end) {
+        case 'K': case 'k': return v << 10;
+        case 'M': case 'm': return v << 20;
+        case 'G': case 'g': return v << 30;
+        default:            return v;
+    }
+}
+
+inline const CorpusProfile* find_corpus_profile(const char* name) {
+    for (const CorpusProfile& p : PROFILES) {
+        if (std::strcmp(p.name, name) == 0) {
+            return &p;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+    generates the whole pak described by the profile into `path`,
+    `header` receives the index of the generated pak.
+*/
+inline bool generate_corpus_pak(const CorpusProfile& profile, const char* path, Header& header) {
+    HeaderWriter writer;
+    HeaderParser parser;
+    CorpusGenerator generator{ profile };
+    std::vector<SyntheticEntry> entries;
+    std::ofstream f{ path, std::ios::binary };
+
+    if (!f.is_open()) {
+        std::cerr << "can't create file: `" << path << "`\n";
+        return false;
+    }
+
+    generator.generate(header, entries);
+
+    if (!writer.write(header, f) || !generator.write_body(header, entries, f)) {
+        std::cerr << "write failed: `" << path << "`\n";
+        return false;
+    }
+
+    // header size and file offsets, same as a parsed header would have.
+    header.headerSize = static_cast<uint64_t>(f.tellp());
+    for (const FileAttr& attr : header.fileAttrList) {
+        header.headerSize -= attr.fileSize;
+    }
+
+    parser.compute_file_offsets(header);
+    return true;
+}
+
+#endif // POPCAP_PAK_CORPUS_HPP
@@ -0,0 +1,246 @@
+/**
+ * @author yuanluo2
+ * @brief durability of the extracted files, written in C++11, only works for windows platform.
+ *
+ * none:     the files are left to the lazy writer, like it always was.
+ * end:      written files are flushed in batches by a background thread while the extraction goes
+ *           on, so most of the write back is done when the last file is written. at the end the
+ *           whole volume is flushed if the process may open it, else the rest of the files and
+ *           the created dirs are flushed one by one. no other volume is touched.
+ * per-file: every file is flushed before the worker takes the next one.
+ *
+ * FlushFileBuffers() is the windows fsync(), it needs a handle with write access, so files are
+ * reopened by path after the engine closed them, which works for every sink.
+*/
+#ifndef POPCAP_PAK_DURABILITY_HPP
+#define POPCAP_PAK_DURABILITY_HPP
+
+#include "popcap_pak_storage.hpp"
+#include "popcap_pak_memory.hpp"
+
+#include <string>
+#include <set>
+#include <cstring>
+
+enum class Durability {
+    None,
+    End,
+    PerFile
+};
+
+inline bool parse_durability(const char* s, Durability& out) {
+    if (std::strcmp(s, "none") == 0) {
+        out = Durability::None;
+    }
+    else if (std::strcmp(s, "end") == 0) {
+        out = Durability::End;
+    }
+    else if (std::strcmp(s, "per-file") == 0) {
+        out = Durability::PerFile;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    dirs need FILE_FLAG_BACKUP_SEMANTICS to be opened at all.
+*/
+inline bool flush_path(const char* path, bool isDir) {
+    HANDLE h = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                          OPEN_EXISTING, isDir ? FILE_FLAG_BACKUP_SEMANTICS : FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool ok = FlushFileBuffers(h) != FALSE;
+    CloseHandle(h);
+    return ok;
+}
+
+class DurabilityTracker {
+    static constexpr size_t BATCH_FILES = 256;
+
+    Durability mode = Durability::None;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::string> pending;
+    std::vector<std::string> dirs;
+    std::thread flusher;
+    bool stopping = false;
+    std::atomic<uint64_t> flushedFiles{ 0 };
+    std::atomic<uint64_t> failedFiles{ 0 };
+
+    DurabilityTracker() = default;
+
+    void flush_files(const std::vector<std::string>& paths) {
+        for (const std::string& path : paths) {
+            if (flush_path(path.c_str(), false)) {
+                flushedFiles.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                std::cerr << "flush failed for file `" << path << "`, error " << GetLastError() << "\n";
+                failedFiles.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock{ mutex };
+
+        while (true) {
+            cv.wait(lock, [this]() { return stopping || pending.size() >= BATCH_FILES; });
+
+            if (pending.size() < BATCH_FILES) {
+                return;     // stopping, the rest is left to finish().
+            }
+
+            std::vector<std::string> batch;
+            batch.swap(pending);
+
+            lock.unlock();
+            flush_files(batch);
+            lock.lock();
+        }
+    }
+
+    // flushes the whole volume of `rootPath`, only works with admin rights.
+    static bool flush_volume(const char* rootPath, std::string& device) {
+        std::array<char, MAX_PATH> full;
+        std::array<char, MAX_PATH> volume;
+
+        DWORD len = GetFullPathName(rootPath, static_cast<DWORD>(full.size()), full.data(), nullptr);
+        if (len == 0 || len >= full.size() || !GetVolumePathName(full.data(), volume.data(), static_cast<DWORD>(volume.size())) ||
+            GetDriveType(volume.data()) == DRIVE_REMOTE || !volume_device_path(volume.data(), device)) {
+            return false;
+        }
+
+        HANDLE h = CreateFile(device.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        bool ok = FlushFileBuffers(h) != FALSE;
+        CloseHandle(h);
+        return ok;
+    }
+public:
+    DurabilityTracker(const DurabilityTracker&) = delete;
+    DurabilityTracker& operator=(const DurabilityTracker&) = delete;
+
+    ~DurabilityTracker() {
+        stop_flusher();
+    }
+
+    static DurabilityTracker& instance() {
+        static DurabilityTracker tracker;
+        return tracker;
+    }
+
+    Durability durability() const noexcept {
+        return mode;
+    }
+
+    // call before any worker starts.
+    void enable(Durability m) {
+        mode = m;
+
+        if (mode == Durability::End) {
+            flusher = std::thread{ &DurabilityTracker::run, this };
+        }
+    }
+
+    void dir_created(const char* path) {
+        if (mode != Durability::None) {
+            MemoryScope scope{ MemPhase::Caches };
+            std::lock_guard<std::mutex> lock{ mutex };
+            dirs.emplace_back(path);
+        }
+    }
+
+    // called once a file is completely written and closed.
+    void file_done(const char* path) {
+        if (mode == Durability::PerFile) {
+            flush_files(std::vector<std::string>{ path });
+        }
+        else if (mode == Durability::End) {
+            MemoryScope scope{ MemPhase::Caches };
+            std::lock_guard<std::mutex> lock{ mutex };
+            pending.emplace_back(path);
+
+            if (pending.size() >= BATCH_FILES) {
+                cv.notify_one();
+            }
+        }
+    }
+
+    void stop_flusher() {
+        if (!flusher.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            stopping = true;
+        }
+
+        cv.notify_one();
+        flusher.join();
+    }
+
+    /*
+        call after all workers are joined, false if anything couldn't be flushed.
+        dirs are flushed deepest first, so a dir entry is never durable before the dirs below it.
+    */
+    bool finish(const char* rootPath, std::ostream& out) {
+        if (mode == Durability::None) {
+            return true;
+        }
+
+        uint64_t start = now_ticks();
+        std::string device;
+
+        stop_flusher();
+
+        if (mode == Durability::End && flush_volume(rootPath, device)) {
+            out << "durability: flushed volume `" << device << "` in " << ticks_to_seconds(now_ticks() - start) << " s\n";
+            return failedFiles.load() == 0;
+        }
+
+        flush_files(pending);
+        pending.clear();
+
+        // a new dir is an entry of its parent, which may be a dir that existed before.
+        std::set<std::string> touched{ dirs.begin(), dirs.end() };
+        for (const std::string& dir : dirs) {
+            size_t pos = dir.rfind('\\');
+            touched.insert(pos == std::string::npos ? std::string{ "." } : dir.substr(0, pos + (pos == 0 || dir[pos - 1] == ':')));
+        }
+
+        std::vector<std::string> ordered{ touched.begin(), touched.end() };
+        std::sort(ordered.begin(), ordered.end(), [](const std::string& a, const std::string& b) {
+            return a.size() > b.size();
+        });
+
+        uint64_t failedDirs = 0;
+        for (const std::string& dir : ordered) {
+            if (!flush_path(dir.c_str(), true)) {
+                failedDirs++;
+            }
+        }
+
+        out << "durability: flushed " << flushedFiles.load() << " files and " << ordered.size() - failedDirs << " dirs, "
+            << ticks_to_seconds(now_ticks() - start) << " s after the last file was written\n";
+
+        if (failedDirs > 0) {
+            std::cerr << failedDirs << " dirs couldn't be flushed\n";
+        }
+
+        return failedFiles.load() == 0 && failedDirs == 0;
+    }
+};
+
+#endif // POPCAP_PAK_DURABILITY_HPP
@@ -0,0 +1,274 @@
+/**
+ * @author yuanluo2
+ * @brief embeds a .pak file into a program at build time, written in C++11.
+ *
+ * writes a header with the file data and a constexpr index of the entries, see popcap_pak_embed.hpp.
+ * by default the data is decoded here and written as an array, any C++11 compiler takes it and
+ * nothing is decoded at run time. `--incbin` leaves the data in the pak and has the assembler
+ * pull it in with `.incbin`, which keeps big paks out of the compiler (gcc, clang and mingw only),
+ * that data is still encoded and copy_file() decodes it.
+ * the header only defines internal names, include it from one source file.
+*/
+#include "popcap_pak.hpp"
+#include "popcap_pak_embed.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+
+/*
+    hash and displace: buckets with more names are placed first, each one gets the first
+    displacement that sends all of its names to free slots.
+*/
+bool build_perfect_hash(const Header& header, std::vector<uint32_t>& displace, std::vector<size_t>& slotOf) {
+    size_t count = header.fileAttrList.size();
+    size_t buckets = (std::max)(size_t(1), (count + 2) / 3);
+    std::vector<std::vector<size_t>> members(buckets);
+    std::vector<bool> taken(count, false);
+
+    for (size_t i = 0; i < count; ++i) {
+        members[embed_hash(header.fileAttrList[i].fileName.get(), EMBED_HASH_BASIS) % buckets].push_back(i);
+    }
+
+    std::vector<size_t> order(buckets);
+    for (size_t b = 0; b < buckets; ++b) {
+        order[b] = b;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return members[a].size() > members[b].size();
+    });
+
+    displace.assign(buckets, 0);
+    slotOf.assign(count, 0);
+
+    for (size_t b : order) {
+        if (members[b].empty()) {
+            break;
+        }
+
+        uint32_t d = 0;
+        std::vector<size_t> slots;
+
+        for (; d < (1u << 24); ++d) {
+            slots.clear();
+
+            for (size_t i : members[b]) {
+                size_t s = embed_hash(header.fileAttrList[i].fileName.get(), embed_seed(d)) % count;
+
+                if (taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end()) {
+                    break;
+                }
+
+                slots.push_back(s);
+            }
+
+            if (slots.size() == members[b].size()) {
+                break;
+            }
+        }
+
+        if (slots.size() != members[b].size()) {
+            return false;
+        }
+
+        displace[b] = d;
+        for (size_t k = 0; k < slots.size(); ++k) {
+            taken[slots[k]] = true;
+            slotOf[members[b][k]] = slots[k];
+        }
+    }
+
+    return true;
+}
+
+std::string c_string(const char* s) {
+    std::string out{ "\"" };
+    char octal[8];
+
+    for (; *s != '\0'; ++s) {
+        unsigned char c = static_cast<unsigned char>(*s);
+
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += *s;
+        }
+        else if (c < 0x20 || c >= 0x7f || c == '?') {
+            std::snprintf(octal, sizeof(octal), "\\%03o", c);
+            out += octal;
+        }
+        else {
+            out += *s;
+        }
+    }
+
+    return out + "\"";
+}
+
+bool write_data_array(std::FILE* out, const Header& header, std::ifstream& pak) {
+    std::vector<char> buf(1 << 16);
+    uint64_t left = 0;
+    unsigned column = 0;
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        left += attr.fileSize;
+    }
+
+    std::fprintf(out, "alignas(16) const unsigned char DATA[] = {\n");
+    pak.seekg(static_cast<std::streamoff>(header.headerSize));
+
+    while (left > 0) {
+        size_t n = static_cast<size_t>((std::min)(uint64_t(buf.size()), left));
+
+        if (!pak.read(buf.data(), n)) {
+            std::cerr << "pak data is truncated\n";
+            return false;
+        }
+
+        decode_bytes(buf.data(), n);
+
+        for (size_t i = 0; i < n; ++i) {
+            std::fprintf(out, "%u,", static_cast<unsigned>(static_cast<uchar>(buf[i])));
+
+            if (++column == 32) {
+                std::fputc('\n', out);
+                column = 0;
+            }
+        }
+
+        left -= n;
+    }
+
+    // one more byte, so an empty body is still a valid array.
+    std::fprintf(out, "0\n};\n\n");
+    return true;
+}
+
+void write_incbin(std::FILE* out, const Header& header, const char* pakPath, const std::string& ns) {
+    std::string path = pakPath;
+    std::replace(path.begin(), path.end(), '\\', '/');
+
+    // a string of the assembler inside a string of the compiler.
+    std::string literal = c_string(c_string(path.c_str()).c_str());
+    literal = literal.substr(1, literal.size() - 2);
+
+    std::fprintf(out, "#ifdef _WIN32\n#define POPCAP_PAK_EMBED_SECTION \".section .rdata,\\\"dr\\\"\\n\"\n#else\n");
+    std::fprintf(out, "#define POPCAP_PAK_EMBED_SECTION \".section .rodata\\n\"\n#endif\n");
+    std::fprintf(out, "__asm__(POPCAP_PAK_EMBED_SECTION \".balign 16\\n%s_pak_data:\\n.incbin %s, %llu\\n.byte 0\\n.previous\\n\");\n",
+                 ns.c_str(), literal.c_str(), static_cast<unsigned long long>(header.headerSize));
+    std::fprintf(out, "#undef POPCAP_PAK_EMBED_SECTION\n");
+
+    // the label is bound by name, i686 mingw would look for `_name` otherwise.
+    std::fprintf(out, "extern \"C\" const unsigned char %s_pak_data[] __asm__(\"%s_pak_data\");\nconst unsigned char* const DATA = %s_pak_data;\n\n",
+                 ns.c_str(), ns.c_str(), ns.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::string ns = "embedded_pak";
+    bool incbin = false;
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--namespace=", 12) == 0) {
+            ns = argv[i] + 12;
+        }
+        else if (std::strcmp(argv[i], "--incbin") == 0) {
+            incbin = true;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.size() != 2 || ns.empty()) {
+        std::cerr << "usage: " << argv[0] << " main.pak out.hpp [--namespace=embedded_pak] [--incbin]\n";
+        std::cerr << "--incbin makes the assembler read the pak, the path must be valid where the header is compiled.\n";
+        return 1;
+    }
+
+    Header header;
+    HeaderParser parser;
+    HeaderValidator validator;
+    std::vector<uint32_t> displace;
+    std::vector<size_t> slotOf;
+    std::ifstream pak{ paths[0], std::ios::binary };
+
+    if (!pak.is_open()) {
+        std::cerr << "can't open file: `" << paths[0] << "`\n";
+        return 1;
+    }
+
+    if (!parser.parse(header, pak) || !validator.validate(header, get_pak_file_size(pak))) {
+        std::cerr << "invalid .pak file: `" << paths[0] << "`\n";
+        return 1;
+    }
+
+    if (header.fileAttrList.empty()) {
+        std::cerr << "the pak has no files to embed\n";
+        return 1;
+    }
+
+    if (!build_perfect_hash(header, displace, slotOf)) {
+        std::cerr << "can't build a perfect hash, two names may differ only in case\n";
+        return 1;
+    }
+
+    std::FILE* out = std::fopen(paths[1], "w");
+    if (out == nullptr) {
+        std::cerr << "can't create file: `" << paths[1] << "`\n";
+        return 1;
+    }
+
+    std::vector<const FileAttr*> slots(header.fileAttrList.size());
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[slotOf[i]] = &header.fileAttrList[i];
+    }
+
+    std::string guard = "POPCAP_PAK_EMBED_" + ns + "_HPP";
+    std::transform(guard.begin(), guard.end(), guard.begin(), [](char c) { return static_cast<char>(std::toupper(static_cast<uchar>(c))); });
+
+    std::fprintf(out, "// generated by popcap_pak_embed from `%s`, do not edit.\n", paths[0]);
+    std::fprintf(out, "#ifndef %s\n#define %s\n\n#include \"popcap_pak_embed.hpp\"\n\n#include <cstring>\n\nnamespace %s {\n\n", guard.c_str(), guard.c_str(), ns.c_str());
+    std::fprintf(out, "constexpr bool ENCODED = %s;\n\n", incbin ? "true" : "false");
+    std::fprintf(out, "constexpr EmbeddedEntry ENTRIES[] = {\n");
+
+    for (const FileAttr* attr : slots) {
+        std::fprintf(out, "    { %s, %lluu, %uu, %luu, %luu },\n", c_string(attr->fileName.get()).c_str(),
+                     static_cast<unsigned long long>(attr->offset - header.headerSize), attr->fileSize,
+                     static_cast<unsigned long>(attr->lastWriteTime.dwLowDateTime), static_cast<unsigned long>(attr->lastWriteTime.dwHighDateTime));
+    }
+
+    std::fprintf(out, "};\n\nconstexpr uint32_t DISPLACE[] = {\n");
+    for (size_t b = 0; b < displace.size(); ++b) {
+        std::fprintf(out, "%s%lu,", b % 16 == 0 ? (b == 0 ? "    " : "\n    ") : " ", static_cast<unsigned long>(displace[b]));
+    }
+    std::fprintf(out, "\n};\n\n");
+
+    bool ok = true;
+    if (incbin) {
+        write_incbin(out, header, paths[0], ns);
+    }
+    else {
+        ok = write_data_array(out, header, pak);
+    }
+
+    std::fprintf(out, "constexpr size_t COUNT = %llu;\n\n", static_cast<unsigned long long>(slots.size()));
+    std::fprintf(out, "constexpr const EmbeddedEntry* find(const char* name) {\n    return embed_find(ENTRIES, DISPLACE, name);\n}\n\n");
+    std::fprintf(out, "inline const unsigned char* file_data(const EmbeddedEntry& e) {\n    return DATA + e.offset;\n}\n\n");
+    std::fprintf(out, "// copies the decoded data of `e` to `out`, the key is a constant so the loop vectorizes.\n");
+    std::fprintf(out, "inline void copy_file(const EmbeddedEntry& e, char* out) {\n");
+    std::fprintf(out, "    if (ENCODED) {\n        for (uint32_t i = 0; i < e.fileSize; ++i) {\n            out[i] = static_cast<char>(DATA[e.offset + i] ^ 0xf7);\n        }\n    }\n");
+    std::fprintf(out, "    else {\n        std::memcpy(out, DATA + e.offset, e.fileSize);\n    }\n}\n\n");
+    std::fprintf(out, "} // namespace %s\n\n#endif // %s\n", ns.c_str(), guard.c_str());
+
+    if (std::fclose(out) != 0 || !ok) {
+        std::cerr << "can't write file: `" << paths[1] << "`\n";
+        return 1;
+    }
+
+    std::cout << "embedded " << slots.size() << " files of `" << paths[0] << "` into `" << paths[1] << "`, "
+              << displace.size() << " hash buckets\n";
+    return 0;
+}
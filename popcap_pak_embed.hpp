@@ -0,0 +1,60 @@
+/**
+ * @author yuanluo2
+ * @brief lookups of a pak embedded by popcap_pak_embed, written in C++11, no dependencies.
+ *
+ * popcap_pak_embed writes a header with the file data and a constexpr table of the entries,
+ * placed by a minimal perfect hash (hash and displace): the name picks a bucket, the bucket's
+ * displacement picks the slot, so a lookup is two hashes, two table reads and one compare,
+ * and a constant name is looked up by the compiler:
+ *
+ *     static_assert(assets::find("properties\\default.xml") != nullptr, "missing from the pak");
+ *
+ * names compare without case, like windows does, `/` and `\` are the same.
+*/
+#ifndef POPCAP_PAK_EMBED_HPP
+#define POPCAP_PAK_EMBED_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+struct EmbeddedEntry {
+    const char* name;
+    uint64_t offset;        // into the embedded data.
+    uint32_t fileSize;
+    uint32_t lowDateTime;   // the FILETIME of the pak.
+    uint32_t highDateTime;
+};
+
+constexpr uint32_t EMBED_HASH_BASIS = 2166136261u;
+
+constexpr unsigned char embed_fold(char c) {
+    return c == '/' ? '\\' : (c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c - 'A' + 'a') : static_cast<unsigned char>(c));
+}
+
+// FNV-1a of the folded name, a different seed is a different hash function.
+constexpr uint32_t embed_hash(const char* s, uint32_t h) {
+    return *s == '\0' ? h : embed_hash(s + 1, (h ^ embed_fold(*s)) * 16777619u);
+}
+
+constexpr uint32_t embed_seed(uint32_t displacement) {
+    return EMBED_HASH_BASIS ^ (displacement * 0x9e3779b9u);
+}
+
+constexpr bool embed_name_equal(const char* a, const char* b) {
+    return embed_fold(*a) != embed_fold(*b) ? false : (*a == '\0' ? true : embed_name_equal(a + 1, b + 1));
+}
+
+template<size_t Buckets>
+constexpr size_t embed_slot(const uint32_t (&displace)[Buckets], const char* name, size_t slots) {
+    return embed_hash(name, embed_seed(displace[embed_hash(name, EMBED_HASH_BASIS) % Buckets])) % slots;
+}
+
+/*
+    the entry of `name`, nullptr if the pak has no such file.
+*/
+template<size_t Count, size_t Buckets>
+constexpr const EmbeddedEntry* embed_find(const EmbeddedEntry (&entries)[Count], const uint32_t (&displace)[Buckets], const char* name) {
+    return embed_name_equal(entries[embed_slot(displace, name, Count)].name, name) ? &entries[embed_slot(displace, name, Count)] : nullptr;
+}
+
+#endif // POPCAP_PAK_EMBED_HPP
@@ -1,26 +1,72 @@
 /*
     @author yuanluo2
-    @brief popcap's .pak file extractor written in ANSI C, no 3rd parties, only works for windows platform.
+    @brief popcap's .pak file extractor written in ANSI C, only works for windows platform.
+
+    by default it's a thin wrapper over popcap_pak_core.h and extracts with the engines of
+    the C++ version, so it must be linked with popcap_pak_core.obj, see there. built with
+    POPCAP_PAK_STANDALONE it has its own parser and workers and needs no other file:
+
+        cl /O2 /DPOPCAP_PAK_STANDALONE popcap_pak_extractor.c
 */
 #define WIN32_LEAN_AND_MEAN
 
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifndef POPCAP_PAK_STANDALONE
+#include "popcap_pak_core.h"
+#endif
+
+BOOL is_dir_exist(const char* path) {
+  DWORD dwAttrib = GetFileAttributes(path);
+
+  return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
+         (dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
+}
 
+/*
+    one worker per cpu unless `--threads=N` says otherwise.
+*/
+unsigned default_thread_num(void) {
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? si.dwNumberOfProcessors : 1;
+}
+
+#ifdef POPCAP_PAK_STANDALONE
+/*
+    the arenas, parser, validator and workers of the standalone build, the default one leaves them to the core.
+*/
 typedef struct ArenaBlockHeader  ArenaBlockHeader;
 typedef struct ArenaAllocator    ArenaAllocator;
+typedef struct MemPhaseStats     MemPhaseStats;
+typedef struct MemStats          MemStats;
 
 typedef struct FileAttr      FileAttr;
 typedef struct FileAttrList  FileAttrList;
 typedef struct PakHeader     PakHeader;
 typedef struct Resource      Resource;
+typedef struct ExtractJob    ExtractJob;
 
 #define BYTES_OF_MAGIC       4
 #define BYTES_OF_VERSION     4
 #define BYTES_OF_FILE_SIZE   4
 #define BYTES_OF_FILE_TIME   sizeof(FILETIME)
 
+/*
+    what the arenas are used for, every arena counts into the phase it's set to.
+*/
+typedef enum MemPhase {
+    MEM_PHASE_PARSE,
+    MEM_PHASE_INDEX,
+    MEM_PHASE_BUFFERS,
+    MEM_PHASE_OTHER,
+    MEM_PHASE_COUNT
+} MemPhase;
+
 struct ArenaBlockHeader {
     size_t used;
     size_t capacity;
@@ -31,12 +77,34 @@ struct ArenaAllocator {
     ArenaBlockHeader* head;
     size_t blockSize;
     size_t blockNum;
+    MemPhase phase;
+    size_t heldBytes;    /* all blocks with their headers, what the arena takes from malloc(). */
+};
+
+/*
+    workers update these at the same time, so they only change through Interlocked*().
+*/
+struct MemPhaseStats {
+    volatile LONG64 allocs;      /* arena_malloc() calls. */
+    volatile LONG64 bytes;       /* bytes asked for. */
+    volatile LONG64 blocks;      /* blocks taken from malloc(). */
+    volatile LONG64 blockBytes;
+    volatile LONG64 peakLive;    /* the highest live bytes of all arenas when this phase took a block. */
+};
+
+struct MemStats {
+    BOOL enabled;
+    volatile LONG64 live;
+    volatile LONG64 peak;
+    MemPhaseStats phases[MEM_PHASE_COUNT];
 };
 
 struct FileAttr {
     char* fileName;
+    UINT32 fileNameLen;
     UINT32 fileSize;
     FILETIME lastWriteTime;
+    UINT64 offset;    /* where the file data starts in the pak file, archives can be larger than 4 GB. */
     FileAttr* next;
 };
 
@@ -49,20 +117,115 @@ struct FileAttrList {
 struct PakHeader {
     UCHAR magic[BYTES_OF_MAGIC];
     UCHAR version[BYTES_OF_VERSION];
-    FileAttrList flist;
+    FileAttrList flist;   /* what the parser builds, it's gone once `entries` is built. */
+    FileAttr* entries;    /* the files in one array with their offsets, the index the workers take files from. */
+    size_t entryNum;
+    UINT64 headerSize;    /* file data starts right after the header. */
 };
 
 struct Resource {
-    ArenaAllocator* arena;
+    ArenaAllocator* arena;        /* the file names, they live as long as the index. */
+    ArenaAllocator* listArena;    /* the nodes of the list, freed once the index is built. */
+    ArenaAllocator* indexArena;
     FILE* pakFile;
     FILE* filenameListSav;
 };
 
 /*
-    create a arena allocator handle.
+    shared by all the workers, each one takes the next file until none is left.
+*/
+struct ExtractJob {
+    PakHeader* header;
+    HANDLE pakFile;             /* every read carries its own offset, so one handle is enough. */
+    const char* extractPath;
+    size_t bufSize;
+    volatile LONG next;
+    volatile LONG failed;
+};
+
+/***************** memory stats. ****************/
+/* all zero, counting is off until mem_stats_enable(). */
+MemStats memStats;
+
+const char* mem_phase_name(MemPhase phase) {
+    static const char* const names[MEM_PHASE_COUNT] = { "parse", "index", "buffers", "other" };
+    return names[phase];
+}
+
+void mem_stats_enable(void) {
+    memStats.enabled = TRUE;
+}
+
+void mem_stats_raise(volatile LONG64* max, LONG64 value) {
+    LONG64 seen = *max;
+
+    while (value > seen) {
+        LONG64 prev = InterlockedCompareExchange64(max, value, seen);
+
+        if (prev == seen) {
+            break;
+        }
+
+        seen = prev;
+    }
+}
+
+void mem_stats_add_block(MemPhase phase, size_t size) {
+    MemPhaseStats* ps = &(memStats.phases[phase]);
+    LONG64 live;
+
+    if (!memStats.enabled) {
+        return;
+    }
+
+    live = InterlockedExchangeAdd64(&(memStats.live), (LONG64)size) + (LONG64)size;
+    InterlockedExchangeAdd64(&(ps->blocks), 1);
+    InterlockedExchangeAdd64(&(ps->blockBytes), (LONG64)size);
+    mem_stats_raise(&(ps->peakLive), live);
+    mem_stats_raise(&(memStats.peak), live);
+}
+
+void mem_stats_add_alloc(MemPhase phase, size_t size) {
+    if (memStats.enabled) {
+        InterlockedExchangeAdd64(&(memStats.phases[phase].allocs), 1);
+        InterlockedExchangeAdd64(&(memStats.phases[phase].bytes), (LONG64)size);
+    }
+}
+
+void mem_stats_release(size_t size) {
+    if (memStats.enabled) {
+        InterlockedExchangeAdd64(&(memStats.live), -(LONG64)size);
+    }
+}
+
+void mem_stats_print(void) {
+    int i;
+    MemPhaseStats* ps;
+
+    if (!memStats.enabled) {
+        return;
+    }
+
+    printf("memory: peak %I64d bytes, live %I64d bytes\n", (INT64)memStats.peak, (INT64)memStats.live);
+
+    for (i = 0; i < MEM_PHASE_COUNT; ++i) {
+        ps = &(memStats.phases[i]);
+
+        if (ps->blocks == 0 && ps->allocs == 0) {
+            continue;
+        }
+
+        printf("  %s: %I64d allocations, %I64d bytes, %I64d blocks, %I64d block bytes, peak %I64d bytes\n",
+               mem_phase_name((MemPhase)i), (INT64)ps->allocs, (INT64)ps->bytes, (INT64)ps->blocks, (INT64)ps->blockBytes, (INT64)ps->peakLive);
+    }
+}
+
+/***************** arena. ****************/
+/*
+    create a arena allocator handle, its blocks count into `phase`.
     remember to call arena_free() at last.
 */
-ArenaAllocator* arena_create(size_t blockSize) {
+ArenaAllocator* arena_create(size_t blockSize, MemPhase phase) {
     ArenaAllocator* arena = (ArenaAllocator*)malloc(sizeof(ArenaAllocator));
 
     if (arena == NULL) {
@@ -80,7 +243,10 @@ ArenaAllocator* arena_create(size_t blockSize) {
     arena->head->used = 0;
     arena->head->next = NULL;
     arena->blockNum = 1;
+    arena->phase = phase;
+    arena->heldBytes = sizeof(ArenaBlockHeader) + blockSize;
 
+    mem_stats_add_block(phase, arena->heldBytes);
     return arena;
 }
 
@@ -100,6 +266,7 @@ void arena_free(ArenaAllocator* arena) {
             cursor = arena->head;
         }
 
+        mem_stats_release(arena->heldBytes);
         free(arena);
     }
 }
@@ -117,23 +284,25 @@ ArenaBlockHeader* arena_create_new_block(ArenaAllocator* arena, size_t size, siz
         arena->head = newBlock;
 
         arena->blockNum += 1;
+        arena->heldBytes += sizeof(ArenaBlockHeader) + size;
+        mem_stats_add_block(arena->phase, sizeof(ArenaBlockHeader) + size);
     }
     else {
         fprintf(stderr, "[ERROR] arena allocator: out of memory\n");
-        fflush(stderr);
-        abort();
     }
 
     return newBlock;
 }
 
 /*
-    same usage as malloc().
+    same usage as malloc(), NULL if out of memory.
 */
 void* arena_malloc(ArenaAllocator* arena, size_t size) {
     ArenaBlockHeader* cursor = arena->head;
     ArenaBlockHeader* newBlock;
 
+    mem_stats_add_alloc(arena->phase, size);
+
     while (cursor != NULL) {
         if (cursor->used + size <= cursor->capacity) {
             cursor->used += size;
@@ -151,7 +320,7 @@ void* arena_malloc(ArenaAllocator* arena, size_t size) {
         newBlock = arena_create_new_block(arena, size, size);
     }
 
-    return (void*)(newBlock + 1);
+    return newBlock != NULL ? (void*)(newBlock + 1) : NULL;
 }
 
 /*
@@ -166,13 +335,18 @@ void resource_free(Resource* res) {
         fclose(res->filenameListSav);
     }
 
+    arena_free(res->listArena);
+    arena_free(res->indexArena);
     arena_free(res->arena);
 }
 
 BOOL resource_init(Resource* res, const char* pakFilePath, const char* filenameListSavPath) {
-    res->arena = arena_create(8192);
-    if (res->arena == NULL) {
-        return FALSE;
+    res->arena = arena_create(8192, MEM_PHASE_PARSE);
+    res->listArena = arena_create(8192, MEM_PHASE_PARSE);
+    res->indexArena = arena_create(4096, MEM_PHASE_INDEX);
+
+    if (res->arena == NULL || res->listArena == NULL || res->indexArena == NULL) {
+        goto clean_arena;
     }
 
     res->pakFile = fopen(pakFilePath, "rb");
@@ -192,6 +366,8 @@ BOOL resource_init(Resource* res, const char* pakFilePath, const char* filenameL
 clean_pak_file:
     fclose(res->pakFile);
 clean_arena:
+    arena_free(res->listArena);
+    arena_free(res->indexArena);
     arena_free(res->arena);
 
     return FALSE;
@@ -217,6 +393,9 @@ void file_attr_list_add(FileAttrList* flist, FileAttr* attr) {
 
 void pak_header_init(PakHeader* header) {
     file_attr_list_init(&(header->flist));
+    header->entries = NULL;
+    header->entryNum = 0;
+    header->headerSize = 0;
 }
 
 /***************** parse. ****************/
@@ -231,74 +410,280 @@ void pak_header_init(PakHeader* header) {
     } \
 } while(0)
 
+/*
+    all header reads go through here, a short read means the pak file is truncated,
+    so the parser stops at once instead of parsing garbage past the end.
+*/
+BOOL read_header_bytes(Resource* res, PakHeader* header, void* buf, size_t len) {
+    if (fread(buf, sizeof(UCHAR), len, res->pakFile) != len) {
+        fprintf(stderr, "[ERROR] pak header is truncated at offset %I64u\n", header->headerSize);
+        return FALSE;
+    }
+
+    header->headerSize += len;
+    return TRUE;
+}
+
 /* must be 0xc0, 0x4a, 0xc0, 0xba. */
-void parse_magic(Resource* res, PakHeader* header) {
-    fread(header->magic, sizeof(UCHAR), BYTES_OF_MAGIC, res->pakFile);
+BOOL parse_magic(Resource* res, PakHeader* header) {
+    if (!read_header_bytes(res, header, header->magic, BYTES_OF_MAGIC)) {
+        return FALSE;
+    }
+
     decode_bytes(header->magic, header->magic, BYTES_OF_MAGIC);
+    return TRUE;
 }
 
 /* must be 0x00, 0x00, 0x00, 0x00. */
-void parse_version(Resource* res, PakHeader* header) {
-    fread(header->version, sizeof(UCHAR), BYTES_OF_VERSION, res->pakFile);
+BOOL parse_version(Resource* res, PakHeader* header) {
+    if (!read_header_bytes(res, header, header->version, BYTES_OF_VERSION)) {
+        return FALSE;
+    }
+
     decode_bytes(header->version, header->version, BYTES_OF_VERSION);
+    return TRUE;
 }
 
-BOOL reach_pak_header_end(Resource* res) {
+BOOL reach_pak_header_end(Resource* res, PakHeader* header, BOOL* end) {
     UCHAR flag;
-    fread(&flag, sizeof(UCHAR), 1, res->pakFile);
-    return decode_one_byte(flag) == 0x80;
+
+    if (!read_header_bytes(res, header, &flag, 1)) {
+        return FALSE;
+    }
+
+    *end = decode_one_byte(flag) == 0x80;
+    return TRUE;
 }
 
-void parse_file_name(Resource* res, FileAttr* attr) {
+BOOL parse_file_name(Resource* res, PakHeader* header, FileAttr* attr) {
     UCHAR byte;
     UINT32 filenameLen;
 
     /* get the length of the file name. */
-    fread(&byte, sizeof(UCHAR), 1, res->pakFile);
+    if (!read_header_bytes(res, header, &byte, 1)) {
+        return FALSE;
+    }
+
     filenameLen = (UINT32)decode_one_byte(byte);
 
     /* get the file name. */
     attr->fileName = (char*)arena_malloc(res->arena, (filenameLen + 1) * sizeof(char));
+    if (attr->fileName == NULL) {
+        return FALSE;
+    }
+
     attr->fileName[filenameLen] = '\0';
-    fread(attr->fileName, sizeof(char), filenameLen, res->pakFile);
+    attr->fileNameLen = filenameLen;
+
+    if (!read_header_bytes(res, header, attr->fileName, filenameLen)) {
+        return FALSE;
+    }
+
     decode_bytes(attr->fileName, attr->fileName, filenameLen);
+    return TRUE;
 }
 
-void parse_file_size(Resource* res, FileAttr* attr) {
+BOOL parse_file_size(Resource* res, PakHeader* header, FileAttr* attr) {
     UCHAR* buf = (UCHAR*)(&(attr->fileSize));
     
-    fread(buf, sizeof(UCHAR), BYTES_OF_FILE_SIZE, res->pakFile);
+    if (!read_header_bytes(res, header, buf, BYTES_OF_FILE_SIZE)) {
+        return FALSE;
+    }
+
     decode_bytes(buf, buf, BYTES_OF_FILE_SIZE);
+    return TRUE;
 }
 
-void parse_file_last_write_time(Resource* res, FileAttr* attr) {
+BOOL parse_file_last_write_time(Resource* res, PakHeader* header, FileAttr* attr) {
     UCHAR* buf = (UCHAR*)(&(attr->lastWriteTime));
 
-    fread(buf, sizeof(UCHAR), BYTES_OF_FILE_TIME, res->pakFile);
+    if (!read_header_bytes(res, header, buf, BYTES_OF_FILE_TIME)) {
+        return FALSE;
+    }
+
     decode_bytes(buf, buf, BYTES_OF_FILE_TIME);
+    return TRUE;
 }
 
-void parse_all_file_attrs(Resource* res, PakHeader* header) {
+BOOL parse_all_file_attrs(Resource* res, PakHeader* header) {
     FileAttr* attr;
+    BOOL end = FALSE;
+
+    while (TRUE) {
+        if (!reach_pak_header_end(res, header, &end)) {
+            return FALSE;
+        }
 
-    while (!feof(res->pakFile)) {
-        if (reach_pak_header_end(res)) {
+        if (end) {
             break;
         }
 
-        attr = (FileAttr*)arena_malloc(res->arena, sizeof(FileAttr));
-        parse_file_name(res, attr);
-        parse_file_size(res, attr);
-        parse_file_last_write_time(res, attr);
+        attr = (FileAttr*)arena_malloc(res->listArena, sizeof(FileAttr));
+
+        if (attr == NULL ||
+            !parse_file_name(res, header, attr) ||
+            !parse_file_size(res, header, attr) ||
+            !parse_file_last_write_time(res, header, attr)) {
+            return FALSE;
+        }
 
         file_attr_list_add(&(header->flist), attr);
     }
+
+    return TRUE;
+}
+
+/*
+    moves the list into one array and computes where the data of every file starts,
+    so a worker can take any file by its index. the nodes of the list are freed after,
+    the names stay where they are.
+*/
+BOOL build_entry_array(Resource* res, PakHeader* header) {
+    FileAttr* attr = header->flist.head;
+    UINT64 offset = header->headerSize;
+    size_t i = 0;
+
+    header->entryNum = header->flist.length;
+    header->entries = (FileAttr*)arena_malloc(res->indexArena, (header->entryNum + 1) * sizeof(FileAttr));
+
+    if (header->entries == NULL) {
+        return FALSE;
+    }
+
+    while (attr != NULL) {
+        header->entries[i] = *attr;
+        header->entries[i].offset = offset;
+        header->entries[i].next = NULL;
+
+        offset += attr->fileSize;
+        attr = attr->next;
+        ++i;
+    }
+
+    file_attr_list_init(&(header->flist));
+    arena_free(res->listArena);
+    res->listArena = NULL;
+    return TRUE;
 }
 
-void parse_pak_header(Resource* res, PakHeader* header) {
-    parse_magic(res, header);
-    parse_version(res, header);
-    parse_all_file_attrs(res, header);
+BOOL parse_pak_header(Resource* res, PakHeader* header) {
+    if (!parse_magic(res, header) ||
+        !parse_version(res, header) ||
+        !parse_all_file_attrs(res, header) ||
+        !build_entry_array(res, header)) {
+        return FALSE;
+    }
+
+    res->arena->phase = MEM_PHASE_OTHER;
+    return TRUE;
+}
+
+/***************** validating. ****************/
+#define is_path_separator(c) \
+    ((c) == '\\' || (c) == '/')
+
+/*
+    file names come from the pak file, so never let them escape the extract dir:
+    no absolute paths, no drive letters, no `..` components, no empty names.
+*/
+BOOL validate_file_name(FileAttr* attr) {
+    const char* name = attr->fileName;
+    const char* component = name;
+    const char* cursor = name;
+
+    if (attr->fileNameLen == 0 || strlen(name) != attr->fileNameLen) {
+        fprintf(stderr, "[ERROR] invalid file name in pak header: `%s`\n", name);
+        return FALSE;
+    }
+
+    if (is_path_separator(name[0]) || strchr(name, ':') != NULL) {
+        fprintf(stderr, "[ERROR] absolute file name in pak header: `%s`\n", name);
+        return FALSE;
+    }
+
+    while (TRUE) {
+        if (*cursor == '\0' || is_path_separator(*cursor)) {
+            if (cursor - component == 2 && component[0] == '.' && component[1] == '.') {
+                fprintf(stderr, "[ERROR] path traversal in pak header: `%s`\n", name);
+                return FALSE;
+            }
+
+            if (*cursor == '\0') {
+                break;
+            }
+
+            component = cursor + 1;
+        }
+
+        ++cursor;
+    }
+
+    return TRUE;
+}
+
+/*
+    fseek() and ftell() work on a 32-bit long on windows, so use the 64-bit versions of the CRT.
+*/
+INT64 get_pak_file_size(Resource* res) {
+    INT64 current = _ftelli64(res->pakFile);
+    INT64 size;
+
+    _fseeki64(res->pakFile, 0, SEEK_END);
+    size = _ftelli64(res->pakFile);
+    _fseeki64(res->pakFile, current, SEEK_SET);
+
+    return size;
+}
+
+/*
+    checks the parsed header against the pak file before anything is written,
+    so a corrupt or hostile pak is rejected here instead of in the middle of extraction.
+*/
+BOOL validate_pak_header(Resource* res, PakHeader* header) {
+    static const UCHAR magic[BYTES_OF_MAGIC] = { 0xc0, 0x4a, 0xc0, 0xba };
+    static const UCHAR version[BYTES_OF_VERSION] = { 0x00, 0x00, 0x00, 0x00 };
+    FileAttr* attr;
+    UINT64 total = header->headerSize;
+    INT64 pakSize = get_pak_file_size(res);
+    size_t i;
+
+    if (memcmp(header->magic, magic, BYTES_OF_MAGIC) != 0) {
+        fprintf(stderr, "[ERROR] bad magic, this is not a popcap .pak file\n");
+        return FALSE;
+    }
+
+    if (memcmp(header->version, version, BYTES_OF_VERSION) != 0) {
+        fprintf(stderr, "[ERROR] unsupported .pak version\n");
+        return FALSE;
+    }
+
+    if (pakSize < 0 || total > (UINT64)pakSize) {
+        fprintf(stderr, "[ERROR] can't get the size of the pak file\n");
+        return FALSE;
+    }
+
+    for (i = 0; i < header->entryNum; ++i) {
+        attr = &(header->entries[i]);
+
+        if (!validate_file_name(attr)) {
+            return FALSE;
+        }
+
+        /* checked before adding, so the sum can never wrap around. */
+        if (attr->fileSize > (UINT64)pakSize - total) {
+            fprintf(stderr, "[ERROR] data of `%s` runs past the end of the pak file\n", attr->fileName);
+            return FALSE;
+        }
+
+        total += attr->fileSize;
+    }
+
+    if (total != (UINT64)pakSize) {
+        fprintf(stderr, "[ERROR] pak file size mismatch, header says %I64u bytes, but the file has %I64d bytes\n", total, pakSize);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 /***************** saving. ****************/
@@ -326,15 +711,9 @@ void build_complete_path(char* buf, size_t len, const char* extractPath, const c
     *buf = '\0';
 }
 
-BOOL is_dir_exist(const char* path) {
-  DWORD dwAttrib = GetFileAttributes(path);
-
-  return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
-         (dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
-}
-
 /*
     create all parent directories from the given path.
+    another worker may create the same dir at the same time, so ERROR_ALREADY_EXISTS is fine.
 */
 BOOL recursive_create_parent_dirs(char* path) {
     char* cursor = path;
@@ -345,7 +724,7 @@ BOOL recursive_create_parent_dirs(char* path) {
             *cursor = '\0';
 
             if (!is_dir_exist(path)) {
-                if (!CreateDirectory(path, NULL)) {
+                if (!CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
                     return FALSE;
                 }
             }
@@ -360,17 +739,37 @@ BOOL recursive_create_parent_dirs(char* path) {
     return TRUE;
 }
 
-void parse_and_extract_one_file(Resource* res, FileAttr* attr, const char* extractPath, char* buf, size_t len) {
+/*
+    ReadFile() with the offset in an OVERLAPPED struct, the windows pread(),
+    it doesn't move a shared file pointer, so the workers never get in each other's way.
+*/
+BOOL read_at(HANDLE hFile, UINT64 offset, char* buf, DWORD len, DWORD* readLen) {
+    OVERLAPPED ov;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)(offset & 0xffffffff);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    *readLen = 0;
+    return ReadFile(hFile, buf, len, readLen, &ov) || GetLastError() == ERROR_HANDLE_EOF;
+}
+
+/*
+    a file that can't be created or written is skipped, only a read error stops the extraction.
+*/
+BOOL parse_and_extract_one_file(ExtractJob* job, FileAttr* attr, char* buf) {
     char path[MAX_PATH];
+    UINT64 offset = attr->offset;
     UINT32 fileSize = attr->fileSize;
-    UINT32 readLen;
+    DWORD readLen;
     HANDLE hFile;
+    BOOL ok = TRUE;
     
-    build_complete_path(path, MAX_PATH, extractPath, attr->fileName);
+    build_complete_path(path, MAX_PATH, job->extractPath, attr->fileName);
     
     if (!recursive_create_parent_dirs(path)) {
         fprintf(stderr, "[ERROR] can't create parent dirs for `%s`\n", path);
-        return;
+        return TRUE;
     }
 
     hFile = CreateFile(path, 
@@ -383,15 +782,14 @@ void parse_and_extract_one_file(Resource* res, FileAttr* attr, const char* extra
         
     if (hFile == INVALID_HANDLE_VALUE) {
         fprintf(stderr, "[ERROR] CreateFile() failed on `%s`\n", path);
-        return;
+        return TRUE;
     }
 
     while (fileSize > 0) {
-        if (fileSize < len) {
-            readLen = fread(buf, sizeof(char), fileSize, res->pakFile);
-        }
-        else {
-            readLen = fread(buf, sizeof(char), len, res->pakFile);
+        if (!read_at(job->pakFile, offset, buf, fileSize < job->bufSize ? fileSize : (DWORD)job->bufSize, &readLen) || readLen == 0) {
+            fprintf(stderr, "[ERROR] unexpected end of pak file while reading `%s`\n", path);
+            ok = FALSE;
+            goto tidy_up;
         }
 
         decode_bytes(buf, buf, readLen);
@@ -401,6 +799,7 @@ void parse_and_extract_one_file(Resource* res, FileAttr* attr, const char* extra
             goto tidy_up;
         }
 
+        offset += readLen;
         fileSize -= readLen;
     }
 
@@ -411,61 +810,253 @@ void parse_and_extract_one_file(Resource* res, FileAttr* attr, const char* extra
 
 tidy_up:
     CloseHandle(hFile);
+    return ok;
+}
+
+/*
+    every worker has its own arena for its buffer, so nothing is allocated under a lock.
+*/
+DWORD WINAPI extract_worker(LPVOID param) {
+    ExtractJob* job = (ExtractJob*)param;
+    ArenaAllocator* arena = arena_create(job->bufSize, MEM_PHASE_BUFFERS);
+    char* buf = arena != NULL ? (char*)arena_malloc(arena, job->bufSize * sizeof(char)) : NULL;
+    size_t i;
+
+    if (buf == NULL) {
+        fprintf(stderr, "[ERROR] can't create the buffer of a worker\n");
+        InterlockedExchange(&(job->failed), TRUE);
+        arena_free(arena);
+        return 1;
+    }
+
+    while (!job->failed) {
+        i = (size_t)(InterlockedIncrement(&(job->next)) - 1);
+
+        if (i >= job->header->entryNum) {
+            break;
+        }
+
+        if (!parse_and_extract_one_file(job, &(job->header->entries[i]), buf)) {
+            InterlockedExchange(&(job->failed), TRUE);
+        }
+    }
+
+    arena_free(arena);
+    return 0;
 }
 
 void save_file_name_list(Resource* res, PakHeader* header, const char* savPath) {
-    FileAttr* attr = header->flist.head;
+    size_t i;
 
-    while (attr != NULL) {
-        fprintf(res->filenameListSav, "%s, %ld\n", attr->fileName, attr->fileSize);
-        attr = attr->next;
+    for (i = 0; i < header->entryNum; ++i) {
+        fprintf(res->filenameListSav, "%s, %lu\n", header->entries[i].fileName, (unsigned long)header->entries[i].fileSize);
     }
 
     printf("[SUCCESS] file name list is saved at `%s`.\n", savPath);
 }
 
-void extract_files(Resource* res, PakHeader* header, const char* extractPath) {
-    FileAttr* attr = header->flist.head;
-    size_t buf_size = 8192;
-    char* buf = (char*)arena_malloc(res->arena, buf_size * sizeof(char));
+/*
+    with one thread the calling thread does all the work, otherwise it only waits.
+*/
+BOOL extract_files(Resource* res, PakHeader* header, const char* pakFilePath, const char* extractPath, unsigned threadNum) {
+    ExtractJob job;
+    HANDLE* threads = NULL;
+    unsigned started = 0;
+    unsigned i;
+
+    job.header = header;
+    job.extractPath = extractPath;
+    job.bufSize = 65536;
+    job.next = 0;
+    job.failed = FALSE;
+    job.pakFile = CreateFile(pakFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+    if (job.pakFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "[ERROR] can't open `%s` for reading\n", pakFilePath);
+        return FALSE;
+    }
 
-    while (attr != NULL) {
-        parse_and_extract_one_file(res, attr, extractPath, buf, buf_size);
-        attr = attr->next;
+    if (threadNum > 1) {
+        threads = (HANDLE*)arena_malloc(res->arena, threadNum * sizeof(HANDLE));
+    }
+
+    for (i = 0; threads != NULL && i < threadNum; ++i) {
+        threads[started] = CreateThread(NULL, 0, extract_worker, &job, 0, NULL);
+
+        if (threads[started] != NULL) {
+            ++started;
+        }
+    }
+
+    if (started == 0) {
+        extract_worker(&job);
+    }
+
+    for (i = 0; i < started; ++i) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    CloseHandle(job.pakFile);
+
+    if (job.failed) {
+        return FALSE;
     }
 
     printf("[SUCCESS] files are saved at `%s`.\n", extractPath);
+    return TRUE;
 }
 
-int main(int argc, char* argv[]) {
+int extract_pak(const char* pakPath, const char* extractPath, const char* savPath, unsigned threadNum, BOOL memoryStats) {
     Resource res;
     PakHeader header;
 
-    if (argc != 3) {
-        fprintf(stderr, "if you have a .pak file called `main.pak`, and you want to extract it to\n");
-        fprintf(stderr, " a dir called `extract_dir`, then usage is: %s main.pak extract_dir\n", argv[0]);
-        return 1;
-    }
-
-    if (is_dir_exist(argv[2])) {
-        fprintf(stderr, "given dir is exists: %s\n", argv[2]);
-        return 1;
+    if (memoryStats) {
+        mem_stats_enable();
     }
 
-    if (!resource_init(&res, argv[1], "filenames.txt")) {
+    if (!resource_init(&res, pakPath, savPath)) {
         fprintf(stderr, "[ERROR] can't init resources\n");
         return 1;
     }
 
     pak_header_init(&header);
-    parse_pak_header(&res, &header);
+    
+    if (!parse_pak_header(&res, &header) || !validate_pak_header(&res, &header)) {
+        fprintf(stderr, "[ERROR] `%s` is not a valid pak file\n", pakPath);
+        resource_free(&res);
+        return 1;
+    }
 
-    printf("[SUCCESS] `%s` has %d files\n", argv[1], header.flist.length);
-    save_file_name_list(&res, &header, "filenames.txt");
+    printf("[SUCCESS] `%s` has %lu files\n", pakPath, (unsigned long)header.entryNum);
+    save_file_name_list(&res, &header, savPath);
 
     printf("saving files ...\n");
-    extract_files(&res, &header, argv[2]);
+    
+    if (!extract_files(&res, &header, pakPath, extractPath, threadNum)) {
+        mem_stats_print();
+        resource_free(&res);
+        return 1;
+    }
 
+    mem_stats_print();
     resource_free(&res);
     return 0;
 }
+#else
+/*
+    the counters of the core, in the same form as the arenas of the standalone build.
+*/
+void core_memory_stats_print(void) {
+    PopcapPakMemoryStats stats;
+    int i;
+
+    popcap_pak_memory_stats(&stats);
+    printf("memory: peak %I64d bytes, live %I64d bytes, %I64u allocations, %I64u frees\n",
+           stats.peakBytes, stats.liveBytes, stats.allocations, stats.frees);
+
+    for (i = 0; i < POPCAP_PAK_MEMORY_PHASES; ++i) {
+        if (stats.phases[i].allocations == 0) {
+            continue;
+        }
+
+        printf("  %s: %I64u allocations, %I64u bytes, peak %I64d bytes\n",
+               stats.phases[i].name, stats.phases[i].allocations, stats.phases[i].bytes, stats.phases[i].peakBytes);
+    }
+}
+
+/*
+    the same steps through the core.
+*/
+int extract_pak(const char* pakPath, const char* extractPath, const char* savPath, unsigned threadNum, BOOL memoryStats) {
+    PopcapPakExtractOptions opt;
+    PopcapPakEntry entry;
+    PopcapPak* pak;
+    FILE* sav;
+    int ret = 1;
+    size_t i;
+
+    if (memoryStats) {
+        popcap_pak_memory_stats_enable();
+    }
+
+    pak = popcap_pak_open(pakPath);
+    if (pak == NULL) {
+        fprintf(stderr, "[ERROR] `%s` is not a valid pak file\n", pakPath);
+        goto tidy_up;
+    }
+
+    sav = fopen(savPath, "w");
+    if (sav == NULL) {
+        fprintf(stderr, "[ERROR] `%s` is not a valid save path\n", savPath);
+        goto tidy_up;
+    }
+
+    printf("[SUCCESS] `%s` has %lu files\n", pakPath, (unsigned long)popcap_pak_file_count(pak));
+
+    for (i = 0; popcap_pak_entry(pak, i, &entry); ++i) {
+        fprintf(sav, "%s, %lu\n", entry.fileName, (unsigned long)entry.fileSize);
+    }
+
+    fclose(sav);
+    printf("[SUCCESS] file name list is saved at `%s`.\n", savPath);
+    printf("saving files ...\n");
+
+    popcap_pak_extract_options_init(&opt);
+    opt.threads = threadNum;
+
+    if (!popcap_pak_extract(pak, extractPath, &opt)) {
+        goto tidy_up;
+    }
+
+    printf("[SUCCESS] files are saved at `%s`.\n", extractPath);
+    ret = 0;
+
+tidy_up:
+    if (memoryStats) {
+        core_memory_stats_print();
+    }
+
+    popcap_pak_close(pak);
+    return ret;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    const char* paths[2];
+    int pathNum = 0;
+    unsigned threadNum = default_thread_num();
+    BOOL memoryStats = FALSE;
+    int i;
+
+    for (i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0 && atoi(argv[i] + 10) > 0) {
+            threadNum = (unsigned)atoi(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--memory-stats") == 0) {
+            memoryStats = TRUE;
+        }
+        else if (pathNum < 2 && strncmp(argv[i], "--", 2) != 0) {
+            paths[pathNum++] = argv[i];
+        }
+        else {
+            pathNum = 3;
+        }
+    }
+
+    if (pathNum != 2) {
+        fprintf(stderr, "if you have a .pak file called `main.pak`, and you want to extract it to\n");
+        fprintf(stderr, " a dir called `extract_dir`, then usage is: %s [--threads=N] [--memory-stats] main.pak extract_dir\n", argv[0]);
+        fprintf(stderr, " the files are extracted by one thread per cpu by default.\n");
+        fprintf(stderr, " --memory-stats prints the allocations and the peak memory per phase at the end,\n");
+        fprintf(stderr, " counted by the core, or by the arenas in the standalone build.\n");
+        return 1;
+    }
+
+    if (is_dir_exist(paths[1])) {
+        fprintf(stderr, "given dir is exists: %s\n", paths[1]);
+        return 1;
+    }
+
+    return extract_pak(paths[0], paths[1], "filenames.txt", threadNum, memoryStats);
+}
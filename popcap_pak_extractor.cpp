@@ -2,381 +2,712 @@
  * @author yuanluo2
  * @brief PopCap's .pak file extractor, written in C++11, only works for windows platform.
  * 
- * a very big thanks to https://github.com/nathaniel-daniel/popcap-pak-rs for giving 
- * the popcap .pak file's format:
- * 
- * Header 
- *   4 bytes - Magic (Should be [0xc0, 0x4a, 0xc0, 0xba])
- *   4 bytes - Version (Should be all 0) 
- *   loop 
- *       1 byte  - Record Flag (exit loop if 0x80)
- *       1 byte  - File name length (N) 
- *       N bytes - Filename 
- *       4 bytes - Filesize (u32)
- *       4 bytes - Last write time (Microsoft FILETIME struct)
- *   end
- *
- * Body
- *   for each record
- *       record.filesize bytes - File data
- *   end
- * 
+ * the .pak file format and the extraction core live in popcap_pak.hpp,
+ * the `bench` subcommand and the config file in popcap_pak_tune.hpp,
+ * the `warm` subcommand in popcap_pak_warm.hpp.
 */
-#define WIN32_LEAN_AND_MEAN
-
-#include <Windows.h>
-
-#include <iostream>
-#include <fstream>
-#include <memory>
-#include <algorithm>
-#include <system_error>
-#include <utility>
-#include <vector>
-#include <array>
-#include <cstdint>
-#include <cstring>
+// this executable counts its allocations for --memory-stats, see popcap_pak_memory.hpp.
+#define POPCAP_PAK_DEFINE_MEMORY_HOOKS
 
-using uchar = unsigned char;
+#include "popcap_pak_tune.hpp"
+#include "popcap_pak_warm.hpp"
+#include "popcap_pak_fanout.hpp"
+#include "popcap_pak_index.hpp"
+#include "popcap_pak_lazy.hpp"
 
-struct FileAttr {
-    std::unique_ptr<char[]> fileName;
-    uint32_t fileSize;
-    FILETIME lastWriteTime;
-};
+#include <cctype>
+#include <sstream>
 
 /*
-    magic should be 0xC0, 0x4A, 0xC0, 0xBA,
-    version should be all 0x00.
+    `target` is a file descriptor number, 1 and 2 are stdout and stderr, or a file path.
 */
-struct Header {
-    std::array<uchar, 4> magic;
-    std::array<uchar, 4> version;
-    std::vector<FileAttr> fileAttrList;
-};
-
-template<typename CharType>
-uchar decode_one_byte(CharType c) {
-    // using 0xf7 to decode the data in .pak file.
-    return static_cast<uchar>(c ^ 0xf7);
-}
+std::FILE* open_progress_output(const char* target) {
+    const char* p = target;
+    while (std::isdigit(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
 
-template<typename CharType>
-void decode_bytes(CharType* data, size_t len) {
-    for (size_t i = 0; i < len; ++i) {
-        data[i] = decode_one_byte(data[i]);
+    if (*p != '\0' || p == target) {
+        return std::fopen(target, "w");
     }
+
+    int fd = std::atoi(target);
+    return fd == 1 ? stdout : fd == 2 ? stderr : _fdopen(fd, "w");
 }
 
-class HeaderParser {
-    bool is_pak_header_end(std::ifstream& f) {
-        char c;
-        f.read(&c, 1);
-        return decode_one_byte(c) == 0x80;
-    }
+template<typename T, typename Parse>
+std::vector<T> parse_list(const char* s, Parse parse) {
+    std::vector<T> items;
+    std::stringstream ss{ s };
+    std::string item;
 
-    void parse_magic(Header& header, std::ifstream& f) {
-        f.read((char*)(header.magic.data()), header.magic.size());
-        decode_bytes(header.magic.data(), header.magic.size());
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(parse(item.c_str()));
+        }
     }
 
-    void parse_version(Header& header, std::ifstream& f) {
-        f.read((char*)(header.version.data()), header.version.size());
-        decode_bytes(header.version.data(), header.version.size());
+    return items;
+}
+
+int run_bench_command(int argc, char* argv[]) {
+    SelfBenchOptions opt;
+
+    for (int i = 0; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--profile=", 10) == 0) {
+            opt.profile = argv[i] + 10;
+        }
+        else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+            opt.threads = parse_list<unsigned>(argv[i] + 10, [](const char* n) {
+                return static_cast<unsigned>((std::max)(1, std::atoi(n)));
+            });
+        }
+        else if (std::strncmp(argv[i], "--buffer-sizes=", 15) == 0) {
+            opt.bufferSizes = parse_list<size_t>(argv[i] + 15, [](const char* n) {
+                return static_cast<size_t>((std::max)(uint64_t(1), parse_size(n)));
+            });
+        }
+        else if (std::strncmp(argv[i], "--repeat=", 9) == 0) {
+            opt.repeat = static_cast<unsigned>((std::max)(1, std::atoi(argv[i] + 9)));
+        }
+        else if (std::strncmp(argv[i], "--work-dir=", 11) == 0) {
+            opt.workDir = argv[i] + 11;
+        }
+        else if (std::strncmp(argv[i], "--config=", 9) == 0) {
+            opt.configPath = argv[i] + 9;
+        }
+        else {
+            std::cerr << "usage: popcap_pak_extractor bench [--profile=tiny|small|medium|large] [--threads=1,2,4,8]\n";
+            std::cerr << "    [--buffer-sizes=8K,64K,256K,1M] [--repeat=3] [--work-dir=DIR] [--config=popcap_pak.conf]\n";
+            return 1;
+        }
     }
 
-    std::unique_ptr<char[]> init_file_name(size_t size) {
-        return std::unique_ptr<char[]>(new char[size]);
+    if (opt.threads.empty() || opt.bufferSizes.empty()) {
+        std::cerr << "--threads and --buffer-sizes need at least one value\n";
+        return 1;
     }
 
-    void parse_file_name(FileAttr& attr, std::ifstream& f) {
-        char c;
-        f.read(&c, 1);
+    SelfBench bench{ opt };
+    return bench.run() ? 0 : 1;
+}
 
-        // get the length of the file name.
-        uint32_t fileNameLen = (uint32_t)decode_one_byte(c);
-        attr.fileName = init_file_name(fileNameLen + 1);
-        attr.fileName[fileNameLen] = '\0';
+int run_warm_command(int argc, char* argv[]) {
+    WarmOptions opt;
+    const char* pakPath = nullptr;
 
-        // get file name.
-        f.read(attr.fileName.get(), fileNameLen);
-        decode_bytes(attr.fileName.get(), fileNameLen);
+    for (int i = 0; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--entries=", 10) == 0) {
+            opt.entries = parse_list<std::string>(argv[i] + 10, [](const char* name) { return std::string{ name }; });
+        }
+        else if (std::strncmp(argv[i], "--access-trace=", 15) == 0) {
+            opt.accessTrace = argv[i] + 15;
+        }
+        else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+            opt.threads = static_cast<unsigned>((std::max)(1, std::atoi(argv[i] + 10)));
+        }
+        else if (std::strcmp(argv[i], "--no-populate") == 0) {
+            opt.populate = false;
+        }
+        else if (argv[i][0] != '-' && pakPath == nullptr) {
+            pakPath = argv[i];
+        }
+        else {
+            pakPath = nullptr;
+            break;
+        }
     }
 
-    void parse_file_size(FileAttr& attr, std::ifstream& f) {
-        constexpr uint32_t FILE_SIZE_BYTES = 4;
+    if (pakPath == nullptr) {
+        std::cerr << "usage: popcap_pak_extractor warm [--entries=NAME,DIR\\,...] [--access-trace=FILE] [--threads=4]\n";
+        std::cerr << "    [--no-populate] main.pak\n";
+        std::cerr << "the access trace is one entry name per line, or a --trace file of an earlier run.\n";
+        return 1;
+    }
 
-        f.read((char*)(&(attr.fileSize)), FILE_SIZE_BYTES);
-        decode_bytes((char*)(&(attr.fileSize)), FILE_SIZE_BYTES);
+    PakWarmer warmer{ opt };
+    return warmer.warm(pakPath) ? 0 : 1;
+}
+
+/*
+    compares the memory of the parsed header with the compact index of the same pak,
+    times a lookup of every name, and prints the entries asked for.
+*/
+int run_index_command(int argc, char* argv[]) {
+    if (argc < 1) {
+        std::cerr << "usage: popcap_pak_extractor index main.pak [NAME...]\n";
+        return 1;
     }
 
-    void parse_file_last_write_time(FileAttr& attr, std::ifstream& f) {
-        f.read((char*)(&(attr.lastWriteTime)), sizeof(FILETIME));
-        decode_bytes((char*)(&(attr.lastWriteTime)), sizeof(FILETIME));
+    Header header;
+    HeaderParser parser;
+    HeaderValidator validator;
+    CompactIndex index;
+    std::ifstream f{ argv[0], std::ios::binary };
+
+    if (!f.is_open()) {
+        std::cerr << "can't open file: `" << argv[0] << "`\n";
+        return 1;
     }
-public:
-    HeaderParser() = default;
 
-    void parse(Header& header, std::ifstream& f) {
-        parse_magic(header, f);
-        parse_version(header, f);
+    if (!parser.parse(header, f) || !validator.validate(header, get_pak_file_size(f))) {
+        std::cerr << "invalid .pak file: `" << argv[0] << "`\n";
+        return 1;
+    }
 
-        while (!f.eof()) {
-            if (is_pak_header_end(f)) {
-                break;
-            }
+    uint64_t start = now_ticks();
+    index.build(header);
+    double buildSeconds = ticks_to_seconds(now_ticks() - start);
 
-            FileAttr attr;
-            parse_file_name(attr, f);
-            parse_file_size(attr, f);
-            parse_file_last_write_time(attr, f);
+    size_t headerBytes = header_memory_bytes(header);
+    size_t indexBytes = index.memory_bytes();
+    IndexEntry entry;
+    size_t missing = 0;
 
-            header.fileAttrList.emplace_back(std::move(attr));
+    start = now_ticks();
+    for (const FileAttr& attr : header.fileAttrList) {
+        if (!index.find(attr.fileName.get(), entry) || entry.offset != attr.offset) {
+            missing++;
         }
     }
-};
+    double lookupSeconds = ticks_to_seconds(now_ticks() - start);
 
-class WinFile {
-    HANDLE hFile;
-public:
-    WinFile() : hFile{ INVALID_HANDLE_VALUE } {}
+    std::cout << index.size() << " files, " << index.distinct_times() << " distinct times, built in " << buildSeconds << " s\n";
+    std::cout << "header: " << headerBytes << " bytes, compact index: " << indexBytes << " bytes, "
+              << static_cast<double>(headerBytes) / (std::max)(indexBytes, size_t(1)) << "x smaller\n";
+    std::cout << "lookup: " << lookupSeconds * 1e9 / (std::max)(index.size(), size_t(1)) << " ns per name\n";
 
-    WinFile(const WinFile&) = delete;
-    WinFile& operator=(const WinFile&) = delete;
+    if (missing > 0) {
+        std::cerr << missing << " names not found in the compact index\n";
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        std::string name = normalize_glob(argv[i]);
 
-    WinFile(WinFile&& other) noexcept {
-        if (this != &other) {
-            hFile = other.hFile;
-            other.hFile = INVALID_HANDLE_VALUE;
+        if (index.find(name.c_str(), entry)) {
+            std::cout << entry.name << ": " << entry.fileSize << " bytes at " << entry.offset << "\n";
+        }
+        else {
+            std::cout << name << ": not found\n";
         }
     }
 
-    WinFile& operator=(WinFile&& other) noexcept {
-        if (this != &other) {
-            hFile = other.hFile;
-            other.hFile = INVALID_HANDLE_VALUE;
-        }
+    return 0;
+}
+
+/*
+    writes entries to stdout straight out of a lazily decoded view, only their pages are decoded.
+*/
+int run_cat_command(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: popcap_pak_extractor cat main.pak NAME...\n";
+        return 1;
+    }
+
+    LazyDecodedView view;
+    CompactIndex index;
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    std::vector<char> buf(1 << 20);
 
-        return *this;
+    if (!view.open(argv[0])) {
+        return 1;
     }
 
-    ~WinFile() noexcept {
-        if (hFile != INVALID_HANDLE_VALUE) {
-            CloseHandle(hFile);
+    index.build(view.header());
+
+    for (int i = 1; i < argc; ++i) {
+        std::string name = normalize_glob(argv[i]);
+        IndexEntry entry;
+
+        if (!index.find(name.c_str(), entry)) {
+            std::cerr << "no such file in pak: `" << name << "`\n";
+            return 1;
+        }
+
+        const char* data = view.data() + (entry.offset - view.header().headerSize);
+
+        // the kernel fails a WriteFile() from a page that isn't decoded yet instead of raising
+        // the exception, so the data goes through a buffer, copying it decodes the pages.
+        for (uint64_t done = 0; done < entry.fileSize; ) {
+            DWORD n = static_cast<DWORD>((std::min)(uint64_t(buf.size()), entry.fileSize - done));
+            DWORD written = 0;
+
+            std::memcpy(buf.data(), data + done, n);
+
+            if (!WriteFile(out, buf.data(), n, &written, nullptr) || written == 0) {
+                std::cerr << "can't write to stdout, error " << GetLastError() << "\n";
+                return 1;
+            }
+
+            done += written;
         }
     }
 
-    bool init(const char* path, std::error_code& ec) noexcept {
-        hFile = CreateFile(path, 
-                            GENERIC_WRITE,
-                            0,
-                            nullptr,
-                            CREATE_NEW,
-                            FILE_ATTRIBUTE_NORMAL,
-                            nullptr);
+    std::cerr << "decoded " << view.decoded_bytes() << " of " << view.body_size() << " bytes in " << view.fault_count() << " faults\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::strcmp(argv[1], "bench") == 0) {
+        return run_bench_command(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "warm") == 0) {
+        return run_warm_command(argc - 2, argv + 2);
+    }
 
-        if (hFile == INVALID_HANDLE_VALUE) {
-            ec.assign(GetLastError(), std::system_category());
-            return false;
+    if (argc > 1 && std::strcmp(argv[1], "cat") == 0) {
+        return run_cat_command(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "index") == 0) {
+        return run_index_command(argc - 2, argv + 2);
+    }
+
+    // the options of a config file come first, so the command line overrides them.
+    std::vector<std::string> options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--config=", 9) == 0 && !load_config_options(argv[i] + 9, options)) {
+            std::cerr << "can't open config: `" << argv[i] + 9 << "`\n";
+            return 1;
         }
-        else {
-            ec.clear();
-            return true;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--config=", 9) != 0) {
+            options.push_back(argv[i]);
         }
     }
 
-    bool write_data(const char* data, DWORD len, std::error_code& ec) noexcept {
-        if (!WriteFile(hFile, data, len, nullptr, nullptr)) {
-            ec.assign(GetLastError(), std::system_category());
-            return false;
+    std::vector<const char*> args;
+    unsigned threadNum = 1;
+    TuneConfig engine;
+    const char* statsJsonPath = nullptr;
+    const char* tracePath = nullptr;
+    size_t traceCapacity = 1 << 16;
+    bool hwCounters = false;
+    bool progressText = false;
+    const char* progressJson = nullptr;
+    unsigned progressInterval = 500;
+    bool autoTune = false;
+    bool direct = false;
+    PlacementMode placement = PlacementMode::Off;
+    Durability durability = Durability::None;
+    const char* tarPath = nullptr;
+    const char* manifestPath = nullptr;
+    const char* casPath = nullptr;
+    std::vector<PriorityClass> priorities;
+    const char* readyFile = nullptr;
+    const char* readyFd = nullptr;
+    bool threadsGiven = false;
+    bool backendGiven = false;
+    bool bufferGiven = false;
+
+    for (const std::string& option : options) {
+        const char* arg = option.c_str();
+
+        if (std::strncmp(arg, "--threads=", 10) == 0) {
+            threadNum = static_cast<unsigned>((std::max)(1, std::atoi(arg + 10)));
+            threadsGiven = true;
+        }
+        else if (std::strncmp(arg, "--stats-json=", 13) == 0) {
+            statsJsonPath = arg + 13;
+        }
+        else if (std::strncmp(arg, "--trace=", 8) == 0) {
+            tracePath = arg + 8;
+        }
+        else if (std::strncmp(arg, "--trace-buffer=", 15) == 0) {
+            traceCapacity = static_cast<size_t>((std::max)(1, std::atoi(arg + 15)));
+        }
+        else if (std::strcmp(arg, "--hw-counters") == 0) {
+            hwCounters = true;
+        }
+        else if (std::strcmp(arg, "--memory-stats") == 0) {
+            MemoryStats::instance().enable();
+        }
+        else if (std::strcmp(arg, "--progress") == 0) {
+            progressText = true;
+        }
+        else if (std::strncmp(arg, "--progress-json=", 16) == 0) {
+            progressJson = arg + 16;
+        }
+        else if (std::strncmp(arg, "--progress-interval=", 20) == 0) {
+            progressInterval = static_cast<unsigned>((std::max)(1, std::atoi(arg + 20)));
+        }
+        else if (std::strncmp(arg, "--backend=", 10) == 0) {
+            engine.backend = arg + 10;
+            backendGiven = true;
+        }
+        else if (std::strncmp(arg, "--buffer-size=", 14) == 0) {
+            engine.bufferSize = static_cast<size_t>((std::max)(uint64_t(1), parse_size(arg + 14)));
+            bufferGiven = true;
+        }
+        else if (std::strcmp(arg, "--auto") == 0) {
+            autoTune = true;
+        }
+        else if (std::strcmp(arg, "--direct") == 0) {
+            direct = true;
+        }
+        else if (std::strcmp(arg, "--numa") == 0) {
+            placement = placement == PlacementMode::Off ? PlacementMode::Node : placement;
+        }
+        else if (std::strcmp(arg, "--pin") == 0) {
+            placement = PlacementMode::Pin;
+        }
+        else if (std::strncmp(arg, "--tar=", 6) == 0) {
+            tarPath = arg + 6;
+        }
+        else if (std::strncmp(arg, "--manifest=", 11) == 0) {
+            manifestPath = arg + 11;
+        }
+        else if (std::strncmp(arg, "--cas=", 6) == 0) {
+            casPath = arg + 6;
+        }
+        else if (std::strncmp(arg, "--priority=", 11) == 0) {
+            if (!load_priority_rules(arg + 11, priorities)) {
+                std::cerr << "can't open priority file: `" << arg + 11 << "`\n";
+                return 1;
+            }
+        }
+        else if (std::strncmp(arg, "--priority-glob=", 16) == 0) {
+            priorities.push_back(PriorityClass{ "priority", parse_list<std::string>(arg + 16, [](const char* glob) {
+                return normalize_glob(glob);
+            }) });
+        }
+        else if (std::strncmp(arg, "--ready-file=", 13) == 0) {
+            readyFile = arg + 13;
+        }
+        else if (std::strncmp(arg, "--ready-fd=", 11) == 0) {
+            readyFd = arg + 11;
+        }
+        else if (std::strncmp(arg, "--durability=", 13) == 0) {
+            if (!parse_durability(arg + 13, durability)) {
+                std::cerr << "unknown durability: `" << arg + 13 << "`, it's none, end or per-file\n";
+                return 1;
+            }
         }
         else {
-            ec.clear();
-            return true;
+            args.push_back(arg);
         }
     }
 
-    bool set_file_time(const FILETIME& ft, std::error_code& ec) noexcept {
-        if (!SetFileTime(hFile, nullptr, nullptr, &ft)) {
-            ec.assign(GetLastError(), std::system_category());
-            return false;
+    if (args.size() != 2) {
+        std::cerr << "If you have a .pak file called `main.pak`, and you want to \n";
+        std::cerr << "extract it to a dir called `sav`, then usage is: ";
+        std::cerr << argv[0] << " [--threads=N] [--stats-json=FILE] [--trace=FILE [--trace-buffer=EVENTS]] [--hw-counters] [--memory-stats]\n";
+        std::cerr << "    [--progress | --progress-json=FD|FILE] [--progress-interval=MS]\n";
+        std::cerr << "    [--backend=ifstream|stdio|readfile|positional|mmap|unbuffered] [--buffer-size=BYTES] [--config=FILE]\n";
+        std::cerr << "    [--auto] [--direct] [--numa | --pin] [--durability=none|end|per-file]\n";
+        std::cerr << "    [--tar=FILE] [--manifest=FILE] [--cas=DIR]\n";
+        std::cerr << "    [--priority=FILE] [--priority-glob=GLOB,...] [--ready-file=FILE] [--ready-fd=FD|FILE] main.pak sav|-\n";
+        std::cerr << "`" << argv[0] << " bench` measures this host and writes the fastest settings as a config file.\n";
+        std::cerr << "`" << argv[0] << " warm main.pak` reads the pak, or some entries of it, into the file cache.\n";
+        std::cerr << "--auto picks the settings not given from the storage of the pak and the output dir,\n";
+        std::cerr << "and adjusts the running threads to the measured throughput unless --threads is given.\n";
+        std::cerr << "--direct reads the pak and writes the files without the file cache.\n";
+        std::cerr << "--numa keeps every worker, its files and its buffers on one NUMA node, --pin also pins it to the cpus of one L3.\n";
+        std::cerr << "--durability=end flushes the extracted files and dirs once they're all written, per-file flushes each one.\n";
+        std::cerr << "--tar, --manifest and --cas are written from the same read of the pak as `sav`, `-` writes no dir.\n";
+        std::cerr << "--priority extracts the files of its classes first, --ready-file is created once they're all saved,\n";
+        std::cerr << "--ready-fd gets a `ready CLASS SECONDS` line as each class is done, `failed` if a file of it wasn't saved.\n";
+        std::cerr << "--memory-stats counts the allocations and the peak memory of every phase into the stats.\n";
+        return 0;
+    }
+
+    if (direct && (backendGiven || bufferGiven)) {
+        std::cerr << "--direct has its own aligned reads, it can't be used with --backend or --buffer-size\n";
+        return 1;
+    }
+
+    const char* pakPath = args[0];
+    const char* rootPath = args[1];
+    bool fanout = tarPath != nullptr || manifestPath != nullptr || casPath != nullptr;
+    bool writeDir = std::strcmp(rootPath, "-") != 0;
+    std::unique_ptr<ConcurrencyController> controller;
+
+    if (fanout && (direct || autoTune || backendGiven || bufferGiven || threadNum > 1)) {
+        std::cerr << "--tar, --manifest and --cas read the pak on one thread, they can't be used with\n";
+        std::cerr << "--direct, --auto, --backend, --buffer-size or --threads\n";
+        return 1;
+    }
+
+    if (!priorities.empty() && placement != PlacementMode::Off) {
+        std::cerr << "--numa splits the file list by node, it can't keep the --priority order\n";
+        return 1;
+    }
+
+    if ((readyFile != nullptr || readyFd != nullptr) && priorities.empty()) {
+        std::cerr << "--ready-file and --ready-fd need --priority or --priority-glob\n";
+        return 1;
+    }
+
+    if (!fanout && !writeDir) {
+        std::cerr << "`-` writes no dir, it needs --tar, --manifest or --cas\n";
+        return 1;
+    }
+
+    if (autoTune) {
+        StorageInfo input = detect_storage(pakPath);
+        StorageInfo output = detect_storage(rootPath);
+        StoragePolicy policy = storage_policy(input, output);
+
+        std::cout << "input `" << input.volume << "` is " << storage_class_name(input.cls) << " " << input.fileSystem
+                  << " (queue depth " << input.queueDepth << ")"
+                  << ", output `" << output.volume << "` is " << storage_class_name(output.cls) << " " << output.fileSystem
+                  << " (queue depth " << output.queueDepth << ")\n";
+
+        if (!backendGiven && !direct) {
+            engine.backend = policy.backend;
+        }
+
+        if (!bufferGiven && !direct) {
+            engine.bufferSize = policy.bufferSize;
+        }
+
+        if (!threadsGiven) {
+            controller.reset(new ConcurrencyController{ policy.threads, 1, policy.maxThreads });
+            threadNum = controller->max_workers();
+        }
+
+        std::cout << "using " << (direct ? "direct I/O" : engine.backend) << " with a " << engine.bufferSize << " bytes buffer, ";
+        if (controller) {
+            std::cout << policy.threads << " threads at the start, up to " << policy.maxThreads << "\n";
         }
         else {
-            ec.clear();
-            return true;
+            std::cout << threadNum << " threads\n";
         }
     }
-};
 
-void save_file_attr_list(const Header& header, const char* savPath) {
-    std::ofstream out{ savPath };
+    const ExtractEngine* backend = find_extract_backend(engine.backend);
+    if (backend == nullptr) {
+        std::cerr << "unknown backend: `" << engine.backend << "`\n";
+        return 1;
+    }
 
-    for (const FileAttr& attr : header.fileAttrList) {
-        out << attr.fileName.get() << ", " << attr.fileSize << "\n";
+    if (writeDir && is_dir_exist(rootPath)) {
+        std::cerr << "given dir is exists: `" << rootPath << "`\n";
+        return 1;
     }
 
-    std::cout << "file attributes are saved at `" << savPath << "`\n";
-    std::cout << "this .pak file has " << header.fileAttrList.size() << " files\n";
-}
+    if (tracePath != nullptr) {
+        Tracer::instance().enable(traceCapacity);
+    }
 
-bool is_dir_exist(const char* path) {
-    DWORD dwAttrib = GetFileAttributes(path);
+    if (placement != PlacementMode::Off) {
+        if (WorkerPlacement::instance().enable(placement)) {
+            WorkerPlacement::instance().print(std::cout);
+        }
+        else {
+            std::cerr << "can't read the cpu topology, running without --numa\n";
+        }
+    }
 
-    return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
-            (dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
-}
+    DurabilityTracker::instance().enable(durability);
 
-/*
-    concatenate 2 paths, only for windows platform.
-*/
-void path_concatenate(std::array<char, MAX_PATH>& buf, const char* parent, const char* sub) {
-    bool hasBackslash = false;
-    char* cursor = buf.data();
+    Header header;
+    HeaderParser parser;
+    HeaderValidator validator;
+    ExtractStats stats;
+    uint64_t start = now_ticks();
+    std::ifstream f;
 
-    while (*parent != '\0') {
-        *cursor = *parent;
+    if (hwCounters && !hw_counters_available()) {
+        std::cerr << "hardware counters are not available, running without them\n";
+        hwCounters = false;
+    }
 
-        ++cursor;
-        ++parent;
+    stats.hwCounters = hwCounters;
+    
+    f.open(pakPath, std::ios::binary);
+    if (!f.is_open()) {
+        std::cerr << "can't open file: `" << pakPath << "`\n";
+        return 1;
     }
 
-    --parent;
-    if (*parent == '\\') {
-        hasBackslash = true;
+    uint64_t pakSize = get_pak_file_size(f);
+    bool valid;
+
+    {
+        PhaseTimer timer{ &stats, Phase::Parse };
+        MemoryScope scope{ MemPhase::Parse };
+        valid = parser.parse(header, f) && validator.validate(header, pakSize);
     }
 
-    if (*sub != '\\' && !hasBackslash) {
-        *cursor = '\\';
-        ++cursor;
+    if (!valid) {
+        std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+        return 1;
     }
 
-    if (*sub == '\\' && hasBackslash) {
-        ++sub;
+    stats.headerBytes = header.headerSize;
+
+    save_file_attr_list(header, "./pak_file_attr_list.txt");
+
+    std::unique_ptr<ProgressReporter> progress;
+    std::FILE* progressOut = stderr;
+
+    if (progressJson != nullptr) {
+        progressOut = open_progress_output(progressJson);
+
+        if (progressOut == nullptr) {
+            std::cerr << "can't open progress output: `" << progressJson << "`\n";
+            return 1;
+        }
     }
 
-    while (*sub != '\0') {
-        *cursor = *sub;
+    if (progressText || progressJson != nullptr) {
+        uint64_t totalBytes = 0;
+        for (const FileAttr& attr : header.fileAttrList) {
+            totalBytes += attr.fileSize;
+        }
 
-        ++cursor;
-        ++sub;
+        progress.reset(new ProgressReporter{ threadNum, header.fileAttrList.size(), totalBytes,
+                                             progressJson != nullptr ? ProgressMode::Json : ProgressMode::Text,
+                                             progressOut, progressInterval });
+        stats.progress = progress->slot_array();
+        progress->start_rendering();
     }
+    
+    std::FILE* readyOut = nullptr;
 
-    *cursor = '\0';
-}
+    if (readyFd != nullptr && (readyOut = open_progress_output(readyFd)) == nullptr) {
+        std::cerr << "can't open ready output: `" << readyFd << "`\n";
+        return 1;
+    }
 
-/*
-    constructs all parent directories of the given path if they're not exist.
-*/
-bool construct_parent_dirs(char* path, std::error_code& ec) {
-    char* cursor = path;
-
-    while (*cursor != '\0') {
-        if (*cursor == '\\') {
-            /* 
-                CreateDirectory() needs a null terminated string, so we can play a trick here.
-                this is why this function's arguments just need a char*, with this
-                operation, we won't do any copy on the path.
-            */
-            *cursor = '\0';
-
-            if (!is_dir_exist(path)) {
-                if (!CreateDirectory(path, nullptr)) {
-                    ec.assign(GetLastError(), std::system_category());
-                    return false;
-                }
+    ReadinessTracker readiness;
+
+    if (!priorities.empty()) {
+        size_t pending = priorities.size();
+        bool allReady = true;
+
+        // a class with a file that wasn't saved is reported as failed, and the ready file is never created.
+        readiness.start(header, priorities, [&](const std::string& name, bool ready) {
+            double seconds = ticks_to_seconds(now_ticks() - start);
+            std::cout << (ready ? "ready: " : "failed: ") << name << " after " << seconds << " s\n";
+
+            if (readyOut != nullptr) {
+                std::fprintf(readyOut, "%s %s %.3f\n", ready ? "ready" : "failed", name.c_str(), seconds);
+                std::fflush(readyOut);
             }
 
-            // reset back.
-            *cursor = '\\';
+            allReady = allReady && ready;
+
+            if (--pending == 0 && allReady && readyFile != nullptr && !std::ofstream{ readyFile }) {
+                std::cerr << "can't create ready file: `" << readyFile << "`\n";
+            }
+        });
+
+        for (size_t c = 0; c < priorities.size(); ++c) {
+            std::cout << "priority " << priorities[c].name << ": " << readiness.files_in(c) << " files\n";
         }
 
-        ++cursor;
+        stats.readiness = &readiness;
     }
 
-    ec.clear();
-    return true;
-}
+    // the serial engines read the files in pak order, a priority order needs seeks.
+    bool ordered = readiness.started();
+    bool saved;
+    std::vector<std::unique_ptr<FanoutSink>> sinks;
 
-template<size_t N>
-void save_single_file_data(const FileAttr& attr, std::ifstream& f, std::array<char, N>& buf, const char* filePath) {
-    uint32_t fileSize = attr.fileSize;
-    uint32_t readLen = 0;
-    std::error_code ec;
-    WinFile wf;
-    
-    if (!wf.init(filePath, ec)) {
-        std::cerr << "create file failed: `" << filePath << "`, " << ec.message() << "\n";
-        return;
-    }
+    if (fanout) {
+        MemoryScope scope{ MemPhase::Buffers };
+        std::unique_ptr<TarSink> tar{ tarPath != nullptr ? new TarSink{ tarPath } : nullptr };
+        std::unique_ptr<ManifestSink> manifest{ manifestPath != nullptr ? new ManifestSink{ manifestPath } : nullptr };
+        std::unique_ptr<CasSink> cas{ casPath != nullptr ? new CasSink{ casPath } : nullptr };
 
-    while (fileSize > 0) {
-        if (fileSize < buf.size()) {
-            f.read(buf.data(), fileSize);
-        }
-        else {
-            f.read(buf.data(), buf.size());
+        if ((tar && !tar->init()) || (manifest && !manifest->init()) || (cas && !cas->init())) {
+            return 1;
         }
 
-        readLen = f.gcount();
-        decode_bytes(buf.data(), readLen);
+        if (writeDir) {
+            sinks.emplace_back(new DirectorySink{ rootPath });
+        }
 
-        if (!wf.write_data(buf.data(), readLen, ec)) {
-            std::cerr << "write to file failed for file `" << filePath << "`, " << ec.message() << "\n";
-            return;
-        }    
-        
-        fileSize -= readLen;
+        sinks.emplace_back(std::move(tar));
+        sinks.emplace_back(std::move(manifest));
+        sinks.emplace_back(std::move(cas));
+        sinks.erase(std::remove(sinks.begin(), sinks.end(), nullptr), sinks.end());
     }
 
-    if (!wf.set_file_time(attr.lastWriteTime, ec)) {
-        std::cerr << "set last write time failed for file `" << filePath << "`, " << ec.message() << "\n";
+    // what the workers allocate outside of their buffers and caches.
+    MemoryStats::instance().set_default_phase(MemPhase::Extract);
+
+    if (fanout) {
+        saved = extract_fanout(header, pakPath, sinks, &stats);
+    }
+    else if (direct && (threadNum > 1 || controller || ordered)) {
+        saved = save_file_data_parallel<DirectReader, DirectFile>(header, pakPath, rootPath, threadNum, &stats, controller.get());
+    }
+    else if (direct) {
+        DirectReader reader{ pakPath };
+        reader.seekg(static_cast<std::streamoff>(header.headerSize), std::ios::beg);
+        saved = reader.is_open() && save_file_data<DirectFile>(header, reader, rootPath, &stats);
+    }
+    else if (!engine.is_default()) {
+        saved = backend->fn(header, pakPath, rootPath, engine.bufferSize, threadNum, &stats, controller.get());
+    }
+    else if (threadNum > 1 || controller || ordered) {
+        saved = save_file_data_parallel(header, pakPath, rootPath, threadNum, &stats, controller.get());
+    }
+    else {
+        saved = save_file_data(header, f, rootPath, &stats);
     }
-}
 
-void save_file_data(const Header& header, std::ifstream& f, const char* rootPath) {
-    std::array<char, 8192> buf;
-    std::array<char, MAX_PATH> pathBuf;
-    std::error_code ec;   // C++11 's std::error_code is very fit for operating system api.
+    MemoryStats::instance().set_default_phase(MemPhase::Other);
 
-    for (const FileAttr& attr : header.fileAttrList) {
-        path_concatenate(pathBuf, rootPath, attr.fileName.get());
-        
-        if (!construct_parent_dirs(pathBuf.data(), ec)) {
-            std::cerr << "create dir failed for `" << pathBuf.data() << "`, " << ec.message() << "\n";
-            continue;
-        }
+    if (progress) {
+        progress->stop();
 
-        save_single_file_data(attr, f, buf, pathBuf.data());
+        if (progressOut != stdout && progressOut != stderr) {
+            std::fclose(progressOut);
+        }
     }
 
-    std::cout << "files data are saved at `" << rootPath << "`\n";
-}
-
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "If you have a .pak file called `main.pak`, and you want to \n";
-        std::cerr << "extract it to a dir called `sav`, then usage is: ";
-        std::cerr << argv[0] << " main.pak sav\n";
-        return 0;
+    if (readyOut != nullptr && readyOut != stdout && readyOut != stderr) {
+        std::fclose(readyOut);
     }
 
-    if (is_dir_exist(argv[2])) {
-        std::cerr << "given dir is exists: `" << argv[2] << "`\n";
+    if (!saved) {
         return 1;
     }
 
-    Header header;
-    HeaderParser parser;
-    std::ifstream f;
-    
-    f.open(argv[1], std::ios::binary);
-    if (!f.is_open()) {
-        std::cerr << "can't open file: `" << argv[1] << "`\n";
+    if (!DurabilityTracker::instance().finish(rootPath, std::cout)) {
+        std::cerr << "not all the files are flushed to disk\n";
         return 1;
     }
 
-    parser.parse(header, f);
-    save_file_attr_list(header, "./pak_file_attr_list.txt");
-    save_file_data(header, f, argv[2]);
+    double wallSeconds = ticks_to_seconds(now_ticks() - start);
+    if (writeDir) {
+        std::cout << "files data are saved at `" << rootPath << "`\n";
+    }
+    stats.print_summary(std::cout, wallSeconds);
+
+    if (controller) {
+        controller->print_history(std::cout);
+    }
+
+    for (const std::unique_ptr<FanoutSink>& sink : sinks) {
+        std::cout << "  sink " << sink->name() << ": " << ticks_to_seconds(sink->busyTicks) * 1000 << " ms busy\n";
+    }
+
+    if (statsJsonPath != nullptr) {
+        std::ofstream out{ statsJsonPath };
+
+        if (!stats.write_json(out, wallSeconds)) {
+            std::cerr << "can't write stats to `" << statsJsonPath << "`\n";
+            return 1;
+        }
+    }
+
+    if (tracePath != nullptr) {
+        std::ofstream out{ tracePath };
+
+        if (!Tracer::instance().write_json(out)) {
+            std::cerr << "can't write trace to `" << tracePath << "`\n";
+            return 1;
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,654 @@
+/**
+ * @author yuanluo2
+ * @brief one read and decode of a .pak file, written to many outputs at once, written in C++11, only works for windows platform.
+ *
+ * the reader decodes every file into chunks of a fixed pool and hands each chunk to all the
+ * sinks as a shared_ptr, every sink runs on its own thread with its own queue, and a chunk goes
+ * back to the pool when the last sink drops it. the pool is small, so a slow sink holds the
+ * reader back instead of piling up decoded data. sinks:
+ *   DirectorySink  the usual dir tree.
+ *   TarSink        a ustar archive.
+ *   ManifestSink   `sha256  name` lines, `sha256sum -c` reads them.
+ *   CasSink        content addressed blobs, `objects\ab\abcd...`, one copy of each content.
+*/
+#ifndef POPCAP_PAK_FANOUT_HPP
+#define POPCAP_PAK_FANOUT_HPP
+
+#include "popcap_pak_io.hpp"
+#include "popcap_pak_sha256.hpp"
+
+#include <string>
+#include <deque>
+#include <memory>
+
+struct DecodedChunk {
+    char* data;
+    size_t len;
+};
+
+using ChunkRef = std::shared_ptr<const DecodedChunk>;
+
+class ChunkPool {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<char*> owned;
+    std::vector<char*> freeBlocks;
+public:
+    explicit ChunkPool(unsigned count) {
+        unsigned node = current_numa_node();
+
+        for (unsigned i = 0; i < count; ++i) {
+            char* block = AlignedBufferPool::instance().acquire(node);
+
+            if (block != nullptr) {
+                owned.push_back(block);
+                freeBlocks.push_back(block);
+            }
+        }
+    }
+
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    // every chunk must be dropped before.
+    ~ChunkPool() {
+        unsigned node = current_numa_node();
+
+        for (char* block : owned) {
+            AlignedBufferPool::instance().release(block, node);
+        }
+    }
+
+    bool empty() const noexcept {
+        return owned.empty();
+    }
+
+    // waits until a sink drops a chunk if all of them are in use.
+    std::shared_ptr<DecodedChunk> acquire() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        cv.wait(lock, [this]() { return !freeBlocks.empty(); });
+
+        char* block = freeBlocks.back();
+        freeBlocks.pop_back();
+
+        return std::shared_ptr<DecodedChunk>(new DecodedChunk{ block, 0 }, [this](DecodedChunk* chunk) {
+            {
+                std::lock_guard<std::mutex> lock{ mutex };
+                freeBlocks.push_back(chunk->data);
+            }
+
+            cv.notify_one();
+            delete chunk;
+        });
+    }
+};
+
+/*
+    the calls of one file come in order, begin_file(), write() for every chunk, end_file().
+    a sink prints its own errors, returning false stops it, the other sinks go on.
+    a sink that skips a file and goes on clears fileSaved in end_file().
+*/
+class FanoutSink {
+public:
+    uint64_t busyTicks = 0;
+    bool fileSaved = true;
+
+    virtual ~FanoutSink() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool begin_file(const FileAttr& attr) = 0;
+    virtual bool write(const char* data, size_t len) = 0;
+    virtual bool end_file(const FileAttr& attr) = 0;
+    virtual bool finish() = 0;
+};
+
+/*
+    a file that can't be created is skipped like in the other engines.
+*/
+class DirectorySink : public FanoutSink {
+    std::string rootPath;
+    std::array<char, MAX_PATH> pathBuf;
+    WinFile wf;
+    bool created = false;
+public:
+    explicit DirectorySink(const char* root) : rootPath{ root } {}
+
+    const char* name() const override { return "dir"; }
+
+    bool begin_file(const FileAttr& attr) override {
+        std::error_code ec;
+
+        path_concatenate(pathBuf, rootPath.c_str(), attr.fileName.get());
+        created = construct_parent_dirs(pathBuf.data(), ec) && wf.init(pathBuf.data(), ec);
+
+        if (!created) {
+            std::cerr << "create file failed: `" << pathBuf.data() << "`, " << ec.message() << "\n";
+        }
+
+        return true;
+    }
+
+    bool write(const char* data, size_t len) override {
+        std::error_code ec;
+
+        if (created && !wf.write_data(data, static_cast<DWORD>(len), ec)) {
+            std::cerr << "write to file failed for file `" << pathBuf.data() << "`, " << ec.message() << "\n";
+            wf.close();
+            created = false;
+        }
+
+        return true;
+    }
+
+    bool end_file(const FileAttr& attr) override {
+        std::error_code ec;
+
+        fileSaved = created;
+        if (!created) {
+            return true;
+        }
+
+        if (!wf.set_file_time(attr.lastWriteTime, ec)) {
+            std::cerr << "set last write time failed for file `" << pathBuf.data() << "`, " << ec.message() << "\n";
+        }
+
+        wf.close();
+        DurabilityTracker::instance().file_done(pathBuf.data());
+        return true;
+    }
+
+    bool finish() override {
+        return true;
+    }
+};
+
+/*
+    ustar, the names of the pak use `\`, tar uses `/`. a name longer than 100 bytes is split
+    into the 155 bytes prefix field at a `/`, a name that still doesn't fit stops the archive.
+*/
+class TarSink : public FanoutSink {
+    static constexpr size_t BLOCK = 512;
+
+    std::string path;
+    WinFile wf;
+    std::vector<char> stage;    // headers and small files are written in big pieces.
+    size_t staged = 0;
+    uint64_t fileBytes = 0;
+    bool failed = false;
+
+    bool flush_stage() {
+        std::error_code ec;
+
+        if (staged > 0 && !wf.write_data(stage.data(), static_cast<DWORD>(staged), ec)) {
+            std::cerr << "write to tar failed: `" << path << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        staged = 0;
+        return true;
+    }
+
+    bool append(const char* data, size_t len) {
+        std::error_code ec;
+
+        if (staged + len <= stage.size()) {
+            std::memcpy(stage.data() + staged, data, len);
+            staged += len;
+            return staged < stage.size() || flush_stage();
+        }
+
+        if (!flush_stage() || !wf.write_data(data, static_cast<DWORD>(len), ec)) {
+            std::cerr << "write to tar failed: `" << path << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    static void put_octal(char* field, size_t width, uint64_t value) {
+        std::snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+    }
+public:
+    explicit TarSink(const char* tarPath) : path{ tarPath }, stage(1 << 20) {}
+
+    bool init() {
+        std::error_code ec;
+
+        if (!wf.init(path.c_str(), ec)) {
+            std::cerr << "can't create tar: `" << path << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* name() const override { return "tar"; }
+
+    bool begin_file(const FileAttr& attr) override {
+        std::array<char, BLOCK> header{};
+        std::string fileName = attr.fileName.get();
+        std::replace(fileName.begin(), fileName.end(), '\\', '/');
+
+        // the last `/` that fits the prefix leaves the shortest name.
+        size_t split = 0;
+        if (fileName.size() > 100) {
+            split = fileName.rfind('/', 155);
+
+            if (split == std::string::npos || split == 0 || fileName.size() - split - 1 > 100) {
+                std::cerr << "name too long for tar: `" << attr.fileName.get() << "`\n";
+                return false;
+            }
+        }
+
+        std::string prefix = split > 0 ? fileName.substr(0, split) : std::string{};
+        std::string shortName = split > 0 ? fileName.substr(split + 1) : fileName;
+        uint64_t unixTime = (static_cast<uint64_t>(attr.lastWriteTime.dwHighDateTime) << 32 | attr.lastWriteTime.dwLowDateTime);
+        unixTime = unixTime > 116444736000000000ULL ? (unixTime - 116444736000000000ULL) / 10000000 : 0;
+
+        std::memcpy(header.data(), shortName.data(), shortName.size());
+        put_octal(header.data() + 100, 8, 0644);
+        put_octal(header.data() + 108, 8, 0);
+        put_octal(header.data() + 116, 8, 0);
+        put_octal(header.data() + 124, 12, attr.fileSize);
+        put_octal(header.data() + 136, 12, unixTime);
+        std::memset(header.data() + 148, ' ', 8);
+        header[156] = '0';
+        std::memcpy(header.data() + 257, "ustar\0" "00", 8);
+        std::memcpy(header.data() + 345, prefix.data(), prefix.size());
+
+        unsigned sum = 0;
+        for (char c : header) {
+            sum += static_cast<unsigned char>(c);
+        }
+
+        put_octal(header.data() + 148, 7, sum);
+        fileBytes = 0;
+
+        failed = !append(header.data(), header.size());
+        return !failed;
+    }
+
+    bool write(const char* data, size_t len) override {
+        fileBytes += len;
+        failed = !append(data, len);
+        return !failed;
+    }
+
+    bool end_file(const FileAttr&) override {
+        static const std::array<char, BLOCK> zeros{};
+        size_t pad = static_cast<size_t>((BLOCK - fileBytes % BLOCK) % BLOCK);
+
+        failed = !append(zeros.data(), pad);
+        return !failed;
+    }
+
+    // two zero blocks end the archive.
+    bool finish() override {
+        static const std::array<char, BLOCK * 2> zeros{};
+
+        if (failed || !append(zeros.data(), zeros.size()) || !flush_stage()) {
+            return false;
+        }
+
+        wf.close();
+        DurabilityTracker::instance().file_done(path.c_str());
+        return true;
+    }
+};
+
+class ManifestSink : public FanoutSink {
+    std::string path;
+    std::ofstream out;
+    Sha256 sha;
+public:
+    explicit ManifestSink(const char* manifestPath) : path{ manifestPath } {}
+
+    bool init() {
+        out.open(path, std::ios::binary);
+
+        if (!out.is_open()) {
+            std::cerr << "can't create manifest: `" << path << "`\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* name() const override { return "manifest"; }
+
+    bool begin_file(const FileAttr&) override {
+        sha.reset();
+        return true;
+    }
+
+    bool write(const char* data, size_t len) override {
+        sha.update(data, len);
+        return true;
+    }
+
+    bool end_file(const FileAttr& attr) override {
+        std::string fileName = attr.fileName.get();
+        std::replace(fileName.begin(), fileName.end(), '\\', '/');
+
+        out << sha.hex_digest() << "  " << fileName << "\n";
+        return static_cast<bool>(out);
+    }
+
+    bool finish() override {
+        out.close();
+
+        if (!out) {
+            std::cerr << "write to manifest failed: `" << path << "`\n";
+            return false;
+        }
+
+        DurabilityTracker::instance().file_done(path.c_str());
+        return true;
+    }
+};
+
+/*
+    every file is written to `tmp\N` while it's hashed, then moved to `objects\ab\<sha256>`,
+    or deleted if that content is already there. `index.txt` maps the names to the hashes.
+*/
+class CasSink : public FanoutSink {
+    std::string rootPath;
+    std::string tmpPath;
+    std::string tmpFile;
+    std::ofstream index;
+    WinFile wf;
+    Sha256 sha;
+    uint64_t blobs = 0;
+    uint64_t duplicates = 0;
+    bool failed = false;
+public:
+    explicit CasSink(const char* root)
+        : rootPath{ root }, tmpPath{ rootPath + "\\tmp" }, tmpFile{ tmpPath + "\\" + std::to_string(GetCurrentProcessId()) } {}
+
+    bool init() {
+        std::array<char, MAX_PATH> pathBuf;
+        std::error_code ec;
+
+        path_concatenate(pathBuf, rootPath.c_str(), "tmp\\index.txt");
+        if (!construct_parent_dirs(pathBuf.data(), ec)) {
+            std::cerr << "can't create cas dir: `" << rootPath << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        index.open(rootPath + "\\index.txt", std::ios::binary | std::ios::app);
+        if (!index.is_open()) {
+            std::cerr << "can't open cas index: `" << rootPath << "\\index.txt`\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* name() const override { return "cas"; }
+
+    bool begin_file(const FileAttr&) override {
+        std::error_code ec;
+
+        DeleteFile(tmpFile.c_str());
+        sha.reset();
+
+        if (!wf.init(tmpFile.c_str(), ec)) {
+            std::cerr << "can't create cas temp file: `" << tmpFile << "`, " << ec.message() << "\n";
+            failed = true;
+        }
+
+        return !failed;
+    }
+
+    bool write(const char* data, size_t len) override {
+        std::error_code ec;
+
+        sha.update(data, len);
+        if (!wf.write_data(data, static_cast<DWORD>(len), ec)) {
+            std::cerr << "write to cas failed: `" << tmpFile << "`, " << ec.message() << "\n";
+            failed = true;
+        }
+
+        return !failed;
+    }
+
+    bool end_file(const FileAttr& attr) override {
+        std::array<char, MAX_PATH> pathBuf;
+        std::string hash = sha.hex_digest();
+        std::error_code ec;
+
+        wf.close();
+        path_concatenate(pathBuf, rootPath.c_str(), ("objects\\" + hash.substr(0, 2) + "\\" + hash).c_str());
+
+        if (GetFileAttributes(pathBuf.data()) != INVALID_FILE_ATTRIBUTES) {
+            DeleteFile(tmpFile.c_str());
+            duplicates++;
+        }
+        else if (construct_parent_dirs(pathBuf.data(), ec) && MoveFileEx(tmpFile.c_str(), pathBuf.data(), 0)) {
+            DurabilityTracker::instance().file_done(pathBuf.data());
+            blobs++;
+        }
+        else {
+            std::cerr << "can't store cas blob: `" << pathBuf.data() << "`\n";
+            return false;
+        }
+
+        index << hash << "  " << attr.fileName.get() << "\n";
+        return static_cast<bool>(index);
+    }
+
+    bool finish() override {
+        index.close();
+        RemoveDirectory(tmpPath.c_str());
+
+        if (failed || !index) {
+            return false;
+        }
+
+        std::cout << "cas: " << blobs << " new blobs, " << duplicates << " already stored\n";
+        DurabilityTracker::instance().file_done((rootPath + "\\index.txt").c_str());
+        return true;
+    }
+};
+
+/*
+    the thread and the queue of one sink, a sink that failed still takes its events,
+    only to drop their chunks. the runner of the first sink counts each file into `stats`, if set,
+    when the sink is done with it: saved or not, its latency from the start of its read, its
+    readiness and its progress slot. its thread is their only writer until finish().
+*/
+class SinkRunner {
+    struct Event {
+        enum class Kind { Begin, Data, End, Finish } kind;
+        const FileAttr* attr;
+        ChunkRef chunk;
+        uint64_t start;     // when the read of the file started, for Begin.
+    };
+
+    FanoutSink& sink;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Event> events;
+    std::thread thread;
+    bool ok = true;
+    ExtractStats* stats;
+    ProgressSlot* progress;
+    uint64_t fileStart = 0;
+
+    void count_event(const Event& e) {
+        switch (e.kind) {
+            case Event::Kind::Begin:
+                fileStart = e.start;
+                if (progress != nullptr) {
+                    progress->begin_file(e.attr->fileName.get());
+                }
+                break;
+            case Event::Kind::Data:
+                if (progress != nullptr) {
+                    progress->add_bytes(e.chunk->len);
+                }
+                break;
+            case Event::Kind::End: {
+                bool saved = ok && sink.fileSaved;
+
+                stats->add_file(e.attr->fileSize, now_ticks() - fileStart, saved);
+                stats->file_done(*e.attr, saved);
+
+                if (progress != nullptr) {
+                    progress->end_file(e.attr->fileSize, saved);
+                }
+                break;
+            }
+            case Event::Kind::Finish:
+                break;
+        }
+    }
+
+    void run() {
+        while (true) {
+            Event e;
+            {
+                std::unique_lock<std::mutex> lock{ mutex };
+                cv.wait(lock, [this]() { return !events.empty(); });
+                e = std::move(events.front());
+                events.pop_front();
+            }
+
+            uint64_t start = now_ticks();
+
+            if (ok) {
+                switch (e.kind) {
+                    case Event::Kind::Begin:  ok = sink.begin_file(*e.attr); break;
+                    case Event::Kind::Data:   ok = sink.write(e.chunk->data, e.chunk->len); break;
+                    case Event::Kind::End:    ok = sink.end_file(*e.attr); break;
+                    case Event::Kind::Finish: ok = sink.finish(); break;
+                }
+            }
+
+            sink.busyTicks += now_ticks() - start;
+
+            if (stats != nullptr) {
+                count_event(e);
+            }
+
+            if (e.kind == Event::Kind::Finish) {
+                return;
+            }
+        }
+    }
+
+    void push(Event::Kind kind, const FileAttr* attr, ChunkRef chunk, uint64_t start = 0) {
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            events.push_back(Event{ kind, attr, std::move(chunk), start });
+        }
+
+        cv.notify_one();
+    }
+public:
+    SinkRunner(FanoutSink& s, ExtractStats* st) : sink{ s }, stats{ st }, progress{ st != nullptr ? st->progress : nullptr } {
+        thread = std::thread{ &SinkRunner::run, this };
+    }
+
+    SinkRunner(const SinkRunner&) = delete;
+    SinkRunner& operator=(const SinkRunner&) = delete;
+
+    void begin_file(const FileAttr& attr, uint64_t start) { push(Event::Kind::Begin, &attr, nullptr, start); }
+    void write(const ChunkRef& chunk)     { push(Event::Kind::Data, nullptr, chunk); }
+    void end_file(const FileAttr& attr)   { push(Event::Kind::End, &attr, nullptr); }
+
+    // joins the thread, the result of the sink.
+    bool finish() {
+        push(Event::Kind::Finish, nullptr, nullptr);
+        thread.join();
+        return ok;
+    }
+};
+
+constexpr unsigned FANOUT_CHUNKS = 16;
+
+/*
+    reads and decodes the pak once for all `sinks`, the read and decode phases are counted into
+    `stats` here, the files by the runner of the first sink, a file counts as saved once that sink
+    saved it. the time each sink spent goes into its busyTicks.
+*/
+template<typename Decoder = ScalarDecoder>
+bool extract_fanout(const Header& header, const char* pakPath, std::vector<std::unique_ptr<FanoutSink>>& sinks,
+                    ExtractStats* stats = nullptr) {
+    ChunkPool pool{ FANOUT_CHUNKS };
+    ReadFileSource source;
+    std::error_code ec;
+    bool readOk = true;
+
+    if (pool.empty()) {
+        std::cerr << "out of memory for the decode buffers\n";
+        return false;
+    }
+
+    if (!source.init(pakPath, ec)) {
+        std::cerr << "can't open file: `" << pakPath << "`, " << ec.message() << "\n";
+        return false;
+    }
+
+    std::vector<std::unique_ptr<SinkRunner>> runners;
+    for (std::unique_ptr<FanoutSink>& sink : sinks) {
+        runners.emplace_back(new SinkRunner{ *sink, runners.empty() ? stats : nullptr });
+    }
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        uint64_t start = stats != nullptr ? now_ticks() : 0;
+        uint64_t offset = attr.offset;
+        uint64_t left = attr.fileSize;
+        TraceSpan span{ "file", attr.fileName.get() };
+
+        for (std::unique_ptr<SinkRunner>& r : runners) {
+            r->begin_file(attr, start);
+        }
+
+        while (left > 0) {
+            std::shared_ptr<DecodedChunk> chunk = pool.acquire();
+            size_t len = static_cast<size_t>((std::min)(left, static_cast<uint64_t>(DIRECT_BLOCK_SIZE)));
+
+            {
+                PhaseTimer timer{ stats, Phase::Read };
+                chunk->len = source.read(offset, chunk->data, len, ec);
+            }
+
+            if (chunk->len == 0) {
+                std::cerr << "unexpected end of pak file while reading `" << attr.fileName.get() << "`\n";
+                readOk = false;
+                break;
+            }
+
+            {
+                PhaseTimer timer{ stats, Phase::Decode };
+                Decoder::decode(chunk->data, chunk->len);
+            }
+
+            offset += chunk->len;
+            left -= chunk->len;
+
+            ChunkRef shared = std::move(chunk);
+            for (std::unique_ptr<SinkRunner>& r : runners) {
+                r->write(shared);
+            }
+        }
+
+        if (!readOk) {
+            break;
+        }
+
+        for (std::unique_ptr<SinkRunner>& r : runners) {
+            r->end_file(attr);
+        }
+    }
+
+    bool ok = readOk;
+    for (std::unique_ptr<SinkRunner>& r : runners) {
+        ok = r->finish() && ok;
+    }
+
+    return ok;
+}
+
+#endif // POPCAP_PAK_FANOUT_HPP
@@ -0,0 +1,89 @@
+/**
+ * @author yuanluo2
+ * @brief synthetic .pak file generator, written in C++11.
+ *
+ * writes a .pak file from one of the corpus profiles in popcap_pak_corpus.hpp,
+ * any field of the profile can be overridden from the command line.
+*/
+#include "popcap_pak_corpus.hpp"
+
+bool parse_option(CorpusProfile& profile, const std::string& arg) {
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+        return false;
+    }
+
+    std::string key = arg.substr(2, eq - 2);
+    const char* value = arg.c_str() + eq + 1;
+
+    if (key == "profile") {
+        const CorpusProfile* p = find_corpus_profile(value);
+
+        if (p == nullptr) {
+            return false;
+        }
+
+        profile = *p;
+        return true;
+    }
+
+    if      (key == "entries")    profile.entries = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    else if (key == "total-size") profile.totalSize = parse_size(value);
+    else if (key == "size-sigma") profile.sizeSigma = std::atof(value);
+    else if (key == "tail-ratio") profile.tailRatio = std::atof(value);
+    else if (key == "tail-scale") profile.tailScale = std::atof(value);
+    else if (key == "depth")      profile.dirDepth = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    else if (key == "fanout")     profile.dirFanout = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    else if (key == "name-len")   profile.nameLen = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    else if (key == "dup-ratio")  profile.dupRatio = std::atof(value);
+    else if (key == "seed")       profile.seed = std::strtoull(value, nullptr, 10);
+    else                          return false;
+
+    return true;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "usage: " << prog << " out.pak [--profile=tiny|small|medium|large] [options]\n";
+    std::cerr << "options override the profile:\n";
+    std::cerr << "  --entries=N  --total-size=BYTES[K|M|G]  --size-sigma=S  --tail-ratio=R\n";
+    std::cerr << "  --tail-scale=X  --depth=D  --fanout=F  --name-len=L  --dup-ratio=R  --seed=N\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // the profile option is applied first, so the other options always override it.
+    CorpusProfile profile = PROFILES[1];
+    for (int i = 2; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--profile=", 10) == 0 && !parse_option(profile, argv[i])) {
+            std::cerr << "unknown profile: `" << argv[i] << "`\n";
+            return 1;
+        }
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--profile=", 10) != 0 && !parse_option(profile, argv[i])) {
+            std::cerr << "unknown option: `" << argv[i] << "`\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Header header;
+
+    if (!generate_corpus_pak(profile, argv[1], header)) {
+        return 1;
+    }
+
+    uint64_t total = 0;
+    for (const FileAttr& attr : header.fileAttrList) {
+        total += attr.fileSize;
+    }
+
+    std::cout << "generated `" << argv[1] << "` with " << header.fileAttrList.size()
+              << " files, " << total << " bytes of file data\n";
+    return 0;
+}
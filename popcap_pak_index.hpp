@@ -0,0 +1,335 @@
+/**
+ * @author yuanluo2
+ * @brief compact in-memory index of a .pak file, written in C++11, only works for windows platform.
+ *
+ * a parsed Header costs a FileAttr of 40 bytes, a heap allocation of the full name and the
+ * allocator overhead for every file, while the names of a pak share long dir prefixes.
+ * CompactIndex keeps the entries sorted by name (without case, like windows) in blocks of
+ * INDEX_BLOCK_FILES, each name front coded against the one before it:
+ *
+ *     varint shared   - bytes shared with the name before, 0 for the first name of a block
+ *     varint len      - length of the rest
+ *     len bytes       - the rest of the name
+ *     varint size     - file size
+ *     varint offset   - data offset minus the header size
+ *     varint time     - index into the table of distinct last write times
+ *
+ * paks are packed at one moment, so a handful of distinct times cover thousands of files.
+ * the table is sorted and delta coded in blocks of INDEX_BLOCK_FILES too, each block starting
+ * with a full time, so paks with a time per file stay small as well.
+ * a lookup binary searches the first names of the blocks, then decodes one block.
+*/
+#ifndef POPCAP_PAK_INDEX_HPP
+#define POPCAP_PAK_INDEX_HPP
+
+#include "popcap_pak.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+    one file of a CompactIndex, decoded.
+*/
+struct IndexEntry {
+    std::string name;
+    uint32_t fileSize;
+    FILETIME lastWriteTime;
+    uint64_t offset;
+};
+
+inline int fold_name_char(char c) noexcept {
+    unsigned char u = static_cast<unsigned char>(c);
+    return u >= 'A' && u <= 'Z' ? u + ('a' - 'A') : u;
+}
+
+/*
+    compares like windows compares file names, ascii letters without case, byte by byte after that.
+*/
+inline int compare_name_nocase(const char* a, size_t aLen, const char* b, size_t bLen) {
+    size_t n = (std::min)(aLen, bLen);
+
+    for (size_t i = 0; i < n; ++i) {
+        int ca = fold_name_char(a[i]);
+        int cb = fold_name_char(b[i]);
+
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+
+    return aLen == bLen ? 0 : (aLen < bLen ? -1 : 1);
+}
+
+constexpr size_t INDEX_BLOCK_FILES = 16;
+
+class CompactIndex {
+    std::vector<uchar> data;
+    std::vector<uint32_t> blockStart;   // where each block starts in data.
+    std::vector<uchar> times;
+    std::vector<uint32_t> timeBlockStart;
+    uint64_t headerSize = 0;
+    size_t count = 0;
+    size_t timeCount = 0;
+
+    static void put_varint(std::vector<uchar>& out, uint64_t v) {
+        for (; v >= 0x80; v >>= 7) {
+            out.push_back(static_cast<uchar>(v | 0x80));
+        }
+
+        out.push_back(static_cast<uchar>(v));
+    }
+
+    static uint64_t get_varint(const uchar*& p) noexcept {
+        uint64_t v = 0;
+
+        for (unsigned shift = 0; ; shift += 7) {
+            uchar b = *p++;
+            v |= uint64_t(b & 0x7f) << shift;
+
+            if ((b & 0x80) == 0) {
+                return v;
+            }
+        }
+    }
+
+    static uint64_t time_bits(const FILETIME& t) noexcept {
+        return uint64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime;
+    }
+
+    uint64_t time_at(size_t id) const noexcept {
+        const uchar* p = times.data() + timeBlockStart[id / INDEX_BLOCK_FILES];
+        uint64_t t = get_varint(p);
+
+        for (size_t i = 0; i < id % INDEX_BLOCK_FILES; ++i) {
+            t += get_varint(p);
+        }
+
+        return t;
+    }
+
+    /*
+        decodes the name at `p` into `name`, which holds the name before it in the block.
+    */
+    static void decode_name(const uchar*& p, std::string& name) {
+        size_t shared = static_cast<size_t>(get_varint(p));
+        size_t len = static_cast<size_t>(get_varint(p));
+
+        name.resize(shared);
+        name.append(reinterpret_cast<const char*>(p), len);
+        p += len;
+    }
+
+    // the fields after the name, `p` is left at the next entry.
+    void decode_fields(const uchar*& p, IndexEntry& out) const {
+        out.fileSize = static_cast<uint32_t>(get_varint(p));
+        out.offset = headerSize + get_varint(p);
+
+        uint64_t t = time_at(static_cast<size_t>(get_varint(p)));
+        out.lastWriteTime.dwLowDateTime = static_cast<DWORD>(t);
+        out.lastWriteTime.dwHighDateTime = static_cast<DWORD>(t >> 32);
+    }
+
+    static void skip_fields(const uchar*& p) noexcept {
+        for (int field = 0; field < 3; ++field) {
+            get_varint(p);
+        }
+    }
+
+    // the first name of a block, it's never front coded.
+    void block_first_name(size_t block, const char*& name, size_t& len) const noexcept {
+        const uchar* p = data.data() + blockStart[block];
+        get_varint(p);
+        len = static_cast<size_t>(get_varint(p));
+        name = reinterpret_cast<const char*>(p);
+    }
+
+    size_t block_files(size_t block) const noexcept {
+        return (std::min)(INDEX_BLOCK_FILES, count - block * INDEX_BLOCK_FILES);
+    }
+public:
+    CompactIndex() = default;
+
+    /*
+        `header` may be dropped after this, the index keeps nothing of it.
+    */
+    void build(const Header& header) {
+        MemoryScope scope{ MemPhase::Index };
+        std::vector<const FileAttr*> sorted;
+        std::vector<uint64_t> distinct;
+
+        sorted.reserve(header.fileAttrList.size());
+        for (const FileAttr& attr : header.fileAttrList) {
+            sorted.push_back(&attr);
+            distinct.push_back(time_bits(attr.lastWriteTime));
+        }
+
+        std::sort(sorted.begin(), sorted.end(), [](const FileAttr* a, const FileAttr* b) {
+            return compare_name_nocase(a->fileName.get(), a->fileNameLen, b->fileName.get(), b->fileNameLen) < 0;
+        });
+
+        std::sort(distinct.begin(), distinct.end());
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+        data.clear();
+        blockStart.clear();
+        times.clear();
+        timeBlockStart.clear();
+        headerSize = header.headerSize;
+        count = sorted.size();
+        timeCount = distinct.size();
+
+        for (size_t i = 0; i < distinct.size(); ++i) {
+            if (i % INDEX_BLOCK_FILES == 0) {
+                timeBlockStart.push_back(static_cast<uint32_t>(times.size()));
+                put_varint(times, distinct[i]);
+            }
+            else {
+                put_varint(times, distinct[i] - distinct[i - 1]);
+            }
+        }
+
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            const FileAttr& attr = *sorted[i];
+            size_t shared = 0;
+
+            if (i % INDEX_BLOCK_FILES == 0) {
+                blockStart.push_back(static_cast<uint32_t>(data.size()));
+            }
+            else {
+                const FileAttr& prev = *sorted[i - 1];
+                size_t n = (std::min)(prev.fileNameLen, attr.fileNameLen);
+
+                while (shared < n && prev.fileName[shared] == attr.fileName[shared]) {
+                    ++shared;
+                }
+            }
+
+            put_varint(data, shared);
+            put_varint(data, attr.fileNameLen - shared);
+            data.insert(data.end(), attr.fileName.get() + shared, attr.fileName.get() + attr.fileNameLen);
+            put_varint(data, attr.fileSize);
+            put_varint(data, attr.offset - headerSize);
+            put_varint(data, std::lower_bound(distinct.begin(), distinct.end(), time_bits(attr.lastWriteTime)) - distinct.begin());
+        }
+
+        data.shrink_to_fit();
+        blockStart.shrink_to_fit();
+        times.shrink_to_fit();
+        timeBlockStart.shrink_to_fit();
+    }
+
+    bool load(const char* pakPath) {
+        Header header;
+        HeaderParser parser;
+        HeaderValidator validator;
+        std::ifstream f{ pakPath, std::ios::binary };
+
+        if (!f.is_open()) {
+            std::cerr << "can't open file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        if (!parser.parse(header, f) || !validator.validate(header, get_pak_file_size(f))) {
+            std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        build(header);
+        return true;
+    }
+
+    size_t size() const noexcept {
+        return count;
+    }
+
+    size_t distinct_times() const noexcept {
+        return timeCount;
+    }
+
+    /*
+        finds `name` without case, `\` separated like in the pak.
+    */
+    bool find(const char* name, IndexEntry& out) const {
+        size_t nameLen = std::strlen(name);
+        size_t lo = 0;
+        size_t hi = blockStart.size();
+
+        // the last block whose first name is not after `name`.
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            const char* first;
+            size_t firstLen;
+
+            block_first_name(mid, first, firstLen);
+
+            if (compare_name_nocase(first, firstLen, name, nameLen) <= 0) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        if (lo == 0) {
+            return false;
+        }
+
+        size_t block = lo - 1;
+        const uchar* p = data.data() + blockStart[block];
+
+        for (size_t i = 0; i < block_files(block); ++i) {
+            decode_name(p, out.name);
+            int c = compare_name_nocase(out.name.data(), out.name.size(), name, nameLen);
+
+            if (c == 0) {
+                decode_fields(p, out);
+                return true;
+            }
+
+            if (c > 0) {
+                break;
+            }
+
+            skip_fields(p);
+        }
+
+        return false;
+    }
+
+    // calls `f(const IndexEntry&)` for every file in name order.
+    template<typename Function>
+    void for_each(Function f) const {
+        IndexEntry e;
+
+        for (size_t block = 0; block < blockStart.size(); ++block) {
+            const uchar* p = data.data() + blockStart[block];
+
+            for (size_t i = 0; i < block_files(block); ++i) {
+                decode_name(p, e.name);
+                decode_fields(p, e);
+                f(static_cast<const IndexEntry&>(e));
+            }
+        }
+    }
+
+    size_t memory_bytes() const noexcept {
+        return sizeof(*this) + data.capacity() + blockStart.capacity() * sizeof(uint32_t) + times.capacity() +
+               timeBlockStart.capacity() * sizeof(uint32_t);
+    }
+};
+
+/*
+    what a parsed Header holds on the heap, the 16 bytes per name are a typical allocator overhead.
+*/
+inline size_t header_memory_bytes(const Header& header) {
+    size_t bytes = sizeof(header) + header.fileAttrList.capacity() * sizeof(FileAttr);
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        bytes += attr.fileNameLen + 1 + 16;
+    }
+
+    return bytes;
+}
+
+#endif // POPCAP_PAK_INDEX_HPP
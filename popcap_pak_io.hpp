@@ -0,0 +1,994 @@
+/**
+ * @author yuanluo2
+ * @brief read sources and write sinks for the extraction loop, written in C++11, only works for windows platform.
+ *
+ * every source reads the pak file at an absolute offset, every sink has the same
+ * init() / write_data() / set_file_time() shape as WinFile, every decoder decodes a buffer in
+ * place, so extract_with<Source, Sink, Decoder>() runs the same extraction loop over any of
+ * them. they are all template parameters, no virtual call is left in the loop, each combination
+ * compiles to its own inlined loop.
+*/
+#ifndef POPCAP_PAK_IO_HPP
+#define POPCAP_PAK_IO_HPP
+
+#include "popcap_pak.hpp"
+#include "popcap_pak_sha256.hpp"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define POPCAP_PAK_HAS_SSE2 1
+#endif
+
+inline void assign_last_error(std::error_code& ec) {
+    ec.assign(GetLastError(), std::system_category());
+}
+
+/*
+    decode_bytes(), one byte at a time, the compiler may vectorize it on its own.
+*/
+struct ScalarDecoder {
+    static const char* name() { return "scalar"; }
+
+    static void decode(char* data, size_t len) noexcept {
+        decode_bytes(data, len);
+    }
+};
+
+/*
+    16 bytes at a time with SSE2, 8 at a time without it, the tail one by one.
+*/
+struct SimdDecoder {
+    static const char* name() { return "simd"; }
+
+    static void decode(char* data, size_t len) noexcept {
+        size_t i = 0;
+
+#ifdef POPCAP_PAK_HAS_SSE2
+        const __m128i key = _mm_set1_epi8(static_cast<char>(0xf7));
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(v, key));
+        }
+#else
+        for (; i + 8 <= len; i += 8) {
+            uint64_t v;
+            std::memcpy(&v, data + i, 8);
+            v ^= 0xf7f7f7f7f7f7f7f7ull;
+            std::memcpy(data + i, &v, 8);
+        }
+#endif
+
+        decode_bytes(data + i, len - i);
+    }
+};
+
+/*
+    leaves the data as it is in the pak, to measure everything but the decoding.
+*/
+struct IdentityDecoder {
+    static const char* name() { return "identity"; }
+
+    static void decode(char*, size_t) noexcept {}
+};
+
+/*
+    std::ifstream, what popcap_pak.hpp uses.
+*/
+class StreamSource {
+    std::ifstream f;
+    uint64_t pos = 0;
+public:
+    static const char* name() { return "ifstream"; }
+
+    bool init(const char* path, std::error_code& ec) {
+        f.open(path, std::ios::binary);
+
+        if (!f.is_open()) {
+            ec = std::make_error_code(std::errc::no_such_file_or_directory);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) {
+        if (offset != pos) {
+            f.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        }
+
+        f.read(buf, len);
+        size_t readLen = static_cast<size_t>(f.gcount());
+        f.clear();
+
+        pos = offset + readLen;
+        ec.clear();
+        return readLen;
+    }
+};
+
+/*
+    C stdio, what popcap_pak_extractor.c uses.
+*/
+class StdioSource {
+    FILE* f = nullptr;
+    uint64_t pos = 0;
+public:
+    static const char* name() { return "stdio"; }
+
+    StdioSource() = default;
+    StdioSource(const StdioSource&) = delete;
+    StdioSource& operator=(const StdioSource&) = delete;
+
+    ~StdioSource() {
+        if (f != nullptr) {
+            std::fclose(f);
+        }
+    }
+
+    bool init(const char* path, std::error_code& ec) {
+        f = std::fopen(path, "rb");
+
+        if (f == nullptr) {
+            ec = std::make_error_code(std::errc::no_such_file_or_directory);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) {
+        if (offset != pos) {
+            _fseeki64(f, static_cast<__int64>(offset), SEEK_SET);
+        }
+
+        size_t readLen = std::fread(buf, 1, len, f);
+
+        pos = offset + readLen;
+        ec.clear();
+        return readLen;
+    }
+};
+
+/*
+    plain ReadFile() on the file pointer, seeks only when the offset jumps.
+*/
+class ReadFileSource {
+protected:
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    uint64_t pos = 0;
+
+    bool open(const char* path, DWORD flags, std::error_code& ec) noexcept {
+        hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+
+        if (hFile == INVALID_HANDLE_VALUE) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+public:
+    static const char* name() { return "readfile"; }
+
+    ReadFileSource() = default;
+    ReadFileSource(const ReadFileSource&) = delete;
+    ReadFileSource& operator=(const ReadFileSource&) = delete;
+
+    ~ReadFileSource() noexcept {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        return open(path, FILE_FLAG_SEQUENTIAL_SCAN, ec);
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) noexcept {
+        DWORD readLen = 0;
+
+        if (offset != pos) {
+            LARGE_INTEGER li;
+            li.QuadPart = static_cast<LONGLONG>(offset);
+
+            if (!SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN)) {
+                assign_last_error(ec);
+                return 0;
+            }
+        }
+
+        if (!ReadFile(hFile, buf, static_cast<DWORD>(len), &readLen, nullptr)) {
+            assign_last_error(ec);
+            return 0;
+        }
+
+        pos = offset + readLen;
+        ec.clear();
+        return readLen;
+    }
+};
+
+/*
+    ReadFile() with the offset in an OVERLAPPED struct, the windows pread(),
+    no file pointer, so one handle can be shared by all workers.
+*/
+class PositionalSource : public ReadFileSource {
+public:
+    static const char* name() { return "positional"; }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        return open(path, FILE_FLAG_RANDOM_ACCESS, ec);
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) noexcept {
+        OVERLAPPED ov{};
+        DWORD readLen = 0;
+
+        ov.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        if (!ReadFile(hFile, buf, static_cast<DWORD>(len), &readLen, &ov) && GetLastError() != ERROR_HANDLE_EOF) {
+            assign_last_error(ec);
+            return 0;
+        }
+
+        ec.clear();
+        return readLen;
+    }
+};
+
+/*
+    maps the whole pak file, a read is a copy out of the view.
+*/
+class MappedSource {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = nullptr;
+    const char* view = nullptr;
+    uint64_t size = 0;
+public:
+    static const char* name() { return "mmap"; }
+
+    MappedSource() = default;
+    MappedSource(const MappedSource&) = delete;
+    MappedSource& operator=(const MappedSource&) = delete;
+
+    ~MappedSource() noexcept {
+        if (view != nullptr) {
+            UnmapViewOfFile(view);
+        }
+
+        if (hMapping != nullptr) {
+            CloseHandle(hMapping);
+        }
+
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        LARGE_INTEGER li;
+
+        // share delete, so a new pak can be renamed over a mapped one, the view keeps the old data.
+        hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &li)) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        size = static_cast<uint64_t>(li.QuadPart);
+
+        hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMapping == nullptr) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        view = static_cast<const char*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (view == nullptr) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    const char* data() const noexcept {
+        return view;
+    }
+
+    uint64_t file_size() const noexcept {
+        return size;
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) noexcept {
+        if (offset >= size) {
+            ec.clear();
+            return 0;
+        }
+
+        if (len > size - offset) {
+            len = static_cast<size_t>(size - offset);
+        }
+
+        std::memcpy(buf, view + offset, len);
+        ec.clear();
+        return len;
+    }
+};
+
+/*
+    FILE_FLAG_NO_BUFFERING, the windows O_DIRECT, the pak never goes through the file cache.
+    DirectReader of popcap_pak.hpp does the aligned reads.
+*/
+class UnbufferedSource {
+    DirectReader reader;
+public:
+    static const char* name() { return "unbuffered"; }
+
+    bool init(const char* path, std::error_code& ec) noexcept {
+        if (!reader.open(path)) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    size_t read(uint64_t offset, char* buf, size_t len, std::error_code& ec) noexcept {
+        reader.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        reader.read(buf, static_cast<std::streamsize>(len));
+
+        ec.clear();
+        return static_cast<size_t>(reader.gcount());
+    }
+};
+
+/*
+    std::ofstream output.
+*/
+class StreamSink {
+    std::ofstream f;
+    std::string path;
+public:
+    static const char* name() { return "ofstream"; }
+
+    bool init(const char* filePath, std::error_code& ec) {
+        path = filePath;
+        f.open(filePath, std::ios::binary);
+
+        if (!f.is_open()) {
+            ec = std::make_error_code(std::errc::permission_denied);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* data, DWORD len, std::error_code& ec) {
+        if (!f.write(data, len)) {
+            ec = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    void close() {
+        if (f.is_open()) {
+            f.close();
+        }
+    }
+
+    // streams can't set file times, the file is reopened as a handle for it.
+    bool set_file_time(const FILETIME& ft, std::error_code& ec) {
+        f.close();
+
+        HANDLE h = CreateFile(path.c_str(), FILE_WRITE_ATTRIBUTES, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE || !SetFileTime(h, nullptr, nullptr, &ft)) {
+            assign_last_error(ec);
+            if (h != INVALID_HANDLE_VALUE) {
+                CloseHandle(h);
+            }
+
+            return false;
+        }
+
+        CloseHandle(h);
+        ec.clear();
+        return true;
+    }
+};
+
+/*
+    C stdio output.
+*/
+class StdioSink {
+    FILE* f = nullptr;
+    std::string path;
+public:
+    static const char* name() { return "stdio"; }
+
+    StdioSink() = default;
+    StdioSink(const StdioSink&) = delete;
+    StdioSink& operator=(const StdioSink&) = delete;
+
+    ~StdioSink() {
+        if (f != nullptr) {
+            std::fclose(f);
+        }
+    }
+
+    bool init(const char* filePath, std::error_code& ec) {
+        path = filePath;
+        f = std::fopen(filePath, "wb");
+
+        if (f == nullptr) {
+            ec = std::make_error_code(std::errc::permission_denied);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* data, DWORD len, std::error_code& ec) {
+        if (std::fwrite(data, 1, len, f) != len) {
+            ec = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    void close() {
+        if (f != nullptr) {
+            std::fclose(f);
+            f = nullptr;
+        }
+    }
+
+    bool set_file_time(const FILETIME& ft, std::error_code& ec) {
+        close();
+
+        HANDLE h = CreateFile(path.c_str(), FILE_WRITE_ATTRIBUTES, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE || !SetFileTime(h, nullptr, nullptr, &ft)) {
+            assign_last_error(ec);
+            if (h != INVALID_HANDLE_VALUE) {
+                CloseHandle(h);
+            }
+
+            return false;
+        }
+
+        CloseHandle(h);
+        ec.clear();
+        return true;
+    }
+};
+
+/*
+    maps the new file at its final size and copies into the view, no WriteFile() per buffer.
+    it gets the size when it's opened, see SinkTraits.
+*/
+class MappedFileSink {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = nullptr;
+    char* view = nullptr;
+    uint64_t size = 0;
+    uint64_t pos = 0;
+
+    /*
+        writes the dirty pages out and drops the mapping, the lazy writer would otherwise
+        write them later and move the last write time of the file past the one we set.
+    */
+    bool unmap() noexcept {
+        bool flushed = true;
+
+        if (view != nullptr) {
+            flushed = FlushViewOfFile(view, 0) != FALSE;
+            UnmapViewOfFile(view);
+            view = nullptr;
+        }
+
+        if (hMapping != nullptr) {
+            CloseHandle(hMapping);
+            hMapping = nullptr;
+        }
+
+        return flushed;
+    }
+public:
+    static const char* name() { return "mmapfile"; }
+
+    MappedFileSink() = default;
+    MappedFileSink(const MappedFileSink&) = delete;
+    MappedFileSink& operator=(const MappedFileSink&) = delete;
+
+    ~MappedFileSink() noexcept {
+        close();
+    }
+
+    bool init(const char* filePath, uint64_t fileSize, std::error_code& ec) noexcept {
+        hFile = CreateFile(filePath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+        size = fileSize;
+
+        if (hFile == INVALID_HANDLE_VALUE) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        // an empty file can't be mapped, there's nothing to write either.
+        if (size > 0) {
+            hMapping = CreateFileMapping(hFile, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                         static_cast<DWORD>(size & 0xffffffffu), nullptr);
+            view = hMapping != nullptr ? static_cast<char*>(MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0)) : nullptr;
+
+            if (view == nullptr) {
+                assign_last_error(ec);
+                return false;
+            }
+        }
+
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* data, DWORD len, std::error_code& ec) noexcept {
+        if (len > size - pos) {
+            ec = std::make_error_code(std::errc::file_too_large);
+            return false;
+        }
+
+        std::memcpy(view + pos, data, len);
+        pos += len;
+        ec.clear();
+        return true;
+    }
+
+    void close() noexcept {
+        unmap();
+
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    // the data is complete once the time is set, so the mapping goes first.
+    bool set_file_time(const FILETIME& ft, std::error_code& ec) noexcept {
+        if (!unmap() || !SetFileTime(hFile, nullptr, nullptr, &ft)) {
+            assign_last_error(ec);
+            return false;
+        }
+
+        ec.clear();
+        return true;
+    }
+};
+
+/*
+    keeps the current file in memory and writes nothing, the extraction without the disk.
+*/
+class MemorySink {
+    std::vector<char> data;
+public:
+    static const char* name() { return "memory"; }
+
+    bool init(const char*, std::error_code& ec) {
+        data.clear();
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* buf, DWORD len, std::error_code& ec) {
+        data.insert(data.end(), buf, buf + len);
+        ec.clear();
+        return true;
+    }
+
+    void close() {}
+
+    bool set_file_time(const FILETIME&, std::error_code& ec) {
+        ec.clear();
+        return true;
+    }
+
+    const std::vector<char>& contents() const noexcept {
+        return data;
+    }
+};
+
+/*
+    the SHA-256 of every file instead of the file, collected for the whole process,
+    take_digests() hands them over as `path, hex digest`.
+*/
+class HashSink {
+    Sha256 sha;
+    std::string path;
+
+    static std::mutex& digest_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<std::pair<std::string, std::string>>& digest_list() {
+        static std::vector<std::pair<std::string, std::string>> digests;
+        return digests;
+    }
+public:
+    static const char* name() { return "hash"; }
+
+    static std::vector<std::pair<std::string, std::string>> take_digests() {
+        std::lock_guard<std::mutex> lock{ digest_mutex() };
+        std::vector<std::pair<std::string, std::string>> digests;
+
+        digests.swap(digest_list());
+        return digests;
+    }
+
+    bool init(const char* filePath, std::error_code& ec) {
+        path = filePath;
+        sha.reset();
+        ec.clear();
+        return true;
+    }
+
+    bool write_data(const char* buf, DWORD len, std::error_code& ec) {
+        sha.update(buf, len);
+        ec.clear();
+        return true;
+    }
+
+    void close() {
+        std::string hex = sha.hex_digest();
+        std::lock_guard<std::mutex> lock{ digest_mutex() };
+
+        digest_list().emplace_back(path, std::move(hex));
+    }
+
+    bool set_file_time(const FILETIME&, std::error_code& ec) {
+        ec.clear();
+        return true;
+    }
+};
+
+/*
+    what extract_one_with() needs to know of a sink beyond its calls: a sink that writes no files
+    needs no dirs and no flush, a sized sink gets the file size in init().
+*/
+template<typename Sink>
+struct SinkTraits {
+    static constexpr bool writesFiles = true;
+    static constexpr bool sized = false;
+};
+
+template<>
+struct SinkTraits<MappedFileSink> {
+    static constexpr bool writesFiles = true;
+    static constexpr bool sized = true;
+};
+
+template<>
+struct SinkTraits<MemorySink> {
+    static constexpr bool writesFiles = false;
+    static constexpr bool sized = false;
+};
+
+template<>
+struct SinkTraits<HashSink> {
+    static constexpr bool writesFiles = false;
+    static constexpr bool sized = false;
+};
+
+template<typename Sink>
+bool open_sink(Sink& sink, const char* path, uint64_t, std::error_code& ec, std::false_type) {
+    return sink.init(path, ec);
+}
+
+template<typename Sink>
+bool open_sink(Sink& sink, const char* path, uint64_t size, std::error_code& ec, std::true_type) {
+    return sink.init(path, size, ec);
+}
+
+/*
+    opening a file with FILE_FLAG_NO_BUFFERING makes windows drop its cached pages,
+    the same as posix_fadvise(POSIX_FADV_DONTNEED), used for cold cache runs.
+*/
+inline bool drop_file_cache(const char* path) {
+    HANDLE h = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    CloseHandle(h);
+    return true;
+}
+
+/*
+    extracts one file through `source` and a fresh Sink, a file that can't be created or written is skipped.
+    only saved files count into the files and bytes of `stats`, the others into its failed files.
+*/
+template<typename Sink, typename Decoder = ScalarDecoder, typename Source>
+FileOutcome extract_one_with(Source& source, const FileAttr& attr, char* buf, size_t bufSize, 
+                      std::array<char, MAX_PATH>& pathBuf, const char* rootPath, ExtractStats* stats) {
+    uint64_t start = stats != nullptr ? now_ticks() : 0;
+    ProgressSlot* progress = stats != nullptr ? stats->progress : nullptr;
+    TraceSpan span{ "file", attr.fileName.get() };
+    uint64_t offset = attr.offset;
+    uint64_t left = attr.fileSize;
+    std::error_code ec;
+    Sink sink;
+    bool created = true;
+
+    if (progress != nullptr) {
+        progress->begin_file(attr.fileName.get());
+    }
+
+    path_concatenate(pathBuf, rootPath, attr.fileName.get());
+
+    if (SinkTraits<Sink>::writesFiles) {
+        PhaseTimer timer{ stats, Phase::CreateDirs };
+        created = construct_parent_dirs(pathBuf.data(), ec);
+    }
+
+    if (created) {
+        PhaseTimer timer{ stats, Phase::Open };
+        created = open_sink(sink, pathBuf.data(), attr.fileSize, ec, std::integral_constant<bool, SinkTraits<Sink>::sized>{});
+    }
+
+    if (!created) {
+        std::cerr << "create file failed: `" << pathBuf.data() << "`, " << ec.message() << "\n";
+        left = 0;
+    }
+
+    while (left > 0) {
+        size_t len = static_cast<size_t>((std::min)(left, static_cast<uint64_t>(bufSize)));
+        size_t readLen;
+
+        {
+            PhaseTimer timer{ stats, Phase::Read };
+            readLen = source.read(offset, buf, len, ec);
+        }
+
+        if (readLen == 0) {
+            std::cerr << "unexpected end of pak file while reading `" << pathBuf.data() << "`\n";
+            return FileOutcome::Fatal;
+        }
+
+        {
+            PhaseTimer timer{ stats, Phase::Decode };
+            Decoder::decode(buf, readLen);
+        }
+
+        bool written;
+        {
+            PhaseTimer timer{ stats, Phase::Write };
+            written = sink.write_data(buf, static_cast<DWORD>(readLen), ec);
+        }
+
+        if (!written) {
+            std::cerr << "write to file failed for file `" << pathBuf.data() << "`, " << ec.message() << "\n";
+            break;
+        }
+
+        if (progress != nullptr) {
+            progress->add_bytes(readLen);
+        }
+
+        offset += readLen;
+        left -= readLen;
+    }
+
+    if (created) {
+        PhaseTimer timer{ stats, Phase::SetTime };
+        sink.set_file_time(attr.lastWriteTime, ec);
+    }
+
+    bool saved = created && left == 0;
+
+    if (saved) {
+        {
+            PhaseTimer timer{ stats, Phase::Close };
+            sink.close();
+        }
+
+        if (SinkTraits<Sink>::writesFiles && DurabilityTracker::instance().durability() != Durability::None) {
+            PhaseTimer timer{ stats, Phase::Sync };
+            DurabilityTracker::instance().file_done(pathBuf.data());
+        }
+    }
+
+    if (progress != nullptr) {
+        progress->end_file(attr.fileSize, saved);
+    }
+
+    if (stats != nullptr) {
+        stats->add_file(attr.fileSize, now_ticks() - start, saved);
+        stats->file_done(attr, saved);
+    }
+
+    return saved ? FileOutcome::Saved : FileOutcome::Failed;
+}
+
+/*
+    the extraction loop of save_file_data(), over any source, sink and decoder, with a runtime buffer size.
+    with several threads, every worker has its own source and takes files from an atomic counter,
+    the same as save_file_data_parallel(), a `controller` decides how many of them run.
+*/
+template<typename Source, typename Sink, typename Decoder = ScalarDecoder>
+bool extract_with(const Header& header, const char* pakPath, const char* rootPath, size_t bufSize,
+                  unsigned threadNum = 1, ExtractStats* stats = nullptr, ConcurrencyController* controller = nullptr) {
+    const WorkerPlacement& placement = WorkerPlacement::instance();
+    NodeWorkQueues queues{ header.fileAttrList.size(), placement.queue_count() };
+    std::atomic<bool> failed{ false };
+    WorkerError error;
+    std::vector<std::thread> workers;
+
+    if (controller != nullptr) {
+        threadNum = controller->max_workers();
+    }
+
+    std::vector<ExtractStats> workerStats(threadNum > 0 ? threadNum : 1);
+
+    for (unsigned i = 0; i < workerStats.size(); ++i) {
+        workerStats[i].init_worker(stats, i);
+    }
+
+    auto work = [&](unsigned id) {
+        try {
+            unsigned queue = placement.place(id);
+            TraceSpan span{ "worker" };
+            Source source;
+            std::unique_ptr<PooledBlock> block;     // on the node of this worker, only if the buffer fits in it.
+            std::vector<char> heapBuf;
+            {
+                MemoryScope scope{ MemPhase::Buffers };
+
+                if (bufSize <= DIRECT_BLOCK_SIZE) {
+                    block.reset(new PooledBlock{ placement.node_of(id) });
+                }
+
+                heapBuf.resize(block == nullptr || block->data() == nullptr ? bufSize : 0);
+            }
+            char* buf = heapBuf.empty() ? block->data() : heapBuf.data();
+            std::array<char, MAX_PATH> pathBuf;
+            std::error_code ec;
+            ExtractStats* ws = stats != nullptr ? &workerStats[id] : nullptr;
+
+            if (!source.init(pakPath, ec)) {
+                std::cerr << "can't open file: `" << pakPath << "`, " << ec.message() << "\n";
+                failed = true;
+                return;
+            }
+
+            for (size_t i = take_next_file(queues, queue, controller, id); i < header.fileAttrList.size() && !failed; 
+                        i = take_next_file(queues, queue, controller, id)) {
+                if (extract_one_with<Sink, Decoder>(source, header.fileAttrList[i], buf, bufSize, pathBuf, rootPath, ws) == FileOutcome::Fatal) {
+                    failed = true;
+                }
+
+                if (controller != nullptr) {
+                    controller->add_bytes(header.fileAttrList[i].fileSize);
+                }
+            }
+
+            if (controller != nullptr) {
+                controller->finish();
+            }
+        }
+        catch (...) {
+            // a worker thread can't let it out, it would end the process.
+            error.keep();
+            failed = true;
+
+            if (controller != nullptr) {
+                controller->finish();
+            }
+        }
+    };
+
+    if (controller != nullptr) {
+        controller->start_control();
+    }
+
+    if (workerStats.size() == 1) {
+        ThreadPlacementGuard guard;
+        work(0);
+    }
+    else {
+        for (unsigned i = 0; i < workerStats.size(); ++i) {
+            workers.emplace_back(work, i);
+        }
+
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    if (controller != nullptr) {
+        controller->stop();
+    }
+
+    if (stats != nullptr) {
+        for (const ExtractStats& ws : workerStats) {
+            stats->merge(ws);
+        }
+    }
+
+    error.rethrow();
+    return !failed;
+}
+
+using ExtractFn = bool (*)(const Header&, const char*, const char*, size_t, unsigned, ExtractStats*, ConcurrencyController*);
+
+/*
+    one instance of extract_with() and the names it is picked by.
+*/
+struct ExtractEngine {
+    const char* source;
+    const char* sink;
+    const char* decoder;
+    ExtractFn fn;
+};
+
+template<typename Source, typename Sink, typename Decoder>
+ExtractEngine engine_of() {
+    return ExtractEngine{ Source::name(), Sink::name(), Decoder::name(), &extract_with<Source, Sink, Decoder> };
+}
+
+/*
+    every engine the frontends run, the C++ extractor and popcap_pak_core pick theirs from here.
+*/
+const std::array<ExtractEngine, 24> EXTRACT_ENGINES = { {
+    engine_of<StreamSource, WinFile, ScalarDecoder>(),
+    engine_of<StreamSource, WinFile, SimdDecoder>(),
+    engine_of<StreamSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<StreamSource, MappedFileSink, SimdDecoder>(),
+    engine_of<StdioSource, WinFile, ScalarDecoder>(),
+    engine_of<StdioSource, WinFile, SimdDecoder>(),
+    engine_of<StdioSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<StdioSource, MappedFileSink, SimdDecoder>(),
+    engine_of<ReadFileSource, WinFile, ScalarDecoder>(),
+    engine_of<ReadFileSource, WinFile, SimdDecoder>(),
+    engine_of<ReadFileSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<ReadFileSource, MappedFileSink, SimdDecoder>(),
+    engine_of<PositionalSource, WinFile, ScalarDecoder>(),
+    engine_of<PositionalSource, WinFile, SimdDecoder>(),
+    engine_of<PositionalSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<PositionalSource, MappedFileSink, SimdDecoder>(),
+    engine_of<MappedSource, WinFile, ScalarDecoder>(),
+    engine_of<MappedSource, WinFile, SimdDecoder>(),
+    engine_of<MappedSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<MappedSource, MappedFileSink, SimdDecoder>(),
+    engine_of<UnbufferedSource, WinFile, ScalarDecoder>(),
+    engine_of<UnbufferedSource, WinFile, SimdDecoder>(),
+    engine_of<UnbufferedSource, MappedFileSink, ScalarDecoder>(),
+    engine_of<UnbufferedSource, MappedFileSink, SimdDecoder>(),
+} };
+
+inline const ExtractEngine* find_extract_engine(const std::string& source, const std::string& sink, const std::string& decoder) {
+    for (const ExtractEngine& e : EXTRACT_ENGINES) {
+        if (source == e.source && sink == e.sink && decoder == e.decoder) {
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
+
+#endif // POPCAP_PAK_IO_HPP
@@ -0,0 +1,264 @@
+/*
+    @author yuanluo2
+    @brief large archive test of the C version, written in ANSI C, only works for windows platform.
+
+    writes the same sparse .pak as popcap_pak_large_test.cpp, larger than 4 GB with only a few KB
+    on disk, then checks the C parser of popcap_pak_extractor.c that the standalone build uses
+    (its file size from _ftelli64(), its offsets, read_at() past 4 GB) and the
+    core API of popcap_pak_core.h that the default build uses:
+
+        cl /O2 /EHsc /c popcap_pak_core.cpp
+        cl /O2 popcap_pak_large_test.c popcap_pak_core.obj
+        popcap_pak_large_test [large.pak]
+
+    it includes the extractor as a standalone build, so its parser is compiled in, and links the core.
+    the pak must be on a file system with sparse files (NTFS, ReFS), it's deleted at the end.
+*/
+#define POPCAP_PAK_STANDALONE
+#define main popcap_pak_extractor_main
+#include "popcap_pak_extractor.c"
+#undef main
+
+#include "popcap_pak_core.h"
+
+#include <winioctl.h>
+
+#define FOUR_GB     0x100000000ULL
+#define SMALL_SIZE  16
+#define BIG_SIZE    0xf0000000UL
+#define FILE_NUM    5
+
+/* head.txt, big0.bin, mid.txt, big1.bin, tail.txt, mid.txt starts 8 bytes before 4 GB. */
+static const char* const fileNames[FILE_NUM] = { "head.txt", "big0.bin", "mid.txt", "big1.bin", "tail.txt" };
+static const char* const fileData[FILE_NUM] = { "head of the pak\n", NULL, "straddles 4 GiB\n", NULL, "tail past 4 GiB\n" };
+
+typedef struct Layout {
+    UINT64 headerSize;
+    UINT32 fileSizes[FILE_NUM];
+    UINT64 offsets[FILE_NUM];
+    UINT64 pakSize;
+} Layout;
+
+int failures = 0;
+
+void check(BOOL ok, const char* what, const char* name) {
+    printf("%s%s%s%s\n", ok ? "ok: " : "FAILED: ", what, name != NULL ? " " : "", name != NULL ? name : "");
+
+    if (!ok) {
+        ++failures;
+    }
+}
+
+void build_layout(Layout* layout) {
+    UINT64 offset;
+    int i;
+
+    layout->headerSize = BYTES_OF_MAGIC + BYTES_OF_VERSION + 1;
+
+    for (i = 0; i < FILE_NUM; ++i) {
+        layout->headerSize += 1 + 1 + strlen(fileNames[i]) + BYTES_OF_FILE_SIZE + BYTES_OF_FILE_TIME;
+        layout->fileSizes[i] = SMALL_SIZE;
+    }
+
+    layout->fileSizes[1] = (UINT32)(FOUR_GB - 8 - layout->headerSize - SMALL_SIZE);
+    layout->fileSizes[3] = BIG_SIZE;
+
+    offset = layout->headerSize;
+    for (i = 0; i < FILE_NUM; ++i) {
+        layout->offsets[i] = offset;
+        offset += layout->fileSizes[i];
+    }
+
+    layout->pakSize = offset;
+}
+
+/*
+    encodes `len` bytes and writes them at `offset`.
+*/
+BOOL write_at(HANDLE hFile, UINT64 offset, const void* data, DWORD len) {
+    UCHAR buf[512];
+    LARGE_INTEGER li;
+    DWORD written = 0;
+
+    decode_bytes((const UCHAR*)data, buf, len);
+    li.QuadPart = (LONGLONG)offset;
+
+    return SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) && WriteFile(hFile, buf, len, &written, NULL) && written == len;
+}
+
+/*
+    the header is built in memory, the small files are written at their offsets,
+    everything else stays a hole.
+*/
+BOOL write_sparse_pak(const Layout* layout, const char* path) {
+    static const UCHAR magicAndVersion[BYTES_OF_MAGIC + BYTES_OF_VERSION] = { 0xc0, 0x4a, 0xc0, 0xba, 0, 0, 0, 0 };
+    UCHAR header[512];
+    FILETIME ft;
+    size_t len = 0;
+    size_t nameLen;
+    HANDLE hFile;
+    LARGE_INTEGER end;
+    DWORD returned = 0;
+    BOOL ok;
+    int i;
+
+    ft.dwLowDateTime = 0x12345678;
+    ft.dwHighDateTime = 0x01d00000;
+
+    memcpy(header, magicAndVersion, sizeof(magicAndVersion));
+    len += sizeof(magicAndVersion);
+
+    for (i = 0; i < FILE_NUM; ++i) {
+        nameLen = strlen(fileNames[i]);
+
+        header[len++] = 0x00;
+        header[len++] = (UCHAR)nameLen;
+        memcpy(header + len, fileNames[i], nameLen);
+        len += nameLen;
+        memcpy(header + len, &(layout->fileSizes[i]), BYTES_OF_FILE_SIZE);
+        len += BYTES_OF_FILE_SIZE;
+        memcpy(header + len, &ft, BYTES_OF_FILE_TIME);
+        len += BYTES_OF_FILE_TIME;
+    }
+
+    header[len++] = 0x80;
+
+    hFile = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "[ERROR] can't create `%s`\n", path);
+        return FALSE;
+    }
+
+    /* without it the holes would take the whole size on disk. */
+    if (!DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL)) {
+        fprintf(stderr, "[ERROR] `%s` can't be a sparse file, use a NTFS or ReFS volume\n", path);
+        CloseHandle(hFile);
+        return FALSE;
+    }
+
+    end.QuadPart = (LONGLONG)layout->pakSize;
+    ok = write_at(hFile, 0, header, (DWORD)len);
+
+    for (i = 0; ok && i < FILE_NUM; ++i) {
+        if (fileData[i] != NULL) {
+            ok = write_at(hFile, layout->offsets[i], fileData[i], SMALL_SIZE);
+        }
+    }
+
+    ok = ok && SetFilePointerEx(hFile, end, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+    CloseHandle(hFile);
+
+    if (!ok) {
+        fprintf(stderr, "[ERROR] can't write `%s`\n", path);
+    }
+
+    return ok;
+}
+
+BOOL same_data(const char* encoded, int index) {
+    UCHAR buf[SMALL_SIZE];
+
+    decode_bytes((const UCHAR*)encoded, buf, SMALL_SIZE);
+    return memcmp(buf, fileData[index], SMALL_SIZE) == 0;
+}
+
+/*
+    the standalone build: parsing, validating with _ftelli64(), and the positional reads
+    of its workers, whose offsets must reach the files past 4 GB.
+*/
+void check_standalone(const Layout* layout, const char* path) {
+    Resource res;
+    PakHeader header;
+    HANDLE hFile;
+    char buf[SMALL_SIZE];
+    DWORD readLen;
+    BOOL sameOffsets;
+    int i;
+
+    if (!resource_init(&res, path, "large_filenames.txt")) {
+        check(FALSE, "standalone opens the pak", NULL);
+        return;
+    }
+
+    pak_header_init(&header);
+    check(parse_pak_header(&res, &header), "standalone parses the header", NULL);
+    check(get_pak_file_size(&res) == (INT64)layout->pakSize, "standalone gets the size past 4 GB from _ftelli64()", NULL);
+    check(validate_pak_header(&res, &header), "standalone validates the header", NULL);
+
+    sameOffsets = header.entryNum == FILE_NUM && header.headerSize == layout->headerSize;
+
+    for (i = 0; sameOffsets && i < FILE_NUM; ++i) {
+        sameOffsets = header.entries[i].offset == layout->offsets[i];
+    }
+
+    check(sameOffsets, "standalone offsets of all files", NULL);
+    hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+    for (i = 0; sameOffsets && hFile != INVALID_HANDLE_VALUE && i < FILE_NUM; ++i) {
+        if (fileData[i] != NULL) {
+            check(read_at(hFile, header.entries[i].offset, buf, SMALL_SIZE, &readLen) && readLen == SMALL_SIZE &&
+                  same_data(buf, i), "standalone reads", fileNames[i]);
+        }
+    }
+
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+
+    resource_free(&res);
+    DeleteFile("large_filenames.txt");
+}
+
+/*
+    the default build: the same pak through popcap_pak_core.h.
+*/
+void check_core(const Layout* layout, const char* path) {
+    PopcapPak* pak = popcap_pak_open(path);
+    PopcapPakEntry entry;
+    char buf[SMALL_SIZE];
+    BOOL sameOffsets = TRUE;
+    size_t i;
+
+    if (pak == NULL) {
+        check(FALSE, "core opens the pak", NULL);
+        return;
+    }
+
+    check(popcap_pak_file_count(pak) == FILE_NUM && popcap_pak_header_size(pak) == layout->headerSize, "core parses the header", NULL);
+
+    for (i = 0; i < FILE_NUM; ++i) {
+        sameOffsets = sameOffsets && popcap_pak_entry(pak, i, &entry) && entry.offset == layout->offsets[i];
+    }
+
+    check(sameOffsets, "core offsets of all files", NULL);
+
+    for (i = 0; i < FILE_NUM; ++i) {
+        if (fileData[i] == NULL) {
+            continue;
+        }
+
+        check(popcap_pak_find(pak, fileNames[i], &entry) && entry.offset == layout->offsets[i] &&
+              popcap_pak_read_file(pak, &entry, buf) && memcmp(buf, fileData[i], SMALL_SIZE) == 0, "core reads", fileNames[i]);
+    }
+
+    popcap_pak_close(pak);
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "large.pak";
+    Layout layout;
+
+    build_layout(&layout);
+
+    if (!write_sparse_pak(&layout, path)) {
+        DeleteFile(path);
+        return 1;
+    }
+
+    check_standalone(&layout, path);
+    check_core(&layout, path);
+    DeleteFile(path);
+
+    printf(failures == 0 ? "all passed\n" : "some checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
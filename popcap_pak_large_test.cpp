@@ -0,0 +1,249 @@
+/**
+ * @author yuanluo2
+ * @brief large archive test of the C++ version, written in C++11, only works for windows platform.
+ *
+ * writes a sparse .pak whose body is larger than 4 GB, only the small files have real data,
+ * the big ones are holes, so it takes a few KB of disk. one small file straddles the 4 GB
+ * boundary and one sits past it. then the offsets of the parsed header, the size check of
+ * the validator, seeking with the stream and reading with every source are checked:
+ *
+ *     cl /O2 /EHsc popcap_pak_large_test.cpp
+ *     popcap_pak_large_test [large.pak]
+ *
+ * the pak must be on a file system with sparse files (NTFS, ReFS), it's deleted at the end.
+*/
+#include "popcap_pak_io.hpp"
+
+#include <winioctl.h>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+constexpr uint64_t FOUR_GB = 0x100000000ull;
+
+// every small file has 16 bytes, so a mismatch shows up as a different string.
+struct SmallFile {
+    const char* name;
+    const char* data;
+};
+
+const SmallFile HEAD = { "head.txt", "head of the pak\n" };
+const SmallFile MID  = { "mid.txt",  "straddles 4 GiB\n" };
+const SmallFile TAIL = { "tail.txt", "tail past 4 GiB\n" };
+
+constexpr uint32_t SMALL_SIZE = 16;
+constexpr uint32_t BIG_SIZE = 0xf0000000u;
+
+void add_file(Header& header, const char* name, uint32_t fileSize) {
+    FileAttr attr;
+
+    attr.fileNameLen = static_cast<uint32_t>(std::strlen(name));
+    attr.fileName.reset(new char[attr.fileNameLen + 1]);
+    std::memcpy(attr.fileName.get(), name, attr.fileNameLen + 1);
+    attr.fileSize = fileSize;
+    attr.lastWriteTime.dwLowDateTime = 0x12345678;
+    attr.lastWriteTime.dwHighDateTime = 0x01d00000;
+    attr.offset = 0;
+
+    header.fileAttrList.push_back(std::move(attr));
+}
+
+/*
+    head.txt, big0.bin, mid.txt, big1.bin, tail.txt.
+    big0.bin is sized so that mid.txt starts 8 bytes before 4 GB.
+*/
+void build_layout(Header& header) {
+    header.magic = { 0xc0, 0x4a, 0xc0, 0xba };
+    header.version = { 0x00, 0x00, 0x00, 0x00 };
+    header.headerSize = 8 + 1;
+
+    const char* names[] = { HEAD.name, "big0.bin", MID.name, "big1.bin", TAIL.name };
+    for (const char* name : names) {
+        add_file(header, name, SMALL_SIZE);
+        header.headerSize += 1 + 1 + std::strlen(name) + 4 + sizeof(FILETIME);
+    }
+
+    header.fileAttrList[1].fileSize = static_cast<uint32_t>(FOUR_GB - 8 - header.headerSize - SMALL_SIZE);
+    header.fileAttrList[3].fileSize = BIG_SIZE;
+
+    uint64_t offset = header.headerSize;
+    for (FileAttr& attr : header.fileAttrList) {
+        attr.offset = offset;
+        offset += attr.fileSize;
+    }
+}
+
+uint64_t pak_size_of(const Header& header) {
+    const FileAttr& last = header.fileAttrList.back();
+    return last.offset + last.fileSize;
+}
+
+bool write_at(HANDLE hFile, uint64_t offset, const char* data, DWORD len) {
+    std::vector<char> buf{ data, data + len };
+    LARGE_INTEGER li;
+    DWORD written = 0;
+
+    encode_bytes(buf.data(), buf.size());
+    li.QuadPart = static_cast<LONGLONG>(offset);
+
+    return SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN) && WriteFile(hFile, buf.data(), len, &written, nullptr) && written == len;
+}
+
+/*
+    the header goes through HeaderWriter, the small files are written at their offsets,
+    everything else stays a hole.
+*/
+bool write_sparse_pak(const Header& header, const char* path) {
+    {
+        std::ofstream f{ path, std::ios::binary | std::ios::trunc };
+        HeaderWriter writer;
+
+        if (!f.is_open() || !writer.write(header, f)) {
+            std::cerr << "can't write the header of `" << path << "`\n";
+            return false;
+        }
+    }
+
+    HANDLE hFile = CreateFile(path, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    DWORD returned = 0;
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        std::cerr << "can't open `" << path << "`\n";
+        return false;
+    }
+
+    // without it the holes would take the whole size on disk.
+    if (!DeviceIoControl(hFile, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr)) {
+        std::cerr << "`" << path << "` can't be a sparse file, use a NTFS or ReFS volume\n";
+        CloseHandle(hFile);
+        return false;
+    }
+
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(pak_size_of(header));
+
+    bool ok = write_at(hFile, header.fileAttrList[0].offset, HEAD.data, SMALL_SIZE) &&
+              write_at(hFile, header.fileAttrList[2].offset, MID.data, SMALL_SIZE) &&
+              write_at(hFile, header.fileAttrList[4].offset, TAIL.data, SMALL_SIZE) &&
+              SetFilePointerEx(hFile, end, nullptr, FILE_BEGIN) && SetEndOfFile(hFile);
+
+    CloseHandle(hFile);
+
+    if (!ok) {
+        std::cerr << "can't write the files of `" << path << "`\n";
+    }
+
+    return ok;
+}
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "ok: " : "FAILED: ") << what << "\n";
+    failures += ok ? 0 : 1;
+}
+
+bool same_data(const char* encoded, const SmallFile& file) {
+    std::string data{ encoded, SMALL_SIZE };
+
+    decode_bytes(&data[0], data.size());
+    return data == file.data;
+}
+
+void check_header(const Header& expected, const char* path, Header& parsed) {
+    HeaderParser parser;
+    HeaderValidator validator;
+    std::ifstream f{ path, std::ios::binary };
+
+    check(f.is_open() && parser.parse(parsed, f), "parse the header");
+
+    uint64_t pakSize = get_pak_file_size(f);
+    check(pakSize == pak_size_of(expected) && pakSize > 2 * FOUR_GB - FOUR_GB / 4, "pak size from tellg() is " + std::to_string(pakSize));
+    check(validator.validate(parsed, pakSize), "validate against the size past 4 GB");
+    check(!validator.validate(parsed, pakSize - FOUR_GB), "reject the size cut down by 4 GB");
+
+    bool sameOffsets = parsed.headerSize == expected.headerSize && parsed.fileAttrList.size() == expected.fileAttrList.size();
+    for (size_t i = 0; sameOffsets && i < parsed.fileAttrList.size(); ++i) {
+        sameOffsets = parsed.fileAttrList[i].offset == expected.fileAttrList[i].offset;
+    }
+
+    check(sameOffsets, "offsets of all files, tail.txt at " + std::to_string(parsed.fileAttrList[4].offset));
+}
+
+/*
+    the serial engines skip a file they can't save with seek_to_next_file(),
+    skipping big0.bin must land on mid.txt and skipping big1.bin on tail.txt, past 4 GB.
+*/
+template<typename Input>
+void check_seek(const Header& header, const char* path, const char* inputName) {
+    Input f{ path, std::ios::binary };
+    std::array<char, SMALL_SIZE> buf;
+    const SmallFile* files[] = { &MID, &TAIL };
+    size_t skipped[] = { 1, 3 };
+
+    for (int i = 0; i < 2; ++i) {
+        const FileAttr& attr = header.fileAttrList[skipped[i]];
+
+        f.seekg(static_cast<std::streamoff>(attr.offset), std::ios::beg);
+        bool landed = seek_to_next_file(attr, f) && f.read(buf.data(), buf.size()) && same_data(buf.data(), *files[i]);
+
+        check(landed, std::string{ inputName } + " skips " + attr.fileName.get() + " to " + files[i]->name);
+    }
+}
+
+template<typename Source>
+void check_source(const Header& header, const char* path) {
+    Source source;
+    std::error_code ec;
+    std::array<char, SMALL_SIZE> buf;
+    const SmallFile* files[] = { &HEAD, &MID, &TAIL };
+    size_t index[] = { 0, 2, 4 };
+
+    if (!source.init(path, ec)) {
+        check(false, std::string{ Source::name() } + " opens the pak, " + ec.message());
+        return;
+    }
+
+    // tail first, so a source that only counts 32 bits reads the wrong place at once.
+    for (int i = 2; i >= 0; --i) {
+        const FileAttr& attr = header.fileAttrList[index[i]];
+        size_t n = source.read(attr.offset, buf.data(), buf.size(), ec);
+
+        check(n == SMALL_SIZE && same_data(buf.data(), *files[i]), std::string{ Source::name() } + " reads " + files[i]->name);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "large.pak";
+    Header expected;
+    Header parsed;
+
+    build_layout(expected);
+
+    if (!write_sparse_pak(expected, path)) {
+        DeleteFile(path);
+        return 1;
+    }
+
+    check_header(expected, path, parsed);
+    check_seek<std::ifstream>(parsed, path, "ifstream");
+    check_seek<DirectReader>(parsed, path, "DirectReader");
+    check_source<StreamSource>(parsed, path);
+    check_source<StdioSource>(parsed, path);
+    check_source<ReadFileSource>(parsed, path);
+    check_source<PositionalSource>(parsed, path);
+    check_source<UnbufferedSource>(parsed, path);
+
+    // a 32 bit process can't map 8 GB.
+    if (sizeof(void*) == 8) {
+        check_source<MappedSource>(parsed, path);
+    }
+
+    DeleteFile(path);
+
+    std::cout << (failures == 0 ? "all passed\n" : "some checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+/**
+ * @author yuanluo2
+ * @brief lazily decoded view of a .pak file's body, written in C++11, only works for windows platform.
+ *
+ * the whole body is one contiguous, decoded, read-only block of memory, but a page is only read
+ * and decoded when it's touched first. windows has no userfaultfd, a vectored exception handler
+ * does the same job: the body is a pagefile backed section with two views, the public one starts
+ * PAGE_NOACCESS, the first touch of a page raises an access violation, the handler reads the page
+ * from the pak with a positional ReadFile() into the private writable view, decodes it in place,
+ * then opens the page of the public view read-only and lets the access go on. the public page
+ * only opens once it's complete, so another thread never sees half a page.
+ *
+ * faults on the page right after (or right before) the last run double the run, up to
+ * LAZY_MAX_RUN, so a sequential reader takes few faults, like the readahead of a mapped file.
+ * the section is charged against the pagefile up front, RAM and decoding only go to the touched
+ * pages. a failed read leaves the page closed and the access violation goes on, the same as a
+ * SIGBUS of a truncated mapped file. system calls fail on pages that aren't decoded yet instead
+ * of raising the exception, prefault() a range before handing it to the kernel.
+*/
+#ifndef POPCAP_PAK_LAZY_HPP
+#define POPCAP_PAK_LAZY_HPP
+
+#include "popcap_pak_io.hpp"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+constexpr size_t LAZY_MAX_RUN = 1 << 20;
+
+class LazyDecodedView;
+
+/*
+    the views the exception handler looks in, the handler is installed with the first view
+    and removed with the last one.
+*/
+class LazyViewRegistry {
+    std::mutex mutex;
+    std::vector<LazyDecodedView*> views;
+    PVOID handler = nullptr;
+
+    LazyViewRegistry() = default;
+
+    static LONG WINAPI on_exception(PEXCEPTION_POINTERS info);
+public:
+    LazyViewRegistry(const LazyViewRegistry&) = delete;
+    LazyViewRegistry& operator=(const LazyViewRegistry&) = delete;
+
+    static LazyViewRegistry& instance() {
+        static LazyViewRegistry registry;
+        return registry;
+    }
+
+    bool add(LazyDecodedView* view) {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        if (views.empty()) {
+            handler = AddVectoredExceptionHandler(1, &LazyViewRegistry::on_exception);
+
+            if (handler == nullptr) {
+                return false;
+            }
+        }
+
+        views.push_back(view);
+        return true;
+    }
+
+    void remove(LazyDecodedView* view) {
+        std::lock_guard<std::mutex> lock{ mutex };
+        auto it = std::find(views.begin(), views.end(), view);
+
+        if (it == views.end()) {
+            return;
+        }
+
+        views.erase(it);
+
+        if (views.empty()) {
+            RemoveVectoredExceptionHandler(handler);
+            handler = nullptr;
+        }
+    }
+
+    inline bool handle(const char* address);
+};
+
+class LazyDecodedView {
+    Header hdr;
+    PositionalSource source;
+    HANDLE hSection = nullptr;
+    char* writable = nullptr;
+    char* view = nullptr;
+    uint64_t size = 0;
+    size_t pageSize = 4096;
+    bool registered = false;
+
+    std::mutex mutex;
+    std::vector<bool> decoded;      // one per page.
+    size_t runStart = 0;            // the pages of the last run.
+    size_t runEnd = 0;
+    size_t run = 0;
+    std::atomic<uint64_t> faults{ 0 };
+    std::atomic<uint64_t> pagesDecoded{ 0 };
+
+    bool read_run(uint64_t offset, size_t len) {
+        std::error_code ec;
+
+        for (size_t done = 0; done < len; ) {
+            size_t n = source.read(hdr.headerSize + offset + done, writable + offset + done, len - done, ec);
+
+            if (n == 0) {
+                return false;
+            }
+
+            done += n;
+        }
+
+        decode_bytes(writable + offset, len);
+        return true;
+    }
+public:
+    LazyDecodedView() = default;
+    LazyDecodedView(const LazyDecodedView&) = delete;
+    LazyDecodedView& operator=(const LazyDecodedView&) = delete;
+
+    ~LazyDecodedView() noexcept {
+        if (registered) {
+            LazyViewRegistry::instance().remove(this);
+        }
+
+        if (view != nullptr) {
+            UnmapViewOfFile(view);
+        }
+
+        if (writable != nullptr) {
+            UnmapViewOfFile(writable);
+        }
+
+        if (hSection != nullptr) {
+            CloseHandle(hSection);
+        }
+    }
+
+    /*
+        parses and checks the header, reserves the view, nothing of the body is read yet.
+    */
+    bool open(const char* pakPath) {
+        HeaderParser parser;
+        HeaderValidator validator;
+        SYSTEM_INFO si;
+        std::error_code ec;
+        std::ifstream f{ pakPath, std::ios::binary };
+
+        if (!f.is_open()) {
+            std::cerr << "can't open file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        if (!parser.parse(hdr, f) || !validator.validate(hdr, get_pak_file_size(f))) {
+            std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        if (!source.init(pakPath, ec)) {
+            std::cerr << "can't open file: `" << pakPath << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        size = get_pak_file_size(f) - hdr.headerSize;
+        if (size == 0) {
+            return true;
+        }
+
+        GetSystemInfo(&si);
+        pageSize = si.dwPageSize;
+        decoded.assign(static_cast<size_t>((size + pageSize - 1) / pageSize), false);
+
+        hSection = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                     static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xffffffffu), nullptr);
+        if (hSection != nullptr) {
+            writable = static_cast<char*>(MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, 0));
+            view = static_cast<char*>(MapViewOfFile(hSection, FILE_MAP_READ, 0, 0, 0));
+        }
+
+        DWORD old;
+        if (writable == nullptr || view == nullptr || !VirtualProtect(view, static_cast<SIZE_T>(size), PAGE_NOACCESS, &old)) {
+            std::cerr << "can't reserve a view of " << size << " bytes, error " << GetLastError() << "\n";
+            return false;
+        }
+
+        if (!LazyViewRegistry::instance().add(this)) {
+            std::cerr << "can't install the exception handler, error " << GetLastError() << "\n";
+            return false;
+        }
+
+        registered = true;
+        return true;
+    }
+
+    const Header& header() const noexcept {
+        return hdr;
+    }
+
+    // the decoded body, the data of a file starts at attr.offset - header().headerSize.
+    const char* data() const noexcept {
+        return view;
+    }
+
+    const char* file_data(const FileAttr& attr) const noexcept {
+        return view + (attr.offset - hdr.headerSize);
+    }
+
+    uint64_t body_size() const noexcept {
+        return size;
+    }
+
+    bool contains(const char* address) const noexcept {
+        return view != nullptr && address >= view && address < view + size;
+    }
+
+    /*
+        decodes the run of pages around `address`, false if it can't be read.
+        another thread may have done it already, then there's nothing to do.
+        large memcpy()s copy backwards, so a run grows downwards when the faults go down.
+    */
+    bool fault(const char* address) {
+        std::lock_guard<std::mutex> lock{ mutex };
+        size_t page = static_cast<size_t>((address - view) / pageSize);
+
+        if (decoded[page]) {
+            return true;
+        }
+
+        faults.fetch_add(1, std::memory_order_relaxed);
+        bool forward = page == runEnd;
+        bool backward = page + 1 == runStart;
+        run = run > 0 && (forward || backward) ? (std::min)(run * 2, LAZY_MAX_RUN / pageSize) : 1;
+
+        size_t first = page;
+        size_t last = page + 1;
+        while (last - first < run && last < decoded.size() && !backward && !decoded[last]) {
+            ++last;
+        }
+
+        while (last - first < run && first > 0 && backward && !decoded[first - 1]) {
+            --first;
+        }
+
+        uint64_t offset = uint64_t(first) * pageSize;
+        size_t len = static_cast<size_t>((std::min)(uint64_t(last - first) * pageSize, size - offset));
+        DWORD old;
+
+        if (!read_run(offset, len) || !VirtualProtect(view + offset, (last - first) * pageSize, PAGE_READONLY, &old)) {
+            return false;
+        }
+
+        std::fill(decoded.begin() + first, decoded.begin() + last, true);
+        pagesDecoded.fetch_add(last - first, std::memory_order_relaxed);
+        runStart = first;
+        runEnd = last;
+        return true;
+    }
+
+    /*
+        decodes [offset, offset + len) of the body now, for a reader that knows what it needs.
+    */
+    bool prefault(uint64_t offset, uint64_t len) {
+        for (uint64_t at = offset - offset % pageSize; at < offset + len && at < size; at += pageSize) {
+            if (!fault(view + at)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint64_t fault_count() const noexcept {
+        return faults.load(std::memory_order_relaxed);
+    }
+
+    uint64_t decoded_bytes() const noexcept {
+        return (std::min)(pagesDecoded.load(std::memory_order_relaxed) * pageSize, size);
+    }
+};
+
+inline bool LazyViewRegistry::handle(const char* address) {
+    LazyDecodedView* owner = nullptr;
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        for (LazyDecodedView* v : views) {
+            if (v->contains(address)) {
+                owner = v;
+                break;
+            }
+        }
+    }
+
+    return owner != nullptr && owner->fault(address);
+}
+
+/*
+    only reads of a view are ours, a write to it is a bug of the caller and goes on as one.
+*/
+inline LONG WINAPI LazyViewRegistry::on_exception(PEXCEPTION_POINTERS info) {
+    const EXCEPTION_RECORD* record = info->ExceptionRecord;
+
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2 || record->ExceptionInformation[0] != 0) {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    const char* address = reinterpret_cast<const char*>(record->ExceptionInformation[1]);
+    return instance().handle(address) ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+}
+
+#endif // POPCAP_PAK_LAZY_HPP
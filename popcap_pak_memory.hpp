@@ -0,0 +1,275 @@
+/**
+ * @author yuanluo2
+ * @brief allocation and peak memory counters per phase, written in C++11, only works for windows platform.
+ *
+ * C++11 has no memory resources, so the executable replaces the global operator new and delete,
+ * define POPCAP_PAK_DEFINE_MEMORY_HOOKS in the one source file of the executable before any include.
+ * the size of a block comes from _msize(), so nothing is added to the allocations.
+ * memory taken with VirtualAlloc() is counted by hand where it's taken.
+ *
+ * a thread counts into the phase of its innermost MemoryScope, a thread without one counts into
+ * the default phase, which the caller switches while the workers run. frees are counted for the
+ * whole process only, a block is often freed in another phase than the one that allocated it.
+ * when counting is off, an allocation costs one relaxed atomic load.
+*/
+#ifndef POPCAP_PAK_MEMORY_HPP
+#define POPCAP_PAK_MEMORY_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+#include <malloc.h>
+
+#include <iostream>
+#include <array>
+#include <atomic>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+
+enum class MemPhase : unsigned {
+    Parse,
+    Index,
+    Buffers,
+    Caches,
+    Extract,
+    Other,
+    Count
+};
+
+constexpr size_t MEM_PHASE_COUNT = static_cast<size_t>(MemPhase::Count);
+
+inline const char* mem_phase_name(MemPhase phase) {
+    static const char* const names[MEM_PHASE_COUNT] = {
+        "parse", "index", "buffers", "caches", "extract", "other"
+    };
+
+    return names[static_cast<size_t>(phase)];
+}
+
+class MemoryStats {
+    struct PhaseCounters {
+        std::atomic<uint64_t> allocs{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<int64_t> peakLive{ 0 };     // the highest live bytes of the process at an allocation of this phase.
+    };
+
+    std::array<PhaseCounters, MEM_PHASE_COUNT> phases;
+    std::atomic<int64_t> live{ 0 };
+    std::atomic<int64_t> peak{ 0 };
+    std::atomic<uint64_t> frees{ 0 };
+    std::atomic<bool> on{ false };
+    std::atomic<unsigned> defaultPhase{ static_cast<unsigned>(MemPhase::Other) };
+
+    MemoryStats() = default;
+
+    static void raise(std::atomic<int64_t>& max, int64_t v) noexcept {
+        int64_t seen = max.load(std::memory_order_relaxed);
+
+        while (v > seen && !max.compare_exchange_weak(seen, v, std::memory_order_relaxed)) {
+        }
+    }
+public:
+    MemoryStats(const MemoryStats&) = delete;
+    MemoryStats& operator=(const MemoryStats&) = delete;
+
+    static MemoryStats& instance() {
+        static MemoryStats stats;
+        return stats;
+    }
+
+    // MEM_PHASE_COUNT while the thread has no MemoryScope.
+    static unsigned& thread_phase() noexcept {
+        thread_local unsigned phase = MEM_PHASE_COUNT;
+        return phase;
+    }
+
+    // call first thing in main(), a block allocated before and freed after makes the live count a little low.
+    void enable() noexcept {
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const noexcept {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    void set_default_phase(MemPhase phase) noexcept {
+        defaultPhase.store(static_cast<unsigned>(phase), std::memory_order_relaxed);
+    }
+
+    MemPhase current_phase() const noexcept {
+        unsigned phase = thread_phase();
+        return static_cast<MemPhase>(phase < MEM_PHASE_COUNT ? phase : defaultPhase.load(std::memory_order_relaxed));
+    }
+
+    void record_alloc(size_t size, MemPhase phase) noexcept {
+        if (!enabled()) {
+            return;
+        }
+
+        PhaseCounters& c = phases[static_cast<size_t>(phase)];
+        int64_t now = live.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed) + static_cast<int64_t>(size);
+
+        c.allocs.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(size, std::memory_order_relaxed);
+        raise(c.peakLive, now);
+        raise(peak, now);
+    }
+
+    void record_alloc(size_t size) noexcept {
+        record_alloc(size, current_phase());
+    }
+
+    void record_free(size_t size) noexcept {
+        if (!enabled()) {
+            return;
+        }
+
+        live.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+        frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t allocations() const noexcept {
+        uint64_t n = 0;
+
+        for (const PhaseCounters& c : phases) {
+            n += c.allocs.load(std::memory_order_relaxed);
+        }
+
+        return n;
+    }
+
+    uint64_t free_count() const noexcept {
+        return frees.load(std::memory_order_relaxed);
+    }
+
+    int64_t live_bytes() const noexcept {
+        return live.load(std::memory_order_relaxed);
+    }
+
+    int64_t peak_bytes() const noexcept {
+        return peak.load(std::memory_order_relaxed);
+    }
+
+    uint64_t phase_allocations(MemPhase phase) const noexcept {
+        return phases[static_cast<size_t>(phase)].allocs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t phase_bytes(MemPhase phase) const noexcept {
+        return phases[static_cast<size_t>(phase)].bytes.load(std::memory_order_relaxed);
+    }
+
+    int64_t phase_peak_bytes(MemPhase phase) const noexcept {
+        return phases[static_cast<size_t>(phase)].peakLive.load(std::memory_order_relaxed);
+    }
+
+    void print_summary(std::ostream& out) const {
+        out << "  memory: peak " << peak.load() / 1048576.0 << " MB, live " << live.load() / 1048576.0 << " MB, "
+            << allocations() << " allocations, " << frees.load() << " frees\n";
+
+        for (size_t i = 0; i < MEM_PHASE_COUNT; ++i) {
+            const PhaseCounters& c = phases[i];
+
+            if (c.allocs.load() == 0) {
+                continue;
+            }
+
+            out << "    " << mem_phase_name(static_cast<MemPhase>(i)) << ": " << c.allocs.load() << " allocations, "
+                << c.bytes.load() << " bytes, peak " << c.peakLive.load() / 1048576.0 << " MB\n";
+        }
+    }
+
+    void write_json(std::ostream& out) const {
+        out << "{ \"peak_bytes\": " << peak.load() << ", \"live_bytes\": " << live.load()
+            << ", \"allocations\": " << allocations() << ", \"frees\": " << frees.load() << ", \"phases\": {";
+
+        for (size_t i = 0; i < MEM_PHASE_COUNT; ++i) {
+            const PhaseCounters& c = phases[i];
+
+            out << (i > 0 ? ", " : " ") << "\"" << mem_phase_name(static_cast<MemPhase>(i)) << "\": { \"allocations\": "
+                << c.allocs.load() << ", \"bytes\": " << c.bytes.load() << ", \"peak_live_bytes\": " << c.peakLive.load() << " }";
+        }
+
+        out << " } }";
+    }
+};
+
+/*
+    the allocations of this thread count into `phase` while it's in scope, scopes nest.
+*/
+class MemoryScope {
+    unsigned saved;
+public:
+    explicit MemoryScope(MemPhase phase) noexcept : saved{ MemoryStats::thread_phase() } {
+        MemoryStats::thread_phase() = static_cast<unsigned>(phase);
+    }
+
+    ~MemoryScope() {
+        MemoryStats::thread_phase() = saved;
+    }
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+};
+
+inline void* counted_malloc(size_t size) noexcept {
+    void* p = std::malloc(size > 0 ? size : 1);
+
+    if (p != nullptr && MemoryStats::instance().enabled()) {
+        MemoryStats::instance().record_alloc(_msize(p));
+    }
+
+    return p;
+}
+
+inline void counted_free(void* p) noexcept {
+    if (p != nullptr && MemoryStats::instance().enabled()) {
+        MemoryStats::instance().record_free(_msize(p));
+    }
+
+    std::free(p);
+}
+
+#ifdef POPCAP_PAK_DEFINE_MEMORY_HOOKS
+void* operator new(size_t size) {
+    void* p = counted_malloc(size);
+
+    if (p == nullptr) {
+        throw std::bad_alloc{};
+    }
+
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void operator delete(void* p) noexcept {
+    counted_free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    counted_free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    counted_free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    counted_free(p);
+}
+#endif
+
+#endif // POPCAP_PAK_MEMORY_HPP
@@ -0,0 +1,232 @@
+/**
+ * @author yuanluo2
+ * @brief priority classes of the extraction and their readiness, written in C++11, only works for windows platform.
+ *
+ * a priority file has glob rules grouped into named classes, in the order they're extracted:
+ *
+ *     [config]
+ *     properties\**
+ *     [atlases]
+ *     images\atlas*.png
+ *
+ * `*` and `?` stay inside one dir, `**` crosses dirs, names compare without case like windows.
+ * files that match no rule come last. the file list is sorted by class before the extraction,
+ * a ReadinessTracker owned by the extraction counts the finished files of each class and calls
+ * back once a class and all the classes before it are done, telling if all its files were saved.
+*/
+#ifndef POPCAP_PAK_PRIORITY_HPP
+#define POPCAP_PAK_PRIORITY_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cctype>
+
+struct PriorityClass {
+    std::string name;
+    std::vector<std::string> globs;
+};
+
+inline bool glob_match(const char* pattern, const char* name) {
+    for (; *pattern != '\0'; ++pattern, ++name) {
+        if (pattern[0] == '*' && pattern[1] == '*') {
+            for (const char* rest = name; ; ++rest) {
+                if (glob_match(pattern + 2, rest)) {
+                    return true;
+                }
+
+                if (*rest == '\0') {
+                    return false;
+                }
+            }
+        }
+
+        if (*pattern == '*') {
+            for (const char* rest = name; ; ++rest) {
+                if (glob_match(pattern + 1, rest)) {
+                    return true;
+                }
+
+                if (*rest == '\0' || *rest == '\\') {
+                    return false;
+                }
+            }
+        }
+
+        if (*name == '\0' || (*pattern == '?' ? *name == '\\' :
+            std::tolower(static_cast<unsigned char>(*pattern)) != std::tolower(static_cast<unsigned char>(*name)))) {
+            return false;
+        }
+    }
+
+    return *name == '\0';
+}
+
+// `/` is taken as `\`, so rules can be written either way.
+inline std::string normalize_glob(std::string glob) {
+    std::replace(glob.begin(), glob.end(), '/', '\\');
+    return glob;
+}
+
+/*
+    rules before the first `[name]` line go into a class called `priority`.
+*/
+inline bool load_priority_rules(const char* path, std::vector<PriorityClass>& classes) {
+    std::ifstream in{ path };
+    std::string line;
+
+    if (!in.is_open()) {
+        return false;
+    }
+
+    while (std::getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        size_t last = line.find_last_not_of(" \t\r");
+
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+
+        line = line.substr(first, last - first + 1);
+
+        if (line.front() == '[' && line.back() == ']') {
+            classes.push_back(PriorityClass{ line.substr(1, line.size() - 2), {} });
+        }
+        else {
+            if (classes.empty()) {
+                classes.push_back(PriorityClass{ "priority", {} });
+            }
+
+            classes.back().globs.push_back(normalize_glob(line));
+        }
+    }
+
+    return true;
+}
+
+/*
+    the class of a file name, classes.size() if no rule matches.
+*/
+inline unsigned priority_of(const char* name, const std::vector<PriorityClass>& classes) {
+    for (unsigned c = 0; c < classes.size(); ++c) {
+        for (const std::string& glob : classes[c].globs) {
+            if (glob_match(glob.c_str(), name)) {
+                return c;
+            }
+        }
+    }
+
+    return static_cast<unsigned>(classes.size());
+}
+
+/*
+    calls back from a worker thread, under a lock, so the callbacks never overlap.
+    `saved` is false if a file of the class couldn't be saved, the class is failed then, not ready.
+*/
+class ReadinessTracker {
+    const void* base = nullptr;     // the first FileAttr of the sorted list.
+    std::vector<unsigned> classOf;
+    std::unique_ptr<std::atomic<size_t>[]> remaining;
+    std::unique_ptr<std::atomic<bool>[]> failed;
+    std::vector<std::string> names;
+    std::function<void(const std::string&, bool)> callback;
+    std::mutex mutex;
+    size_t announced = 0;
+
+    void announce() {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        while (announced < names.size() && remaining[announced].load(std::memory_order_acquire) == 0) {
+            callback(names[announced], !failed[announced].load(std::memory_order_relaxed));
+            announced++;
+        }
+    }
+public:
+    ReadinessTracker() = default;
+    ReadinessTracker(const ReadinessTracker&) = delete;
+    ReadinessTracker& operator=(const ReadinessTracker&) = delete;
+
+    /*
+        sorts the files of `header` by class, keeping the pak order inside a class, and starts
+        counting. call before any worker starts, the file list must not change after.
+    */
+    template<typename HeaderType>
+    void start(HeaderType& header, const std::vector<PriorityClass>& classes, std::function<void(const std::string&, bool)> ready) {
+        using Attr = typename decltype(header.fileAttrList)::value_type;
+        std::vector<std::pair<unsigned, size_t>> order;
+
+        for (size_t i = 0; i < header.fileAttrList.size(); ++i) {
+            order.emplace_back(priority_of(header.fileAttrList[i].fileName.get(), classes), i);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [](const std::pair<unsigned, size_t>& a, const std::pair<unsigned, size_t>& b) {
+            return a.first < b.first;
+        });
+
+        std::vector<Attr> sorted;
+        sorted.reserve(order.size());
+        remaining.reset(new std::atomic<size_t>[classes.size() + 1]);
+        failed.reset(new std::atomic<bool>[classes.size() + 1]);
+
+        for (size_t c = 0; c <= classes.size(); ++c) {
+            remaining[c].store(0, std::memory_order_relaxed);
+            failed[c].store(false, std::memory_order_relaxed);
+        }
+
+        for (const std::pair<unsigned, size_t>& o : order) {
+            sorted.push_back(std::move(header.fileAttrList[o.second]));
+            classOf.push_back(o.first);
+            remaining[o.first].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        header.fileAttrList.swap(sorted);
+        base = header.fileAttrList.data();
+        callback = std::move(ready);
+
+        for (const PriorityClass& c : classes) {
+            names.push_back(c.name);
+        }
+
+        announce();     // classes without files are ready at once.
+    }
+
+    bool started() const noexcept {
+        return base != nullptr;
+    }
+
+    size_t files_in(size_t c) const noexcept {
+        return std::count(classOf.begin(), classOf.end(), static_cast<unsigned>(c));
+    }
+
+    /*
+        called once per file of the sorted list, `saved` false if it was skipped or cut short.
+        a file of another list is ignored.
+    */
+    template<typename Attr>
+    void file_done(const Attr& attr, bool saved) {
+        const Attr* first = static_cast<const Attr*>(base);
+        std::less<const Attr*> before;
+
+        if (first == nullptr || before(&attr, first) || !before(&attr, first + classOf.size())) {
+            return;
+        }
+
+        unsigned c = classOf[static_cast<size_t>(&attr - first)];
+
+        if (!saved) {
+            failed[c].store(true, std::memory_order_relaxed);
+        }
+
+        // the release of the count also publishes the failed flag to the thread that announces.
+        if (remaining[c].fetch_sub(1, std::memory_order_acq_rel) == 1 && c < names.size()) {
+            announce();
+        }
+    }
+};
+
+#endif // POPCAP_PAK_PRIORITY_HPP
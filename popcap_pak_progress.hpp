@@ -0,0 +1,227 @@
+/**
+ * @author yuanluo2
+ * @brief live progress and ETA of the extraction, written in C++11, only works for windows platform.
+ *
+ * every worker owns one ProgressSlot and is its only writer, so it updates it with relaxed
+ * stores, no lock and no read-modify-write. a render thread sums the slots at a fixed rate and
+ * prints either a status line to stderr or one JSON object per line to a file descriptor.
+*/
+#ifndef POPCAP_PAK_PROGRESS_HPP
+#define POPCAP_PAK_PROGRESS_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include "popcap_pak_trace.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/*
+    the hot fields sit at the front and a slot is 128 bytes,
+    so the hot fields of two slots never share a cache line, whatever the alignment.
+*/
+struct ProgressSlot {
+    std::atomic<uint64_t> doneBytes{ 0 };       // bytes of the saved files.
+    std::atomic<uint64_t> fileBytes{ 0 };       // bytes written of the current file.
+    std::atomic<uint64_t> files{ 0 };           // saved files.
+    std::atomic<uint64_t> skippedBytes{ 0 };    // bytes of the failed files.
+    std::atomic<uint64_t> failed{ 0 };
+    std::atomic<const char*> file{ nullptr };   // the current file, owned by the header.
+    char pad[128 - 5 * sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<const char*>)];
+
+    void begin_file(const char* name) noexcept {
+        file.store(name, std::memory_order_relaxed);
+    }
+
+    void add_bytes(uint64_t n) noexcept {
+        fileBytes.store(fileBytes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // a failed file still moves the position, so the total always adds up, but it's not counted as done.
+    void end_file(uint64_t size, bool saved = true) noexcept {
+        if (saved) {
+            doneBytes.store(doneBytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+            files.store(files.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        else {
+            skippedBytes.store(skippedBytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+            failed.store(failed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        fileBytes.store(0, std::memory_order_relaxed);
+        file.store(nullptr, std::memory_order_relaxed);
+    }
+};
+
+enum class ProgressMode {
+    Text,
+    Json
+};
+
+class ProgressReporter {
+    static constexpr size_t MAX_ACTIVE_SHOWN = 3;
+
+    std::unique_ptr<ProgressSlot[]> slots;
+    size_t slotNum;
+    uint64_t totalFiles;
+    uint64_t totalBytes;
+    ProgressMode mode;
+    std::FILE* out;
+    unsigned intervalMs;
+    uint64_t start = 0;
+
+    std::thread renderer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    static void write_json_string(std::FILE* out, const char* s) {
+        std::fputc('"', out);
+
+        for (; *s != '\0'; ++s) {
+            unsigned char c = static_cast<unsigned char>(*s);
+
+            if (c == '"' || c == '\\') {
+                std::fputc('\\', out);
+                std::fputc(c, out);
+            }
+            else {
+                std::fputc(c < 0x20 ? ' ' : c, out);
+            }
+        }
+
+        std::fputc('"', out);
+    }
+
+    void render(bool last) {
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+        uint64_t failed = 0;
+        uint64_t skipped = 0;
+        const char* active[MAX_ACTIVE_SHOWN];
+        size_t activeNum = 0;
+
+        for (size_t i = 0; i < slotNum; ++i) {
+            const ProgressSlot& s = slots[i];
+            const char* name = s.file.load(std::memory_order_relaxed);
+
+            files += s.files.load(std::memory_order_relaxed);
+            bytes += s.doneBytes.load(std::memory_order_relaxed) + s.fileBytes.load(std::memory_order_relaxed);
+            failed += s.failed.load(std::memory_order_relaxed);
+            skipped += s.skippedBytes.load(std::memory_order_relaxed);
+
+            if (name != nullptr && activeNum < MAX_ACTIVE_SHOWN) {
+                active[activeNum++] = name;
+            }
+        }
+
+        double elapsed = ticks_to_seconds(now_ticks() - start);
+        uint64_t position = bytes + skipped;
+        double rate = elapsed > 0 ? bytes / elapsed : 0;
+        double eta = rate > 0 && totalBytes > position ? (totalBytes - position) / rate : 0;
+
+        if (mode == ProgressMode::Json) {
+            std::fprintf(out, "{\"elapsed\":%.3f,\"files\":%llu,\"failed\":%llu,\"total_files\":%llu,\"bytes\":%llu,\"total_bytes\":%llu,"
+                              "\"bytes_per_sec\":%.0f,\"eta_seconds\":%.3f,\"done\":%s,\"active\":[",
+                         elapsed, static_cast<unsigned long long>(files), static_cast<unsigned long long>(failed),
+                         static_cast<unsigned long long>(totalFiles),
+                         static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(totalBytes),
+                         rate, eta, last ? "true" : "false");
+
+            for (size_t i = 0; i < activeNum; ++i) {
+                if (i > 0) {
+                    std::fputc(',', out);
+                }
+
+                write_json_string(out, active[i]);
+            }
+
+            std::fputs("]}\n", out);
+        }
+        else {
+            double percent = totalBytes > 0 ? 100.0 * position / totalBytes : 100.0;
+
+            // the line is redrawn in place, the padding wipes the tail of a longer previous line.
+            std::fprintf(out, "\r%5.1f%% %llu/%llu files, %.1f/%.1f MB, %.1f MB/s, ETA %.0f s",
+                         percent, static_cast<unsigned long long>(files), static_cast<unsigned long long>(totalFiles),
+                         bytes / 1048576.0, totalBytes / 1048576.0, rate / 1048576.0, eta);
+
+            if (failed > 0) {
+                std::fprintf(out, ", %llu failed", static_cast<unsigned long long>(failed));
+            }
+
+            if (activeNum > 0) {
+                std::fprintf(out, ", %s", active[0]);
+
+                if (activeNum > 1) {
+                    std::fprintf(out, " (+%u more)", static_cast<unsigned>(activeNum - 1));
+                }
+            }
+
+            std::fputs(last ? "\n" : "          ", out);
+        }
+
+        std::fflush(out);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock{ mutex };
+
+        while (!cv.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return stopping; })) {
+            render(false);
+        }
+
+        render(true);
+    }
+public:
+    /*
+        `slotCount` is the number of workers, `out` must stay open until stop() returns.
+    */
+    ProgressReporter(size_t slotCount, uint64_t files, uint64_t bytes, ProgressMode m, std::FILE* o, unsigned interval)
+        : slots{ new ProgressSlot[slotCount > 0 ? slotCount : 1] }, slotNum{ slotCount > 0 ? slotCount : 1 },
+          totalFiles{ files }, totalBytes{ bytes }, mode{ m }, out{ o }, intervalMs{ interval > 0 ? interval : 1 } {}
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    ~ProgressReporter() {
+        stop();
+    }
+
+    ProgressSlot* slot_array() noexcept {
+        return slots.get();
+    }
+
+    void start_rendering() {
+        start = now_ticks();
+        renderer = std::thread{ &ProgressReporter::run, this };
+    }
+
+    // renders the final state once, call it before the header is gone.
+    void stop() {
+        if (!renderer.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            stopping = true;
+        }
+
+        cv.notify_one();
+        renderer.join();
+    }
+};
+
+#endif // POPCAP_PAK_PROGRESS_HPP
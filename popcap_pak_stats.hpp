@@ -0,0 +1,353 @@
+/**
+ * @author yuanluo2
+ * @brief per-phase timing and throughput counters for the extraction, written in C++11, only works for windows platform.
+ *
+ * every worker owns one ExtractStats and updates it without any lock or atomic,
+ * the caller merges them when the workers are done. a null ExtractStats* with tracing off
+ * turns every PhaseTimer into a no-op, so the extraction loop pays one branch then.
+*/
+#ifndef POPCAP_PAK_STATS_HPP
+#define POPCAP_PAK_STATS_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include "popcap_pak_trace.hpp"
+#include "popcap_pak_progress.hpp"
+#include "popcap_pak_priority.hpp"
+#include "popcap_pak_memory.hpp"
+
+#include <iostream>
+#include <array>
+#include <cstdint>
+
+enum class Phase : unsigned {
+    Parse,
+    CreateDirs,
+    Open,
+    Read,
+    Decode,
+    Write,
+    SetTime,
+    Close,
+    Sync,
+    Count
+};
+
+constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+
+inline const char* phase_name(Phase phase) {
+    static const char* const names[PHASE_COUNT] = {
+        "parse", "create_dirs", "open", "read", "decode", "write", "set_time", "close", "sync"
+    };
+
+    return names[static_cast<size_t>(phase)];
+}
+
+/*
+    user mode windows has no perf_event_open(), the per-thread cycle counter of
+    QueryThreadCycleTime() is the one hardware counter any process may read.
+    instructions, cache misses and branch misses need ETW PMU sources and admin
+    rights, so they're reported as unavailable instead.
+*/
+inline bool read_thread_cycles(uint64_t& cycles) noexcept {
+    ULONG64 c;
+
+    if (!QueryThreadCycleTime(GetCurrentThread(), &c)) {
+        return false;
+    }
+
+    cycles = c;
+    return true;
+}
+
+inline bool hw_counters_available() noexcept {
+    uint64_t cycles;
+    return read_thread_cycles(cycles);
+}
+
+/*
+    log-linear histogram of nanoseconds, 8 sub buckets per power of 2,
+    so a percentile is off by at most 12.5%.
+*/
+class LatencyHistogram {
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr unsigned SUB_COUNT = 1u << SUB_BITS;
+
+    std::array<uint64_t, 64 * SUB_COUNT> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t maxValue = 0;
+
+    static size_t bucket_of(uint64_t v) noexcept {
+        if (v < SUB_COUNT) {
+            return static_cast<size_t>(v);
+        }
+
+        unsigned high = 63;
+        while (!(v >> high)) {
+            --high;
+        }
+
+        unsigned shift = high - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + static_cast<size_t>((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t bucket_upper(size_t bucket) noexcept {
+        if (bucket < SUB_COUNT) {
+            return bucket;
+        }
+
+        unsigned shift = static_cast<unsigned>(bucket / SUB_COUNT) - 1;
+        uint64_t sub = bucket % SUB_COUNT;
+        return ((SUB_COUNT + sub + 1) << shift) - 1;
+    }
+public:
+    void add(uint64_t ns) noexcept {
+        ++buckets[bucket_of(ns)];
+        ++count;
+        sum += ns;
+        maxValue = ns > maxValue ? ns : maxValue;
+    }
+
+    void merge(const LatencyHistogram& other) noexcept {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            buckets[i] += other.buckets[i];
+        }
+
+        count += other.count;
+        sum += other.sum;
+        maxValue = other.maxValue > maxValue ? other.maxValue : maxValue;
+    }
+
+    uint64_t percentile(double p) const noexcept {
+        uint64_t rank = static_cast<uint64_t>(p * count);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+
+            if (seen > rank) {
+                uint64_t upper = bucket_upper(i);
+                return upper < maxValue ? upper : maxValue;
+            }
+        }
+
+        return maxValue;
+    }
+
+    uint64_t samples() const noexcept { return count; }
+    uint64_t max() const noexcept { return maxValue; }
+    uint64_t mean() const noexcept { return count > 0 ? sum / count : 0; }
+};
+
+class ExtractStats {
+    // bytes each phase works on, for cycles per byte, 0 means count per call instead.
+    uint64_t phase_bytes(Phase phase) const noexcept {
+        switch (phase) {
+            case Phase::Parse:  return headerBytes;
+            case Phase::Read:
+            case Phase::Decode:
+            case Phase::Write:  return bytes;
+            default:            return 0;
+        }
+    }
+public:
+    std::array<uint64_t, PHASE_COUNT> phaseTicks{};
+    std::array<uint64_t, PHASE_COUNT> phaseCalls{};
+    std::array<uint64_t, PHASE_COUNT> phaseCycles{};
+    uint64_t files = 0;              // saved files, `bytes` are theirs.
+    uint64_t bytes = 0;
+    uint64_t failed = 0;             // files that couldn't be created or written.
+    uint64_t headerBytes = 0;
+    bool hwCounters = false;        // also count cpu cycles per phase, costs a syscall per phase.
+    ProgressSlot* progress = nullptr;   // live progress of this worker, not merged.
+    ReadinessTracker* readiness = nullptr;  // shared by all the workers of one extraction, not merged.
+    LatencyHistogram fileLatency;    // from creating the dirs of a file to closing it.
+
+    /*
+        the stats of worker `id`, counting the same things as `parent`, which may be null.
+        `parent->progress`, if set, points to one slot per worker.
+    */
+    void init_worker(const ExtractStats* parent, unsigned id) noexcept {
+        hwCounters = parent != nullptr && parent->hwCounters;
+        progress = parent != nullptr && parent->progress != nullptr ? parent->progress + id : nullptr;
+        readiness = parent != nullptr ? parent->readiness : nullptr;
+    }
+
+    // tells the readiness of the extraction, if any, that `attr` is done.
+    template<typename Attr>
+    void file_done(const Attr& attr, bool saved) {
+        if (readiness != nullptr) {
+            readiness->file_done(attr, saved);
+        }
+    }
+
+    void add(Phase phase, uint64_t ticks) noexcept {
+        phaseTicks[static_cast<size_t>(phase)] += ticks;
+        phaseCalls[static_cast<size_t>(phase)] += 1;
+    }
+
+    void add_cycles(Phase phase, uint64_t cycles) noexcept {
+        phaseCycles[static_cast<size_t>(phase)] += cycles;
+    }
+
+    void add_file(uint64_t fileBytes, uint64_t ticks, bool saved = true) noexcept {
+        if (!saved) {
+            failed += 1;
+            return;
+        }
+
+        files += 1;
+        bytes += fileBytes;
+        fileLatency.add(static_cast<uint64_t>(ticks_to_seconds(ticks) * 1e9));
+    }
+
+    void merge(const ExtractStats& other) noexcept {
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            phaseTicks[i] += other.phaseTicks[i];
+            phaseCalls[i] += other.phaseCalls[i];
+            phaseCycles[i] += other.phaseCycles[i];
+        }
+
+        files += other.files;
+        bytes += other.bytes;
+        failed += other.failed;
+        headerBytes += other.headerBytes;
+        fileLatency.merge(other.fileLatency);
+    }
+
+    /*
+        phase times are summed over all workers, so with several threads they add up to more than the wall time.
+    */
+    void print_summary(std::ostream& out, double wallSeconds) const {
+        double mb = bytes / 1048576.0;
+
+        out << "extracted " << files << " files, " << bytes << " bytes in " << wallSeconds << " s";
+        if (wallSeconds > 0) {
+            out << " (" << mb / wallSeconds << " MB/s, " << files / wallSeconds << " files/s)";
+        }
+
+        if (failed > 0) {
+            out << ", " << failed << " files failed";
+        }
+
+        out << "\n";
+
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            if (phaseCalls[i] == 0) {
+                continue;
+            }
+
+            Phase phase = static_cast<Phase>(i);
+            out << "  " << phase_name(phase) << ": "
+                << ticks_to_seconds(phaseTicks[i]) * 1000 << " ms in " << phaseCalls[i] << " calls";
+
+            if (hwCounters) {
+                uint64_t n = phase_bytes(phase);
+
+                out << ", " << phaseCycles[i] / 1e6 << " Mcycles, "
+                    << (n > 0 ? static_cast<double>(phaseCycles[i]) / n : static_cast<double>(phaseCycles[i]) / phaseCalls[i])
+                    << (n > 0 ? " cycles/byte" : " cycles/call");
+            }
+
+            out << "\n";
+        }
+
+        out << "  per file latency: p50 " << fileLatency.percentile(0.50) / 1000.0
+            << " us, p99 " << fileLatency.percentile(0.99) / 1000.0
+            << " us, max " << fileLatency.max() / 1000.0 << " us\n";
+
+        if (MemoryStats::instance().enabled()) {
+            MemoryStats::instance().print_summary(out);
+        }
+    }
+
+    bool write_json(std::ostream& out, double wallSeconds) const {
+        out << "{\n";
+        out << "  \"files\": " << files << ",\n";
+        out << "  \"bytes\": " << bytes << ",\n";
+        out << "  \"failed\": " << failed << ",\n";
+        out << "  \"wall_seconds\": " << wallSeconds << ",\n";
+        out << "  \"phases\": {\n";
+
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            out << "    \"" << phase_name(static_cast<Phase>(i)) << "\": { \"seconds\": " << ticks_to_seconds(phaseTicks[i])
+                << ", \"calls\": " << phaseCalls[i];
+
+            if (hwCounters) {
+                out << ", \"cycles\": " << phaseCycles[i];
+            }
+
+            out << " }" << (i + 1 < PHASE_COUNT ? "," : "") << "\n";
+        }
+
+        out << "  },\n";
+        out << "  \"hw_counters\": { \"cycles\": " << (hwCounters ? "true" : "false")
+            << ", \"instructions\": null, \"cache_misses\": null, \"branch_misses\": null },\n";
+        out << "  \"file_latency_ns\": { \"samples\": " << fileLatency.samples()
+            << ", \"mean\": " << fileLatency.mean()
+            << ", \"p50\": " << fileLatency.percentile(0.50)
+            << ", \"p90\": " << fileLatency.percentile(0.90)
+            << ", \"p99\": " << fileLatency.percentile(0.99)
+            << ", \"max\": " << fileLatency.max() << " },\n";
+        out << "  \"memory\": ";
+
+        if (MemoryStats::instance().enabled()) {
+            MemoryStats::instance().write_json(out);
+        }
+        else {
+            out << "null";
+        }
+
+        out << "\n}\n";
+
+        return static_cast<bool>(out);
+    }
+};
+
+/*
+    adds the time of its own scope to one phase, and records it as a span when tracing is on.
+*/
+class PhaseTimer {
+    ExtractStats* stats;
+    Phase phase;
+    uint64_t start;
+    uint64_t startCycles = 0;
+public:
+    PhaseTimer(ExtractStats* s, Phase p) noexcept
+        : stats{ s }, phase{ p }, start{ s != nullptr || Tracer::instance().enabled() ? now_ticks() : 0 } {
+        if (stats != nullptr && stats->hwCounters) {
+            read_thread_cycles(startCycles);
+        }
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    ~PhaseTimer() {
+        if (start == 0) {
+            return;
+        }
+
+        uint64_t end = now_ticks();
+
+        if (stats != nullptr) {
+            uint64_t endCycles = 0;
+            stats->add(phase, end - start);
+
+            if (stats->hwCounters && read_thread_cycles(endCycles)) {
+                stats->add_cycles(phase, endCycles - startCycles);
+            }
+        }
+
+        if (Tracer::instance().enabled()) {
+            Tracer::instance().record(phase_name(phase), nullptr, start, end);
+        }
+    }
+};
+
+#endif // POPCAP_PAK_STATS_HPP
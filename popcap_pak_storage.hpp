@@ -0,0 +1,399 @@
+/**
+ * @author yuanluo2
+ * @brief storage aware concurrency and I/O sizing of the extraction, written in C++11, only works for windows platform.
+ *
+ * the device class of a path comes from its volume: GetDriveType() tells network, removable
+ * and ram disks apart, IOCTL_STORAGE_QUERY_PROPERTY tells whether a fixed disk has a seek
+ * penalty (a spinning disk) and whether it sits on an NVMe bus. the class picks the start and
+ * max worker count, the buffer size and the read backend, the queue depth of the device and the
+ * file system of the output can only lower the worker counts. then ConcurrencyController moves
+ * the number of running workers up or down by the throughput it measures.
+*/
+#ifndef POPCAP_PAK_STORAGE_HPP
+#define POPCAP_PAK_STORAGE_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+#include <winioctl.h>
+
+#include "popcap_pak_trace.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+enum class StorageClass {
+    Unknown,
+    Nvme,
+    Ssd,
+    Hdd,
+    Network,
+    Removable,
+    Ram
+};
+
+inline const char* storage_class_name(StorageClass c) {
+    switch (c) {
+        case StorageClass::Nvme:      return "nvme";
+        case StorageClass::Ssd:       return "ssd";
+        case StorageClass::Hdd:       return "hdd";
+        case StorageClass::Network:   return "network";
+        case StorageClass::Removable: return "removable";
+        case StorageClass::Ram:       return "ram";
+        default:                      return "unknown";
+    }
+}
+
+struct StorageInfo {
+    StorageClass cls = StorageClass::Unknown;
+    std::string volume;         // mount point, like `C:\` or `\\server\share\`.
+    std::string fileSystem;     // NTFS, ReFS, exFAT, ... empty if unknown.
+    unsigned queueDepth = 0;    // commands the device takes at once, 0 if unknown.
+};
+
+// NCQ has 32 tags, SAS tagged queueing has at least as many.
+constexpr unsigned COMMAND_QUEUE_DEPTH = 32;
+
+// the Number of Queues feature of the NVMe spec.
+constexpr DWORD NVME_NUMBER_OF_QUEUES_FEATURE = 0x07;
+
+template<typename T>
+bool query_storage_property(HANDLE hVolume, STORAGE_PROPERTY_ID id, T& out) {
+    STORAGE_PROPERTY_QUERY query{};
+    DWORD returned = 0;
+
+    query.PropertyId = id;
+    query.QueryType = PropertyStandardQuery;
+
+    return DeviceIoControl(hVolume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                           &out, sizeof(out), &returned, nullptr) && returned >= sizeof(out);
+}
+
+/*
+    the I/O submission queues the NVMe controller granted, every one of them takes many commands,
+    so a worker per queue never waits for a free slot. 0 if the driver doesn't answer.
+*/
+inline unsigned query_nvme_queue_count(HANDLE hVolume) {
+    // the query goes in and the descriptor comes back in the same buffer, both have the same size.
+    std::array<DWORD, (FIELD_OFFSET(STORAGE_PROPERTY_QUERY, AdditionalParameters) + sizeof(STORAGE_PROTOCOL_SPECIFIC_DATA) + 3) / 4> buf{};
+    STORAGE_PROPERTY_QUERY* query = reinterpret_cast<STORAGE_PROPERTY_QUERY*>(buf.data());
+    STORAGE_PROTOCOL_SPECIFIC_DATA* data = reinterpret_cast<STORAGE_PROTOCOL_SPECIFIC_DATA*>(query->AdditionalParameters);
+    DWORD size = static_cast<DWORD>(buf.size() * sizeof(DWORD));
+    DWORD returned = 0;
+
+    query->PropertyId = StorageDeviceProtocolSpecificProperty;
+    query->QueryType = PropertyStandardQuery;
+    data->ProtocolType = ProtocolTypeNvme;
+    data->DataType = NVMeDataTypeFeature;
+    data->ProtocolDataRequestValue = NVME_NUMBER_OF_QUEUES_FEATURE;
+
+    if (!DeviceIoControl(hVolume, IOCTL_STORAGE_QUERY_PROPERTY, buf.data(), size, buf.data(), size, &returned, nullptr) ||
+        returned < sizeof(STORAGE_PROTOCOL_DATA_DESCRIPTOR)) {
+        return 0;
+    }
+
+    // the submission queues allocated are in the low word, counted from 0.
+    const STORAGE_PROTOCOL_DATA_DESCRIPTOR* desc = reinterpret_cast<const STORAGE_PROTOCOL_DATA_DESCRIPTOR*>(buf.data());
+    return (desc->ProtocolSpecificData.FixedProtocolReturnData & 0xffffu) + 1;
+}
+
+/*
+    the device of the volume mounted at `volume`, like `C:\`, for CreateFile().
+*/
+inline bool volume_device_path(const char* volume, std::string& device) {
+    std::array<char, MAX_PATH> volumeName;
+
+    if (!GetVolumeNameForVolumeMountPoint(volume, volumeName.data(), static_cast<DWORD>(volumeName.size()))) {
+        return false;
+    }
+
+    // `\\?\Volume{guid}\` names the root dir, without the last backslash it names the device.
+    device = volumeName.data();
+    if (!device.empty() && device.back() == '\\') {
+        device.pop_back();
+    }
+
+    return true;
+}
+
+/*
+    `path` doesn't need to exist, only its volume does.
+    a volume that can't be queried, like a disk without admin rights on old windows, is Unknown.
+*/
+inline StorageInfo detect_storage(const char* path) {
+    StorageInfo info;
+    std::array<char, MAX_PATH> full;
+    std::array<char, MAX_PATH> volume;
+    std::array<char, MAX_PATH> fsName;
+
+    DWORD len = GetFullPathName(path, static_cast<DWORD>(full.size()), full.data(), nullptr);
+    if (len == 0 || len >= full.size() || !GetVolumePathName(full.data(), volume.data(), static_cast<DWORD>(volume.size()))) {
+        return info;
+    }
+
+    info.volume = volume.data();
+
+    if (GetVolumeInformation(volume.data(), nullptr, 0, nullptr, nullptr, nullptr, fsName.data(), static_cast<DWORD>(fsName.size()))) {
+        info.fileSystem = fsName.data();
+    }
+
+    switch (GetDriveType(volume.data())) {
+        case DRIVE_REMOTE:    info.cls = StorageClass::Network;   return info;
+        case DRIVE_REMOVABLE:
+        case DRIVE_CDROM:     info.cls = StorageClass::Removable; return info;
+        case DRIVE_RAMDISK:   info.cls = StorageClass::Ram;       return info;
+        case DRIVE_FIXED:     break;
+        default:              return info;
+    }
+
+    std::string device;
+    if (!volume_device_path(volume.data(), device)) {
+        return info;
+    }
+
+    HANDLE hVolume = CreateFile(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hVolume == INVALID_HANDLE_VALUE) {
+        return info;
+    }
+
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seek{};
+    STORAGE_ADAPTER_DESCRIPTOR adapter{};
+    STORAGE_DEVICE_DESCRIPTOR descriptor{};
+    bool nvme = query_storage_property(hVolume, StorageAdapterProperty, adapter) && adapter.BusType == BusTypeNvme;
+
+    if (query_storage_property(hVolume, StorageDeviceSeekPenaltyProperty, seek)) {
+        if (seek.IncursSeekPenalty) {
+            info.cls = StorageClass::Hdd;
+        }
+        else if (nvme) {
+            info.cls = StorageClass::Nvme;
+        }
+        else {
+            info.cls = StorageClass::Ssd;
+        }
+    }
+
+    if (nvme) {
+        info.queueDepth = query_nvme_queue_count(hVolume);
+    }
+    else if (query_storage_property(hVolume, StorageDeviceProperty, descriptor)) {
+        info.queueDepth = descriptor.CommandQueueing ? COMMAND_QUEUE_DEPTH : 1;
+    }
+
+    CloseHandle(hVolume);
+    return info;
+}
+
+/*
+    every worker does one synchronous read or write at a time,
+    so the max worker count is also the max I/O depth in flight.
+*/
+struct StoragePolicy {
+    unsigned threads;       // workers running at the start.
+    unsigned maxThreads;    // the controller never goes above.
+    size_t bufferSize;
+    const char* backend;    // a source name of popcap_pak_io.hpp.
+};
+
+inline StoragePolicy storage_policy(StorageClass c) {
+    unsigned cpus = (std::max)(1u, std::thread::hardware_concurrency());
+
+    switch (c) {
+        case StorageClass::Nvme:      return { (std::min)(cpus, 8u), (std::min)(cpus * 2, 32u), 1 << 20, "positional" };
+        case StorageClass::Ssd:       return { (std::min)(cpus, 4u), (std::min)(cpus, 16u), 256 << 10, "positional" };
+        case StorageClass::Hdd:       return { 1, 2, 1 << 20, "readfile" };
+        case StorageClass::Network:   return { 4, 16, 1 << 20, "positional" };   // many requests in flight hide the latency.
+        case StorageClass::Removable: return { 1, 2, 256 << 10, "readfile" };
+        case StorageClass::Ram:       return { cpus, cpus, 1 << 20, "mmap" };
+        default:                      return { (std::min)(cpus, 2u), cpus, 64 << 10, "readfile" };
+    }
+}
+
+/*
+    more workers than the device takes commands only queue up in the driver.
+*/
+inline StoragePolicy storage_policy(const StorageInfo& info) {
+    StoragePolicy p = storage_policy(info.cls);
+
+    if (info.queueDepth > 0) {
+        p.maxThreads = (std::min)(p.maxThreads, info.queueDepth);
+        p.threads = (std::min)(p.threads, p.maxThreads);
+    }
+
+    return p;
+}
+
+inline bool is_fat_file_system(const std::string& fileSystem) {
+    return fileSystem == "FAT" || fileSystem == "FAT32" || fileSystem == "exFAT";
+}
+
+/*
+    both ends must keep up, so the stricter worker counts win,
+    the read backend follows the input and the buffer is the larger of the two.
+    fat and exfat take the lock of the whole volume to create a file, so more than two
+    workers creating files there only wait on each other.
+*/
+inline StoragePolicy storage_policy(const StorageInfo& input, const StorageInfo& output) {
+    StoragePolicy in = storage_policy(input);
+    StoragePolicy out = storage_policy(output);
+
+    if (is_fat_file_system(output.fileSystem)) {
+        out.maxThreads = (std::min)(out.maxThreads, 2u);
+        out.threads = (std::min)(out.threads, out.maxThreads);
+    }
+
+    in.threads = (std::min)(in.threads, out.threads);
+    in.maxThreads = (std::max)(in.threads, (std::min)(in.maxThreads, out.maxThreads));
+    in.bufferSize = (std::max)(in.bufferSize, out.bufferSize);
+    return in;
+}
+
+/*
+    hill climbing on the number of running workers: all `maxWorkers` threads are started,
+    a worker whose id isn't below the running count parks before it takes the next file.
+    every interval the throughput of finished files is compared with the interval before,
+    a move that helped is repeated, a move that hurt is undone, a flat result keeps the count.
+*/
+class ConcurrencyController {
+    static constexpr double TOLERANCE = 0.05;
+
+    unsigned minWorkers;
+    unsigned maxWorkers;
+    unsigned intervalMs;
+    std::atomic<unsigned> active;
+    std::atomic<uint64_t> doneBytes{ 0 };
+    std::atomic<bool> finished{ false };
+
+    std::thread controller;
+    std::mutex mutex;               // parked workers and the controller thread wait on `cv`.
+    std::condition_variable cv;
+    bool stopping = false;
+    uint64_t start = 0;
+    std::vector<std::pair<double, unsigned>> history;   // seconds since start, running workers.
+
+    void run() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        uint64_t lastBytes = 0;
+        uint64_t lastTicks = now_ticks();
+        double lastRate = -1.0;
+        int step = 1;
+
+        while (!cv.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return stopping; })) {
+            uint64_t bytes = doneBytes.load(std::memory_order_relaxed);
+            uint64_t ticks = now_ticks();
+            double rate = (bytes - lastBytes) / ticks_to_seconds(ticks - lastTicks);
+
+            lastBytes = bytes;
+            lastTicks = ticks;
+
+            if (lastRate >= 0 && rate < lastRate * (1 - TOLERANCE)) {
+                step = -step;
+            }
+            else if (lastRate >= 0 && rate <= lastRate * (1 + TOLERANCE)) {
+                lastRate = rate;
+                continue;
+            }
+
+            lastRate = rate;
+
+            unsigned current = active.load(std::memory_order_relaxed);
+            unsigned next = static_cast<unsigned>((std::max)(static_cast<int>(minWorkers),
+                                                  (std::min)(static_cast<int>(maxWorkers), static_cast<int>(current) + step)));
+
+            if (next != current) {
+                active.store(next, std::memory_order_release);
+                history.emplace_back(ticks_to_seconds(ticks - start), next);
+                cv.notify_all();
+            }
+        }
+    }
+public:
+    ConcurrencyController(unsigned initial, unsigned minCount, unsigned maxCount, unsigned interval = 250)
+        : minWorkers{ (std::max)(1u, minCount) }, maxWorkers{ (std::max)((std::max)(1u, minCount), maxCount) },
+          intervalMs{ (std::max)(1u, interval) }, active{ (std::min)((std::max)(minWorkers, initial), maxWorkers) } {}
+
+    ConcurrencyController(const ConcurrencyController&) = delete;
+    ConcurrencyController& operator=(const ConcurrencyController&) = delete;
+
+    ~ConcurrencyController() {
+        stop();
+    }
+
+    unsigned max_workers() const noexcept {
+        return maxWorkers;
+    }
+
+    unsigned running_workers() const noexcept {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    void start_control() {
+        start = now_ticks();
+        history.emplace_back(0.0, active.load(std::memory_order_relaxed));
+        controller = std::thread{ &ConcurrencyController::run, this };
+    }
+
+    /*
+        called by worker `id` before it takes a file, returns at once while it may run.
+    */
+    void wait_turn(unsigned id) {
+        if (id < active.load(std::memory_order_acquire) || finished.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock{ mutex };
+        cv.wait(lock, [&]() {
+            return id < active.load(std::memory_order_acquire) || finished.load(std::memory_order_acquire);
+        });
+    }
+
+    // once per finished file, not per chunk, so it stays off the hot loop.
+    void add_bytes(uint64_t n) noexcept {
+        doneBytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // no more files to hand out, wakes the parked workers so they can exit.
+    void finish() {
+        std::lock_guard<std::mutex> lock{ mutex };
+        finished.store(true, std::memory_order_release);
+        cv.notify_all();
+    }
+
+    void stop() {
+        if (!controller.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            stopping = true;
+        }
+
+        cv.notify_all();
+        controller.join();
+    }
+
+    // call after stop().
+    void print_history(std::ostream& out) const {
+        out << "running workers:";
+
+        for (const std::pair<double, unsigned>& h : history) {
+            out << " " << h.second << " at " << h.first << " s,";
+        }
+
+        out << " max " << maxWorkers << "\n";
+    }
+};
+
+#endif // POPCAP_PAK_STORAGE_HPP
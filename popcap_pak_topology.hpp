@@ -0,0 +1,288 @@
+/**
+ * @author yuanluo2
+ * @brief cpu topology and NUMA aware placement of the extraction workers, written in C++11, only works for windows platform.
+ *
+ * GetLogicalProcessorInformationEx() gives the NUMA nodes, the cores and the L3 caches with the
+ * processors of each one. workers are spread over the nodes round robin, and over the L3 domains
+ * inside a node, each node has its own range of the file list, so a worker takes its files, its
+ * headers and its buffers from its own node, and only steals from other nodes when its own range
+ * is done. placement is off unless WorkerPlacement::instance().enable() is called.
+*/
+#ifndef POPCAP_PAK_TOPOLOGY_HPP
+#define POPCAP_PAK_TOPOLOGY_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+struct CacheDomain {
+    GROUP_AFFINITY affinity;    // processors sharing one L3.
+};
+
+struct NumaNode {
+    DWORD number;
+    GROUP_AFFINITY affinity;
+    std::vector<CacheDomain> l3;
+};
+
+struct CpuTopology {
+    std::vector<NumaNode> nodes;
+    unsigned cores = 0;
+    unsigned logical = 0;
+};
+
+inline unsigned count_bits(KAFFINITY mask) {
+    unsigned n = 0;
+
+    for (; mask != 0; mask &= mask - 1) {
+        ++n;
+    }
+
+    return n;
+}
+
+/*
+    nodes without a L3 of their own, like on old cpus, get one domain of the whole node.
+    an empty topology means the query failed, callers treat it as one node.
+*/
+inline CpuTopology detect_cpu_topology() {
+    CpuTopology topo;
+    DWORD len = 0;
+
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &len);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        return topo;
+    }
+
+    std::unique_ptr<char[]> buf{ new char[len] };
+    if (!GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.get()), &len)) {
+        return topo;
+    }
+
+    std::vector<GROUP_AFFINITY> caches;
+
+    for (DWORD at = 0; at < len; ) {
+        const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.get() + at);
+
+        switch (info->Relationship) {
+            case RelationProcessorCore:
+                ++topo.cores;
+                for (WORD g = 0; g < info->Processor.GroupCount; ++g) {
+                    topo.logical += count_bits(info->Processor.GroupMask[g].Mask);
+                }
+                break;
+            case RelationNumaNode:
+                topo.nodes.push_back(NumaNode{ info->NumaNode.NodeNumber, info->NumaNode.GroupMask, {} });
+                break;
+            case RelationCache:
+                if (info->Cache.Level == 3 && info->Cache.Type == CacheUnified) {
+                    caches.push_back(info->Cache.GroupMask);
+                }
+                break;
+            default:
+                break;
+        }
+
+        at += info->Size;
+    }
+
+    for (NumaNode& node : topo.nodes) {
+        for (const GROUP_AFFINITY& cache : caches) {
+            KAFFINITY shared = cache.Mask & node.affinity.Mask;
+
+            if (cache.Group == node.affinity.Group && shared != 0) {
+                GROUP_AFFINITY domain = node.affinity;
+                domain.Mask = shared;
+                node.l3.push_back(CacheDomain{ domain });
+            }
+        }
+
+        if (node.l3.empty()) {
+            node.l3.push_back(CacheDomain{ node.affinity });
+        }
+    }
+
+    return topo;
+}
+
+/*
+    the NUMA node the calling thread runs on right now, 0 if unknown.
+*/
+inline unsigned current_numa_node() {
+    PROCESSOR_NUMBER processor;
+    WORD node = 0;
+
+    GetCurrentProcessorNumberEx(&processor);
+    return GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+}
+
+enum class PlacementMode {
+    Off,
+    Node,   // an ideal processor on the node, the scheduler may still move the worker.
+    Pin     // hard affinity to the processors of one L3 domain.
+};
+
+class WorkerPlacement {
+    CpuTopology topo;
+    PlacementMode mode = PlacementMode::Off;
+
+    WorkerPlacement() = default;
+public:
+    WorkerPlacement(const WorkerPlacement&) = delete;
+    WorkerPlacement& operator=(const WorkerPlacement&) = delete;
+
+    static WorkerPlacement& instance() {
+        static WorkerPlacement placement;
+        return placement;
+    }
+
+    // call before any worker starts, false if the topology can't be read.
+    bool enable(PlacementMode m) {
+        topo = detect_cpu_topology();
+        mode = topo.nodes.empty() ? PlacementMode::Off : m;
+        return !topo.nodes.empty();
+    }
+
+    const CpuTopology& topology() const noexcept {
+        return topo;
+    }
+
+    // the number of work queues of a parallel extraction, one per node.
+    unsigned queue_count() const noexcept {
+        return mode == PlacementMode::Off ? 1 : static_cast<unsigned>(topo.nodes.size());
+    }
+
+    unsigned queue_of(unsigned worker) const noexcept {
+        return worker % queue_count();
+    }
+
+    /*
+        moves the calling thread, worker `worker`, to its node and returns its queue.
+        called first thing in a worker, before it touches its buffers.
+    */
+    unsigned place(unsigned worker) const {
+        if (mode == PlacementMode::Off) {
+            return 0;
+        }
+
+        unsigned nodeCount = static_cast<unsigned>(topo.nodes.size());
+        const NumaNode& node = topo.nodes[worker % nodeCount];
+        const CacheDomain& domain = node.l3[(worker / nodeCount) % node.l3.size()];
+
+        if (mode == PlacementMode::Pin) {
+            SetThreadGroupAffinity(GetCurrentThread(), &domain.affinity, nullptr);
+        }
+        else {
+            unsigned skip = (worker / nodeCount / static_cast<unsigned>(node.l3.size())) % count_bits(domain.affinity.Mask);
+            PROCESSOR_NUMBER ideal{};
+
+            ideal.Group = domain.affinity.Group;
+            for (BYTE bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+                if ((domain.affinity.Mask >> bit & 1) != 0 && skip-- == 0) {
+                    ideal.Number = bit;
+                    break;
+                }
+            }
+
+            SetThreadIdealProcessorEx(GetCurrentThread(), &ideal, nullptr);
+        }
+
+        return queue_of(worker);
+    }
+
+    /*
+        the NUMA node place() puts `worker` on. with Node the thread only moves there later,
+        so its buffers are taken from this node instead of the one it runs on right now.
+    */
+    unsigned node_of(unsigned worker) const {
+        if (mode == PlacementMode::Off) {
+            return current_numa_node();
+        }
+
+        return static_cast<unsigned>(topo.nodes[worker % topo.nodes.size()].number);
+    }
+
+    void print(std::ostream& out) const {
+        out << "topology: " << topo.nodes.size() << " NUMA nodes, " << topo.cores << " cores, " << topo.logical << " logical processors";
+
+        for (const NumaNode& node : topo.nodes) {
+            out << ", node " << node.number << " has " << count_bits(node.affinity.Mask) << " processors in " << node.l3.size() << " L3";
+        }
+
+        out << (mode == PlacementMode::Pin ? ", workers pinned\n" : "\n");
+    }
+};
+
+/*
+    keeps the affinity and the ideal processor of the calling thread and puts them back when it
+    goes, for a worker that runs on the thread of the caller, so place() doesn't move the caller for good.
+*/
+class ThreadPlacementGuard {
+    GROUP_AFFINITY affinity{};
+    PROCESSOR_NUMBER ideal{};
+    bool saved;
+public:
+    ThreadPlacementGuard() : saved{ GetThreadGroupAffinity(GetCurrentThread(), &affinity) &&
+                                    GetThreadIdealProcessorEx(GetCurrentThread(), &ideal) } {}
+
+    ThreadPlacementGuard(const ThreadPlacementGuard&) = delete;
+    ThreadPlacementGuard& operator=(const ThreadPlacementGuard&) = delete;
+
+    ~ThreadPlacementGuard() {
+        if (saved) {
+            SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+            SetThreadIdealProcessorEx(GetCurrentThread(), &ideal, nullptr);
+        }
+    }
+};
+
+/*
+    the file list cut into one contiguous range per node, each with its own cursor on its own
+    cache line, so workers of different sockets never fight over one counter.
+    a queue whose range is done takes from the next ones, so no worker sits idle at the end.
+*/
+class NodeWorkQueues {
+    struct Cursor {
+        std::atomic<size_t> next{ 0 };
+        size_t end = 0;
+        char pad[128 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    };
+
+    std::unique_ptr<Cursor[]> cursors;
+    unsigned count;
+    size_t total;
+public:
+    NodeWorkQueues(size_t items, unsigned queues) : cursors{ new Cursor[queues] }, count{ queues }, total{ items } {
+        for (unsigned q = 0; q < count; ++q) {
+            cursors[q].next.store(items * q / count, std::memory_order_relaxed);
+            cursors[q].end = items * (q + 1) / count;
+        }
+    }
+
+    // the next item of `queue` or of the queues after it, `total` when all are done.
+    size_t take(unsigned queue) noexcept {
+        for (unsigned k = 0; k < count; ++k) {
+            Cursor& c = cursors[(queue + k) % count];
+
+            if (c.next.load(std::memory_order_relaxed) < c.end) {
+                size_t i = c.next.fetch_add(1, std::memory_order_relaxed);
+
+                if (i < c.end) {
+                    return i;
+                }
+            }
+        }
+
+        return total;
+    }
+};
+
+#endif // POPCAP_PAK_TOPOLOGY_HPP
@@ -0,0 +1,208 @@
+/**
+ * @author yuanluo2
+ * @brief span tracing of the extraction, exported as chrome trace-event JSON, written in C++11, only works for windows platform.
+ *
+ * every thread records its spans into its own ring buffer, the oldest spans are overwritten
+ * when it's full. the JSON file loads in chrome://tracing and ui.perfetto.dev.
+ * when tracing is off, a span costs one relaxed atomic load.
+*/
+#ifndef POPCAP_PAK_TRACE_HPP
+#define POPCAP_PAK_TRACE_HPP
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <Windows.h>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+inline uint64_t now_ticks() noexcept {
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return static_cast<uint64_t>(li.QuadPart);
+}
+
+inline double ticks_to_seconds(uint64_t ticks) noexcept {
+    static const double freq = []() {
+        LARGE_INTEGER li;
+        QueryPerformanceFrequency(&li);
+        return static_cast<double>(li.QuadPart);
+    }();
+
+    return ticks / freq;
+}
+
+/*
+    `name` and `detail` must outlive the tracer, they are string literals or file names of the header.
+*/
+struct TraceEvent {
+    const char* name;
+    const char* detail;
+    uint64_t start;
+    uint64_t end;
+};
+
+class TraceRing {
+    std::vector<TraceEvent> events;
+    size_t next = 0;
+    uint64_t total = 0;
+public:
+    const uint32_t tid;
+
+    TraceRing(uint32_t id, size_t capacity) : events(capacity > 0 ? capacity : 1), tid{ id } {}
+
+    void push(const TraceEvent& e) noexcept {
+        events[next] = e;
+        next = next + 1 == events.size() ? 0 : next + 1;
+        ++total;
+    }
+
+    uint64_t dropped() const noexcept {
+        return total > events.size() ? total - events.size() : 0;
+    }
+
+    // oldest first.
+    template<typename Fn>
+    void for_each(Fn fn) const {
+        size_t count = total < events.size() ? static_cast<size_t>(total) : events.size();
+        size_t first = total < events.size() ? 0 : next;
+
+        for (size_t i = 0; i < count; ++i) {
+            fn(events[(first + i) % events.size()]);
+        }
+    }
+};
+
+class Tracer {
+    std::atomic<bool> on{ false };
+    size_t capacity = 1 << 16;
+    uint64_t origin = 0;
+    std::mutex mutex;       // only taken when a thread records its first span.
+    std::vector<std::unique_ptr<TraceRing>> rings;
+
+    Tracer() = default;
+
+    TraceRing& ring() {
+        thread_local TraceRing* r = nullptr;
+
+        if (r == nullptr) {
+            std::lock_guard<std::mutex> lock{ mutex };
+            rings.emplace_back(new TraceRing{ static_cast<uint32_t>(rings.size()), capacity });
+            r = rings.back().get();
+        }
+
+        return *r;
+    }
+
+    static void write_json_string(std::ostream& out, const char* s) {
+        out << '"';
+
+        for (; *s != '\0'; ++s) {
+            unsigned char c = static_cast<unsigned char>(*s);
+
+            if (c == '"' || c == '\\') {
+                out << '\\' << *s;
+            }
+            else if (c < 0x20) {
+                out << ' ';
+            }
+            else {
+                out << *s;
+            }
+        }
+
+        out << '"';
+    }
+public:
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const noexcept {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    /*
+        call before any worker thread starts, `capacity` is the ring size of each thread.
+    */
+    void enable(size_t ringCapacity) {
+        capacity = ringCapacity;
+        origin = now_ticks();
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    void record(const char* name, const char* detail, uint64_t start, uint64_t end) {
+        TraceEvent e{ name, detail, start, end };
+        ring().push(e);
+    }
+
+    /*
+        call after all worker threads are joined.
+    */
+    bool write_json(std::ostream& out) {
+        std::lock_guard<std::mutex> lock{ mutex };
+        bool first = true;
+        uint64_t dropped = 0;
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        for (const std::unique_ptr<TraceRing>& r : rings) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r->tid
+                << ",\"args\":{\"name\":\"" << (r->tid == 0 ? "main" : "worker") << " " << r->tid << "\"}}";
+            first = false;
+            dropped += r->dropped();
+
+            r->for_each([&](const TraceEvent& e) {
+                double ts = ticks_to_seconds(e.start - origin) * 1e6;
+                double dur = ticks_to_seconds(e.end - e.start) * 1e6;
+
+                out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << r->tid
+                    << ",\"ts\":" << ts << ",\"dur\":" << dur;
+
+                if (e.detail != nullptr) {
+                    out << ",\"args\":{\"file\":";
+                    write_json_string(out, e.detail);
+                    out << "}";
+                }
+
+                out << "}";
+            });
+        }
+
+        out << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+/*
+    records its own scope as one span.
+*/
+class TraceSpan {
+    const char* name;
+    const char* detail;
+    uint64_t start;
+public:
+    explicit TraceSpan(const char* n, const char* d = nullptr) noexcept
+        : name{ n }, detail{ d }, start{ Tracer::instance().enabled() ? now_ticks() : 0 } {}
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan() {
+        if (start != 0) {
+            Tracer::instance().record(name, detail, start, now_ticks());
+        }
+    }
+};
+
+#endif // POPCAP_PAK_TRACE_HPP
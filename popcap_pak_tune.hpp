@@ -0,0 +1,368 @@
+/**
+ * @author yuanluo2
+ * @brief host self-test and tuned settings of the extractor, written in C++11, only works for windows platform.
+ *
+ * `popcap_pak_extractor bench` generates a temporary synthetic pak, measures decode speed,
+ * read and write bandwidth and the small file create rate, then extracts the pak through the
+ * same engines the extractor runs, and writes the fastest threads / backend / buffer size as a
+ * config file, which `--config=FILE` loads again.
+*/
+#ifndef POPCAP_PAK_TUNE_HPP
+#define POPCAP_PAK_TUNE_HPP
+
+#include "popcap_pak_corpus.hpp"
+#include "popcap_pak_io.hpp"
+
+#include <string>
+#include <set>
+
+/*
+    a backend of the extractor is a source of EXTRACT_ENGINES, writing through WinFile
+    with the scalar decoder like the extractor does.
+*/
+inline bool is_extract_backend(const ExtractEngine& e) {
+    return std::strcmp(e.sink, WinFile::name()) == 0 && std::strcmp(e.decoder, ScalarDecoder::name()) == 0;
+}
+
+inline const ExtractEngine* find_extract_backend(const std::string& name) {
+    return find_extract_engine(name, WinFile::name(), ScalarDecoder::name());
+}
+
+/*
+    the defaults are what the extractor does without any option.
+*/
+struct TuneConfig {
+    unsigned threads = 1;
+    std::string backend = "ifstream";
+    size_t bufferSize = 8192;
+
+    bool is_default() const {
+        return backend == "ifstream" && bufferSize == 8192;
+    }
+};
+
+/*
+    a config file has one `key=value` per line, the keys are the long options of the extractor,
+    so every line is turned into `--key=value` and parsed like the command line.
+    empty lines and lines starting with `#` are skipped.
+*/
+inline bool load_config_options(const char* path, std::vector<std::string>& options) {
+    std::ifstream in{ path };
+    std::string line;
+
+    if (!in.is_open()) {
+        return false;
+    }
+
+    while (std::getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        size_t last = line.find_last_not_of(" \t\r");
+
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+
+        options.push_back("--" + line.substr(first, last - first + 1));
+    }
+
+    return true;
+}
+
+/*
+    deletes what an extraction of `header` created under `rootPath`, deepest dirs first.
+*/
+inline void remove_extracted_tree(const Header& header, const std::string& rootPath) {
+    std::array<char, MAX_PATH> pathBuf;
+    std::set<std::string> dirs;
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        path_concatenate(pathBuf, rootPath.c_str(), attr.fileName.get());
+        DeleteFile(pathBuf.data());
+
+        std::string dir = pathBuf.data();
+        for (size_t pos = dir.rfind('\\'); pos != std::string::npos && pos > rootPath.size(); pos = dir.rfind('\\')) {
+            dir.erase(pos);
+            dirs.insert(dir);
+        }
+    }
+
+    std::vector<std::string> ordered(dirs.begin(), dirs.end());
+    std::sort(ordered.begin(), ordered.end(), [](const std::string& a, const std::string& b) {
+        return a.size() > b.size();
+    });
+
+    for (const std::string& dir : ordered) {
+        RemoveDirectory(dir.c_str());
+    }
+
+    RemoveDirectory(rootPath.c_str());
+}
+
+/*
+    flushes the files an earlier extraction of `header` wrote under `rootPath` and drops their
+    cached pages, so the write-back of one run doesn't spill into the next one.
+*/
+inline void drop_extracted_cache(const Header& header, const std::string& rootPath) {
+    std::array<char, MAX_PATH> pathBuf;
+
+    for (const FileAttr& attr : header.fileAttrList) {
+        path_concatenate(pathBuf, rootPath.c_str(), attr.fileName.get());
+
+        HANDLE h = CreateFile(pathBuf.data(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h != INVALID_HANDLE_VALUE) {
+            FlushFileBuffers(h);
+            CloseHandle(h);
+            drop_file_cache(pathBuf.data());
+        }
+    }
+}
+
+struct SelfBenchOptions {
+    std::string profile = "small";
+    std::vector<unsigned> threads = { 1, 2, 4, 8 };
+    std::vector<size_t> bufferSizes = { 8 << 10, 64 << 10, 256 << 10, 1 << 20 };
+    unsigned repeat = 3;
+    std::string workDir = "popcap_selftest_tmp";
+    std::string configPath = "popcap_pak.conf";
+};
+
+class SelfBench {
+    const SelfBenchOptions& opt;
+    std::string pakPath;
+    std::string rootPath;
+    Header header;
+    uint64_t bodyBytes = 0;
+    std::vector<std::string> notes;     // measurements, written as comments into the config.
+
+    /*
+        best of `opt.repeat` runs in seconds, `setup` is not timed, negative if `fn` failed.
+    */
+    template<typename Setup, typename Fn>
+    double best_seconds(Setup setup, Fn fn) {
+        double best = -1.0;
+
+        for (unsigned i = 0; i < opt.repeat; ++i) {
+            setup();
+
+            uint64_t start = now_ticks();
+            if (!fn()) {
+                return -1.0;
+            }
+
+            double seconds = ticks_to_seconds(now_ticks() - start);
+            best = best < 0 || seconds < best ? seconds : best;
+        }
+
+        return best;
+    }
+
+    void note(const std::string& what, double seconds, double amount, const char* unit) {
+        std::string line = what + ": ";
+
+        if (seconds > 0) {
+            char rate[64];
+            std::snprintf(rate, sizeof(rate), "%.1f %s", amount / seconds, unit);
+            line += rate;
+        }
+        else {
+            line += "failed";
+        }
+
+        std::cout << "  " << line << "\n";
+        notes.push_back(line);
+    }
+
+    double time_extract(ExtractFn fn, size_t bufSize, unsigned threads) {
+        return best_seconds([&]() { remove_extracted_tree(header, rootPath); }, [&]() {
+            return fn(header, pakPath.c_str(), rootPath.c_str(), bufSize, threads, nullptr, nullptr);
+        });
+    }
+
+    /*
+        the pak was just generated or extracted and is in the file cache, so every read run drops
+        it first, and the write run flushes inside the timed region, both measure the storage.
+    */
+    void bench_host() {
+        std::vector<char> buf(64 << 20, 0x5a);
+        std::string writePath = opt.workDir + "\\write.bin";
+        std::string smallDir = opt.workDir + "\\small";
+        const uint32_t smallFiles = 1000;
+
+        double t = best_seconds([]() {}, [&]() {
+            decode_bytes(buf.data(), buf.size());
+            return true;
+        });
+        note("decode", t, buf.size() / 1048576.0, "MB/s");
+
+        t = best_seconds([&]() { drop_file_cache(pakPath.c_str()); }, [&]() {
+            std::error_code ec;
+            ReadFileSource source;
+            uint64_t offset = 0;
+            size_t n;
+
+            if (!source.init(pakPath.c_str(), ec)) {
+                return false;
+            }
+
+            while ((n = source.read(offset, buf.data(), 1 << 20, ec)) > 0) {
+                offset += n;
+            }
+
+            return true;
+        });
+        note("read", t, (header.headerSize + bodyBytes) / 1048576.0, "MB/s");
+
+        t = best_seconds([&]() { DeleteFile(writePath.c_str()); }, [&]() {
+            std::error_code ec;
+            WinFile wf;
+            bool ok = wf.init(writePath.c_str(), ec);
+
+            for (size_t n = 0; ok && n < buf.size(); n += 1 << 20) {
+                ok = wf.write_data(buf.data() + n, 1 << 20, ec);
+            }
+
+            wf.close();
+            return ok && flush_path(writePath.c_str(), false);
+        });
+        note("write", t, buf.size() / 1048576.0, "MB/s");
+        DeleteFile(writePath.c_str());
+
+        CreateDirectory(smallDir.c_str(), nullptr);
+
+        auto removeSmall = [&]() {
+            for (uint32_t i = 0; i < smallFiles; ++i) {
+                DeleteFile((smallDir + "\\" + std::to_string(i)).c_str());
+            }
+        };
+
+        t = best_seconds(removeSmall, [&]() {
+            std::error_code ec;
+            bool ok = true;
+
+            for (uint32_t i = 0; ok && i < smallFiles; ++i) {
+                WinFile wf;
+                ok = wf.init((smallDir + "\\" + std::to_string(i)).c_str(), ec) && wf.write_data(buf.data(), 4096, ec);
+            }
+
+            return ok;
+        });
+        note("create 4K files", t, smallFiles, "files/s");
+
+        removeSmall();
+        RemoveDirectory(smallDir.c_str());
+    }
+
+    /*
+        a full matrix of threads, backends and buffer sizes takes too long on a big host,
+        so each setting is searched once with the best of the ones before it.
+    */
+    TuneConfig tune() {
+        TuneConfig config;
+        double best = -1.0;
+        const ExtractEngine* backend = find_extract_backend(config.backend);
+
+        for (unsigned threads : opt.threads) {
+            double t = time_extract(backend->fn, config.bufferSize, threads);
+            note("extract " + std::string(backend->source) + ", threads=" + std::to_string(threads), t, bodyBytes / 1048576.0, "MB/s");
+
+            if (t > 0 && (best < 0 || t < best)) {
+                best = t;
+                config.threads = threads;
+            }
+        }
+
+        for (const ExtractEngine& b : EXTRACT_ENGINES) {
+            if (&b == backend || !is_extract_backend(b)) {
+                continue;   // already timed above, or not a backend.
+            }
+
+            double t = time_extract(b.fn, config.bufferSize, config.threads);
+            note("extract " + std::string(b.source) + ", threads=" + std::to_string(config.threads), t, bodyBytes / 1048576.0, "MB/s");
+
+            if (t > 0 && (best < 0 || t < best)) {
+                best = t;
+                config.backend = b.source;
+            }
+        }
+
+        backend = find_extract_backend(config.backend);
+
+        for (size_t bufSize : opt.bufferSizes) {
+            double t = time_extract(backend->fn, bufSize, config.threads);
+            note("extract " + config.backend + ", threads=" + std::to_string(config.threads) +
+                 ", buffer-size=" + std::to_string(bufSize), t, bodyBytes / 1048576.0, "MB/s");
+
+            if (t > 0 && (best < 0 || t < best)) {
+                best = t;
+                config.bufferSize = bufSize;
+            }
+        }
+
+        return config;
+    }
+
+    bool write_config(const TuneConfig& config) const {
+        std::ofstream out{ opt.configPath };
+
+        out << "# written by `popcap_pak_extractor bench` for this host, load it with --config=" << opt.configPath << "\n";
+        out << "# measured with the `" << opt.profile << "` corpus profile:\n";
+
+        for (const std::string& line : notes) {
+            out << "#   " << line << "\n";
+        }
+
+        out << "threads=" << config.threads << "\n";
+        out << "backend=" << config.backend << "\n";
+        out << "buffer-size=" << config.bufferSize << "\n";
+
+        return static_cast<bool>(out);
+    }
+public:
+    explicit SelfBench(const SelfBenchOptions& o) : opt{ o } {}
+
+    bool run() {
+        const CorpusProfile* profile = find_corpus_profile(opt.profile.c_str());
+
+        if (profile == nullptr) {
+            std::cerr << "unknown profile: `" << opt.profile << "`\n";
+            return false;
+        }
+
+        if (!is_dir_exist(opt.workDir.c_str()) && !CreateDirectory(opt.workDir.c_str(), nullptr)) {
+            std::cerr << "can't create work dir: `" << opt.workDir << "`\n";
+            return false;
+        }
+
+        pakPath = opt.workDir + "\\" + profile->name + ".pak";
+        rootPath = opt.workDir + "\\out";
+
+        std::cout << "generating `" << pakPath << "` ...\n";
+        if (!generate_corpus_pak(*profile, pakPath.c_str(), header)) {
+            return false;
+        }
+
+        for (const FileAttr& attr : header.fileAttrList) {
+            bodyBytes += attr.fileSize;
+        }
+
+        bench_host();
+        TuneConfig config = tune();
+
+        remove_extracted_tree(header, rootPath);
+        DeleteFile(pakPath.c_str());
+        RemoveDirectory(opt.workDir.c_str());
+
+        std::cout << "recommended: --threads=" << config.threads << " --backend=" << config.backend
+                  << " --buffer-size=" << config.bufferSize << "\n";
+
+        if (!write_config(config)) {
+            std::cerr << "can't write config: `" << opt.configPath << "`\n";
+            return false;
+        }
+
+        std::cout << "config is saved at `" << opt.configPath << "`\n";
+        return true;
+    }
+};
+
+#endif // POPCAP_PAK_TUNE_HPP
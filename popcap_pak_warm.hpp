@@ -0,0 +1,311 @@
+/**
+ * @author yuanluo2
+ * @brief file cache warm-up of a .pak file, written in C++11, only works for windows platform (windows 8 and later).
+ *
+ * the pak is mapped, the header and the chosen entries are handed to PrefetchVirtualMemory(),
+ * the madvise(MADV_WILLNEED) of windows, which reads them with large I/Os, then workers touch
+ * every page of them, the MAP_POPULATE of windows. after the process exits, the pages stay in
+ * the file cache for whoever reads the pak next. windows has no mincore(), so nothing is said
+ * about how much of the pak was cached before.
+*/
+#ifndef POPCAP_PAK_WARM_HPP
+#define POPCAP_PAK_WARM_HPP
+
+#include "popcap_pak_io.hpp"
+
+#include <string>
+#include <set>
+#include <map>
+#include <iterator>
+#include <unordered_map>
+
+struct WarmOptions {
+    std::vector<std::string> entries;   // names or dir prefixes, empty means all of them.
+    std::string accessTrace;            // warm in the order of this trace, empty for none.
+    unsigned threads = 4;
+    bool populate = true;
+};
+
+/*
+    a byte range of the pak file.
+*/
+struct WarmRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+/*
+    entry names of an access trace, first access first.
+    it is either one name per line, or the chrome trace written by --trace, whose file spans
+    carry the name as `"file":"..."`. the spans are grouped by thread there, so they are put
+    back in the order of their `"ts"`, and a trace of a real run can be replayed directly.
+*/
+inline bool load_access_trace(const char* path, std::vector<std::string>& names) {
+    std::ifstream in{ path };
+    std::string line;
+    std::vector<std::pair<double, std::string>> accesses;
+
+    if (!in.is_open()) {
+        return false;
+    }
+
+    while (std::getline(in, line)) {
+        size_t pos = line.find("\"file\":\"");
+        size_t ts = line.find("\"ts\":");
+
+        if (pos == std::string::npos) {
+            if (!line.empty() && line[0] != '{' && line[0] != '[' && line[0] != ']') {
+                accesses.emplace_back(static_cast<double>(accesses.size()), line.back() == '\r' ? line.substr(0, line.size() - 1) : line);
+            }
+
+            continue;
+        }
+
+        std::string name;
+        for (pos += 8; pos < line.size() && line[pos] != '"'; ++pos) {
+            if (line[pos] == '\\' && pos + 1 < line.size()) {
+                ++pos;
+            }
+
+            name += line[pos];
+        }
+
+        accesses.emplace_back(ts == std::string::npos ? 0.0 : std::atof(line.c_str() + ts + 5), name);
+    }
+
+    std::stable_sort(accesses.begin(), accesses.end(), [](const std::pair<double, std::string>& a,
+                                                          const std::pair<double, std::string>& b) {
+        return a.first < b.first;
+    });
+
+    for (std::pair<double, std::string>& a : accesses) {
+        names.push_back(std::move(a.second));
+    }
+
+    return true;
+}
+
+constexpr uint64_t WARM_PAGE_SIZE = 4096;
+constexpr uint64_t WARM_CHUNK_SIZE = 4 << 20;   // unit of work of one worker.
+
+class PakWarmer {
+    const WarmOptions& opt;
+    std::vector<WarmRange> ranges;
+    std::map<uint64_t, uint64_t> chosenPages;  // first page -> end page, of all the ranges so far.
+    uint64_t rangeBytes = 0;
+    size_t entryCount = 0;
+
+    static bool matches(const std::string& name, const std::vector<std::string>& patterns) {
+        for (const std::string& p : patterns) {
+            if (name == p || (name.size() > p.size() && name.compare(0, p.size(), p) == 0 &&
+                              (p.back() == '\\' || name[p.size()] == '\\'))) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void add_pages(uint64_t first, uint64_t end) {
+        ranges.push_back(WarmRange{ first * WARM_PAGE_SIZE, (end - first) * WARM_PAGE_SIZE });
+        rangeBytes += (end - first) * WARM_PAGE_SIZE;
+    }
+
+    /*
+        adds the pages of a byte range that no earlier range has, in order, so small entries
+        sharing a page or an entry chosen twice are not prefetched and touched again.
+    */
+    void add_range(uint64_t offset, uint64_t length) {
+        uint64_t first = offset / WARM_PAGE_SIZE;
+        uint64_t end = (offset + length + WARM_PAGE_SIZE - 1) / WARM_PAGE_SIZE;
+        uint64_t at = first;
+
+        if (length == 0) {
+            return;
+        }
+
+        auto it = chosenPages.upper_bound(first);
+        if (it != chosenPages.begin() && std::prev(it)->second > first) {
+            --it;
+        }
+
+        for (; at < end && it != chosenPages.end() && it->first < end; ++it) {
+            if (it->first > at) {
+                add_pages(at, it->first);
+            }
+
+            at = (std::max)(at, it->second);
+        }
+
+        if (at < end) {
+            add_pages(at, end);
+        }
+
+        // merges [first, end) with the chosen pages it touches.
+        it = chosenPages.upper_bound(first);
+        if (it != chosenPages.begin() && std::prev(it)->second >= first) {
+            --it;
+        }
+
+        while (it != chosenPages.end() && it->first <= end) {
+            first = (std::min)(first, it->first);
+            end = (std::max)(end, it->second);
+            it = chosenPages.erase(it);
+        }
+
+        chosenPages[first] = end;
+    }
+
+    void add_entry(const FileAttr& attr) {
+        add_range(attr.offset, attr.fileSize);
+        ++entryCount;
+    }
+
+    /*
+        the header comes first, then the traced entries in trace order, then the other chosen entries.
+    */
+    bool select_ranges(const Header& header) {
+        std::unordered_map<std::string, const FileAttr*> byName;
+        std::set<const FileAttr*> added;
+
+        add_range(0, header.headerSize);
+
+        for (const FileAttr& attr : header.fileAttrList) {
+            byName[attr.fileName.get()] = &attr;
+        }
+
+        if (!opt.accessTrace.empty()) {
+            std::vector<std::string> trace;
+
+            if (!load_access_trace(opt.accessTrace.c_str(), trace)) {
+                std::cerr << "can't open access trace: `" << opt.accessTrace << "`\n";
+                return false;
+            }
+
+            for (const std::string& name : trace) {
+                auto it = byName.find(name);
+
+                if (it != byName.end() && added.insert(it->second).second) {
+                    add_entry(*it->second);
+                }
+            }
+        }
+
+        // with a trace and no names, only the traced entries are warmed.
+        if (!opt.entries.empty() || opt.accessTrace.empty()) {
+            for (const FileAttr& attr : header.fileAttrList) {
+                if ((opt.entries.empty() || matches(attr.fileName.get(), opt.entries)) && added.insert(&attr).second) {
+                    add_entry(attr);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // rounds out to whole pages, the view starts at offset 0 and is page aligned.
+    static WIN32_MEMORY_RANGE_ENTRY page_range(const char* view, const WarmRange& r) {
+        uint64_t first = r.offset & ~(WARM_PAGE_SIZE - 1);
+        uint64_t last = (r.offset + r.length + WARM_PAGE_SIZE - 1) & ~(WARM_PAGE_SIZE - 1);
+        WIN32_MEMORY_RANGE_ENTRY e;
+
+        e.VirtualAddress = const_cast<char*>(view + first);
+        e.NumberOfBytes = static_cast<SIZE_T>(last - first);
+        return e;
+    }
+
+    /*
+        reads one byte of every page, split into chunks so a few big entries still keep all workers busy.
+    */
+    void populate(const char* view) {
+        std::vector<WarmRange> chunks;
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::thread> workers;
+
+        for (const WarmRange& r : ranges) {
+            for (uint64_t at = 0; at < r.length; at += WARM_CHUNK_SIZE) {
+                chunks.push_back(WarmRange{ r.offset + at, (std::min)(WARM_CHUNK_SIZE, r.length - at) });
+            }
+        }
+
+        auto work = [&]() {
+            unsigned char sum = 0;
+
+            for (size_t i = next++; i < chunks.size(); i = next++) {
+                const volatile char* p = view + chunks[i].offset;
+
+                for (uint64_t at = 0; at < chunks[i].length; at += WARM_PAGE_SIZE) {
+                    sum ^= static_cast<unsigned char>(p[at]);
+                }
+
+                sum ^= static_cast<unsigned char>(p[chunks[i].length - 1]);
+            }
+
+            (void)sum;
+        };
+
+        for (unsigned i = 0; i < (std::max)(1u, opt.threads); ++i) {
+            workers.emplace_back(work);
+        }
+
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+public:
+    explicit PakWarmer(const WarmOptions& o) : opt{ o } {}
+
+    bool warm(const char* pakPath) {
+        Header header;
+        HeaderParser parser;
+        HeaderValidator validator;
+        MappedSource mapped;
+        std::ifstream f{ pakPath, std::ios::binary };
+        std::error_code ec;
+
+        if (!f.is_open()) {
+            std::cerr << "can't open file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        if (!parser.parse(header, f) || !validator.validate(header, get_pak_file_size(f))) {
+            std::cerr << "invalid .pak file: `" << pakPath << "`\n";
+            return false;
+        }
+
+        if (!select_ranges(header)) {
+            return false;
+        }
+
+        // a 32 bit build can't map a pak larger than its address space.
+        if (!mapped.init(pakPath, ec)) {
+            std::cerr << "can't map file: `" << pakPath << "`, " << ec.message() << "\n";
+            return false;
+        }
+
+        const char* view = mapped.data();
+        uint64_t start = now_ticks();
+        std::vector<WIN32_MEMORY_RANGE_ENTRY> prefetch;
+
+        for (const WarmRange& r : ranges) {
+            prefetch.push_back(page_range(view, r));
+        }
+
+        if (!PrefetchVirtualMemory(GetCurrentProcess(), prefetch.size(), prefetch.data(), 0)) {
+            std::cerr << "PrefetchVirtualMemory failed, only touching the pages\n";
+        }
+
+        if (opt.populate) {
+            populate(view);
+        }
+
+        double seconds = ticks_to_seconds(now_ticks() - start);
+
+        std::cout << "warmed " << entryCount << " entries and the header, " << rangeBytes / 1048576.0 << " MB of pages in "
+                  << seconds << " s\n";
+        return true;
+    }
+};
+
+#endif // POPCAP_PAK_WARM_HPP